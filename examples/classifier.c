@@ -1,44 +1,64 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <assert.h>
-#include <pthread.h>
 
 #include "utils.h"
 #include "parser.h"
 #include "data.h"
+#include "data_loader.h"
+#include "file_reader.h"
+#include "image_pack.h"
+#include "image_archive.h"
+#include "image_stream.h"
 #include "option_list.h"
 #include "network.h"
 
-pthread_mutex_t mutex;
-int load_over;
-batch train_global;
-
 typedef struct load_args{
-    char **paths;
+    path_table *paths;
     char **labels;
-    int classes, train_set_size, w, h, c, batch_size, flip, test;
+    int classes, w, h, c, batch_size, flip, test;
     float hue, saturation, exposure, mean_value, scale;
+    image_pack *pack;
+    image_archive *archive;
+    image_stream *stream;
+    image_cache *cache;
+    sampler *samples;
+    uint64_t position;      // of the samples of ticket 0
 } load_args;
 
-void *load_data_in_thread(void *args_point)
+/* item is a batch loaded before or zeroed, its buffers are reused; batch ticket takes the samples from its position,
+ * the reads of the images of batch next start before it decodes */
+static void load_classifier_batch(void *args_point, void *item, uint64_t ticket, uint64_t next)
 {
     load_args args = *(load_args *)args_point;
-    while(1){
-        pthread_mutex_lock(&mutex);
-        if(load_over == 0){
-            train_global = random_batch(
-                args.paths, args.batch_size, args.labels, args.classes,
-                args.train_set_size, args.w, args.h, args.c,
-                args.hue, args.saturation, args.exposure, args.flip, args.mean_value, args.scale,
-                args.test);
-            //printf("load_over\n");
-            load_over = 1;
-            pthread_mutex_unlock(&mutex);
-        } else {
-            pthread_mutex_unlock(&mutex);
-        }
-        usleep(10000);
+    batch *b = (batch *)item;
+    uint64_t position = args.position + ticket * args.batch_size;
+    uint64_t next_position = next == (uint64_t)-1 ? next : args.position + next * args.batch_size;
+    if(args.pack){
+        image_pack_batch(args.pack, b, args.samples, position, args.batch_size, args.hue, args.saturation, args.exposure,
+                         args.flip, args.mean_value, args.scale, args.test);
+        return;
+    }
+    if(args.stream){
+        image_stream_batch(args.stream, b, position, args.batch_size, args.hue, args.saturation, args.exposure, args.flip,
+                           args.mean_value, args.scale);
+        return;
+    }
+    if(args.archive){
+        image_archive_batch(args.archive, b, args.samples, position, args.batch_size, args.w, args.h, args.c, args.hue,
+                            args.saturation, args.exposure, args.flip, args.mean_value, args.scale, args.test);
+        return;
     }
+    random_batch(
+        args.paths, b, args.samples, position, next_position, args.batch_size, args.labels, args.classes,
+        args.w, args.h, args.c,
+        args.hue, args.saturation, args.exposure, args.flip, args.mean_value, args.scale,
+        args.test, args.cache);
+}
+
+static void free_classifier_batch(void *item)
+{
+    free_batch((batch *)item);
 }
 
 void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
@@ -46,7 +66,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
     char *base = basecfg(cfgfile);   // get projetc name by cfgfile, cifar.cfg -> cifar
     //fprintf(stderr, "train data base name: %s\n", base);
     //fprintf(stderr, "the number of GPU: %d\n", ngpus);
-    srand(time(0));
+    rand_seed(time(0));
     network *net = load_network(cfgfile, weightfile);
     net->output_layer = net->n - 1;
     struct list *options = read_data_cfg(datacfg);
@@ -57,49 +77,84 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
 
     int train_set_size = 0;
     int batch_num = 0;
-    char **paths = NULL;
-    struct list *plist = NULL;
-    int train_data_type = option_find_int(options, "train_data_type", 1);    //  0: csv, 1: load to memory
+    path_table *paths = NULL;
+    // 0: csv, 1: load to memory, 3: pack, 4: archive, 5: pack streamed through a shuffle buffer
+    int train_data_type = option_find_int(options, "train_data_type", 1);
     batch *all_train_data = NULL;
+    image_pack *pack = NULL;
+    image_archive *archive = NULL;
+    image_stream *stream = NULL;
     if(0 == train_data_type) {
         train_set_size = option_find_int(options, "train_num", 0);
         all_train_data = load_csv_image_to_memory(train_list, net->batch * net->subdivisions, labels, net->classes, train_set_size,
                                                   &batch_num, net->w, net->h, net->c, net->hue, net->saturation,
                                                   net->exposure, net->test);
     } else if(1 == train_data_type){
-        plist = get_paths(train_list);
-        paths = (char **)list_to_array(plist);
-        train_set_size = plist->size;
+        paths = load_path_table(train_list);
+        resolve_path_labels(paths, labels, net->classes);
+        train_set_size = paths->count;
         train_set_size = option_find_int(options, "train_num", train_set_size);
         all_train_data = load_image_to_memory(paths, net->batch * net->subdivisions, labels, net->classes, train_set_size, &batch_num,
                                               net->w, net->h, net->c, net->hue, net->saturation, net->exposure,
                                               net->flip, net->mean_value, net->scale, net->test);
+    } else if(3 == train_data_type){
+        pack = open_image_pack(train_list);
+        train_set_size = pack->count;
+        if(pack->w != net->w || pack->h != net->h || pack->c != net->c){
+            fprintf(stderr, "%s: images are %dx%dx%d, the network input is %dx%dx%d\n", train_list,
+                    pack->w, pack->h, pack->c, net->w, net->h, net->c);
+            exit(-1);
+        }
+    } else if(4 == train_data_type){
+        archive = open_image_archive(train_list);
+        train_set_size = archive->count;
+    } else if(5 == train_data_type){
+        stream = open_image_stream(train_list, (size_t)option_find_int(options, "shuffle_mb", 1024) << 20,
+                                   option_find_int(options, "stream_readers", 4),
+                                   (size_t)option_find_int(options, "read_mb", 8) << 20);
+        train_set_size = stream->count;
+        if(stream->w != net->w || stream->h != net->h || stream->c != net->c){
+            fprintf(stderr, "%s: images are %dx%dx%d, the network input is %dx%dx%d\n", train_list,
+                    stream->w, stream->h, stream->c, net->w, net->h, net->c);
+            exit(-1);
+        }
     } else {
-        plist = get_paths(train_list);
-        paths = (char **)list_to_array(plist);
-        train_set_size = plist->size;
+        paths = load_path_table(train_list);
+        resolve_path_labels(paths, labels, net->classes);
+        train_set_size = paths->count;
         train_set_size = option_find_int(options, "train_num", train_set_size);
     }
     double time;
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
-    int max_epoch = (int)net->max_batches * net->batch * net->subdivisions / train_set_size;
+    int replica = option_find_int(options, "replica", 0);
+    int replicas = option_find_int(options, "replicas", 1);
+    int max_epoch = sampler_epoch((uint64_t)net->max_batches * net->batch * net->subdivisions, train_set_size, 0,
+                                  replicas);
     fprintf(stderr, "image net has seen: %lu, train_set_size: %d, max_batches of net: %d, net->classes: %d,"
            "net->batch: %d, max_epoch: %d\n\n",
            net->seen, train_set_size, net->max_batches, net->classes, net->batch, max_epoch);
 
     net->batch_train = net->seen / net->batch / net->subdivisions;
-    net->epoch = net->seen / train_set_size;
+    net->epoch = sampler_epoch(net->seen, train_set_size, replica, replicas);
     float avg_loss = -1;
     float max_accuracy = -1;
     int max_accuracy_batch = 0;
-    pthread_t load_data_thread_id;
-    if(0 != train_data_type && 1 != train_data_type){
-        load_args args = {0};
+    data_loader *loader = NULL;
+    image_cache *cache = NULL;
+    load_args args = {0};
+    /* every image, or every batch kept in memory, once per epoch from the position the weights were saved at;
+     * replica / replicas split the images between data-parallel processes */
+    int in_memory = 0 == train_data_type || 1 == train_data_type;
+    sampler *samples = make_sampler(in_memory ? batch_num : train_set_size, option_find_int(options, "sample_seed", 1),
+                                    replica, replicas);
+    sampler_seek(samples, in_memory ? (uint64_t)net->batch_train : net->seen);
+    if(!in_memory){
         args.paths = paths;
         args.batch_size = net->batch * net->subdivisions;
         args.labels = labels;
         args.classes =  net->classes;
-        args.train_set_size = train_set_size;
+        args.samples = samples;
+        args.position = net->seen;
         args.w = net->w;
         args.h = net->h;
         args.c = net->c;
@@ -110,16 +165,27 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
         args.mean_value = net->mean_value;
         args.scale = net->scale;
         args.test = net->test;
-        pthread_mutex_init(&mutex, NULL);
-        pthread_create(&load_data_thread_id, NULL, load_data_in_thread, &args);
-        usleep(1000000);
+        args.pack = pack;
+        args.archive = archive;
+        args.stream = stream;
+        if(stream){
+            start_image_stream(stream, option_find_int(options, "sample_seed", 1), replica, replicas, net->seen);
+        }
+        int cache_mb = option_find_int(options, "cache_mb", 0);     // decoded images kept in memory, 2 only
+        if(2 == train_data_type && cache_mb > 0) cache = make_image_cache((size_t)cache_mb << 20, 16);
+        args.cache = cache;
+        set_file_read_depth(option_find_int(options, "read_depth", 16));
+        loader = make_data_loader(option_find_int(options, "prefetch", 4), option_find_int(options, "load_threads", 2),
+                                  sizeof(batch), load_classifier_batch, free_classifier_batch, &args);
     }
+    double train_start = what_time_is_it_now();
     while(net->batch_train < net->max_batches){
         batch train;
         time = what_time_is_it_now();
         update_current_learning_rate(net);
         if(0 == train_data_type) {
-            int index = rand() % batch_num;
+            int index;
+            sampler_next(samples, &index, 1);
             train = all_train_data[index];
             /*printf("class: %d\n", train.truth_label_index[0]);
             image tmp;
@@ -136,29 +202,12 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
             save_image_png(tmp, "input.jpg");*/
             train_network(net, train.data, train.truth_label_index);
         } else if(1 == train_data_type) {
-            int index = rand() % batch_num;
+            int index;
+            sampler_next(samples, &index, 1);
             train = all_train_data[index];
             train_network(net, train.data, train.truth_label_index);
         } else {
-            while(1){
-                /*
-                train = random_batch(paths, net->batch * net->subdivisions, labels, net->classes,
-                                     train_set_size, net->w, net->h, net->c, net->hue, net->saturation, net->exposure,
-                                     net->flip, net->mean_value, net->scale, net->test);
-                printf("train_data_type: %d, spend %f \n", train_data_type, what_time_is_it_now() - time);
-                break;
-                */
-                pthread_mutex_lock(&mutex);
-                if(load_over == 1){
-                    train = train_global;
-                    load_over = 0;
-                    pthread_mutex_unlock(&mutex);
-                    break;
-                }
-                pthread_mutex_unlock(&mutex);
-                printf("wait load_over\n");
-                usleep(5000);
-            }
+            data_loader_get(loader, &train);
             /*
             image tmp;
             tmp.w = train.w;
@@ -178,10 +227,10 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
             //double train_start_time = what_time_is_it_now();
             train_network(net, train.data, train.truth_label_index);
             //printf("train spend %f \n", what_time_is_it_now() - train_start_time);
-            free_batch(&train);
+            data_loader_put(loader, &train);
         }
         int epoch_old = net->epoch;
-        net->epoch = net->seen / train_set_size;
+        net->epoch = sampler_epoch(net->seen, train_set_size, replica, replicas);
         float loss = net->loss;
         if(loss > 999999 || loss < -999999 || loss != loss || (loss + 1.0 == loss)) {  // NaN ≠ NaN, Inf + 1 = Inf
             fprintf(stderr, "\n\nloss too large: %f, exit\n", loss);
@@ -196,10 +245,17 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
             max_accuracy = net->correct_num / (net->accuracy_count + 0.00001F);
             max_accuracy_batch = net->batch_train;
         }
+        char cache_info[64] = "";
+        if(cache){
+            uint64_t hits = cache->hits, misses = cache->misses;
+            sprintf(cache_info, ", cache hit: %.1f%% %.0f MB", 100.0 * hits / (hits + misses + 0.00001),
+                    image_cache_bytes(cache) / 1024.0 / 1024.0);
+        }
         printf("epoch:%d, batch:%d, accuracy: %.4f, loss: %.2f, avg_loss:%.2f, learning_rate:%f, %.3fs, "
-               "seen %lu image, max_accuracy: %.4f\n", net->epoch+1, net->batch_train,
+               "load stall: %.3fs, seen %lu image, max_accuracy: %.4f%s\n", net->epoch+1, net->batch_train,
                net->correct_num / (net->accuracy_count + 0.00001F),
-               loss, avg_loss, net->learning_rate, what_time_is_it_now() - time, net->seen,  max_accuracy);
+               loss, avg_loss, net->learning_rate, what_time_is_it_now() - time, loader ? loader->stall : 0,
+               net->seen,  max_accuracy, cache_info);
         if(epoch_old != net->epoch){
             int save_weight_times = 20;
             int save_weight_interval = max_epoch / save_weight_times;
@@ -219,6 +275,22 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
         //exit(-1);
     }
     printf("max_accuracy_batch: %d\n", max_accuracy_batch);
+    if(loader){
+        fprintf(stderr, "data loader stalled %.2f seconds in total\n", loader->stall_total);
+        free_data_loader(loader);
+    }
+    if(cache){
+        fprintf(stderr, "image cache: %lu hits, %lu misses\n", cache->hits, cache->misses);
+        free_image_cache(cache);
+    }
+    if(stream){
+        fprintf(stderr, "image stream: %.0f MB read, %.1f MB/s\n", stream->bytes_read / 1024.0 / 1024.0,
+                stream->bytes_read / 1024.0 / 1024.0 / (what_time_is_it_now() - train_start));
+        free_image_stream(stream);
+    }
+    free_sampler(samples);
+    if(pack) free_image_pack(pack);
+    if(archive) free_image_archive(archive);
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
@@ -230,49 +302,55 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile)
         free(all_train_data);
     }
     free_ptrs((void**)labels, net->classes);
-    if(paths) free_ptr(paths);
-    if(plist){
-        free_list_contents(plist);
-        free_list(plist);
-    }
+    if(paths) free_path_table(paths);
     free(base);
 }
 
 void validate_classifier(char *datacfg, char *cfgfile, char *weightfile)
 {
-    srand(time(0));
+    rand_seed(time(0));
     network *net = load_network(cfgfile, weightfile);
     struct list *options = read_data_cfg(datacfg);
     char *label_list = option_find_str(options, "labels_test", "data/labels.list");
     int label_num = 0;
     char **labels = get_labels_and_num(label_list, &label_num);
     char *valid_list = option_find_str(options, "valid", "data/valid.list");
+    set_file_read_depth(option_find_int(options, "read_depth", 16));
 
     int valid_set_size = 0;
     int batch_num = 0;
-    char **paths = NULL;
-    struct list *plist = NULL;
-    int train_data_type = option_find_int(options, "train_data_type", 1);    //  0: csv, 1: load to memory
+    path_table *paths = NULL;
+    int train_data_type = option_find_int(options, "train_data_type", 1);    //  0: csv, 1: load to memory, 3, 5: pack, 4: archive
     net->test = 1;      // 0: train, 1: valid
 
     batch *all_valid_data = NULL;
+    image_pack *pack = NULL;
+    image_archive *archive = NULL;
     if(0 == train_data_type) {
         valid_set_size = option_find_int(options, "valid_num", 0);
         all_valid_data = load_csv_image_to_memory(valid_list, net->batch, labels, net->classes, valid_set_size,
                                                   &batch_num, net->w, net->h, net->c, net->hue, net->saturation,
                                                   net->exposure, net->test);
     } else if(1 == train_data_type){
-        plist = get_paths(valid_list);
-        paths = (char **)list_to_array(plist);
-        valid_set_size = plist->size;
+        paths = load_path_table(valid_list);
+        resolve_path_labels(paths, labels, net->classes);
+        valid_set_size = paths->count;
         valid_set_size = option_find_int(options, "valid_num", valid_set_size);
         all_valid_data = load_image_to_memory(paths, net->batch, labels, net->classes, valid_set_size, &batch_num,
                                               net->w, net->h, net->c, net->hue, net->saturation, net->exposure,
                                               net->flip, net->mean_value, net->scale, net->test);
+    } else if(3 == train_data_type || 5 == train_data_type){      // a streamed pack is validated in order
+        pack = open_image_pack(valid_list);
+        valid_set_size = pack->count;
+        batch_num = valid_set_size;
+    } else if(4 == train_data_type){
+        archive = open_image_archive(valid_list);
+        valid_set_size = archive->count;
+        batch_num = valid_set_size;
     } else {
-        plist = get_paths(valid_list);
-        paths = (char **)list_to_array(plist);
-        valid_set_size = plist->size;
+        paths = load_path_table(valid_list);
+        resolve_path_labels(paths, labels, net->classes);
+        valid_set_size = paths->count;
         batch_num = valid_set_size;
     }
 
@@ -289,6 +367,7 @@ void validate_classifier(char *datacfg, char *cfgfile, char *weightfile)
 
     FILE *fp = fopen("features.txt", "w");
     if(!fp) file_error("features.txt");
+    batch loaded = {0};     // reused by every batch that is not kept in memory
     while(count < batch_num){
         batch train;
         if(0 == train_data_type) {
@@ -297,12 +376,21 @@ void validate_classifier(char *datacfg, char *cfgfile, char *weightfile)
         } else if(1 == train_data_type) {
             train = all_valid_data[count];
             valid_network(net, train.data, train.truth_label_index);
+        } else if(3 == train_data_type || 5 == train_data_type) {
+            image_pack_batch(pack, &loaded, NULL, 0, net->batch, net->hue, net->saturation, net->exposure, net->flip,
+                             net->mean_value, net->scale, net->test);
+            train = loaded;
+            valid_network(net, train.data, train.truth_label_index);
+        } else if(4 == train_data_type) {
+            image_archive_batch(archive, &loaded, NULL, 0, net->batch, net->w, net->h, net->c, net->hue,
+                                net->saturation, net->exposure, net->flip, net->mean_value, net->scale, net->test);
+            train = loaded;
+            valid_network(net, train.data, train.truth_label_index);
         } else {
-            train = random_batch(paths, net->batch, labels, net->classes, valid_set_size, net->w, net->h, net->c,
-                                 net->hue, net->saturation, net->exposure, net->flip, net->mean_value, net->scale,
-                                 net->test);
+            random_batch(paths, &loaded, NULL, 0, -1, net->batch, labels, net->classes, net->w, net->h, net->c, net->hue,
+                         net->saturation, net->exposure, net->flip, net->mean_value, net->scale, net->test, NULL);
+            train = loaded;
             valid_network(net, train.data, train.truth_label_index);
-            free_batch(&train);
         }
 
         int network_output_size = get_network_output_size_layer(net, net->output_layer);
@@ -344,6 +432,7 @@ void validate_classifier(char *datacfg, char *cfgfile, char *weightfile)
         //sleep(3);
     }
     fclose(fp);
+    free_batch(&loaded);
     free_network(net);
     if(all_valid_data){
         for(int i = 0; i < batch_num; i++){
@@ -351,12 +440,10 @@ void validate_classifier(char *datacfg, char *cfgfile, char *weightfile)
         }
         free(all_valid_data);
     }
+    if(pack) free_image_pack(pack);
+    if(archive) free_image_archive(archive);
     free_ptrs((void**)labels, label_num);
-    if(paths) free_ptr(paths);
-    if(plist){
-        free_list_contents(plist);
-        free_list(plist);
-    }
+    if(paths) free_path_table(paths);
 }
 
 void run_classifier(int argc, char **argv)
@@ -7,6 +7,10 @@
 void run_classifier(int argc, char **argv);
 void run_char_rnn(int argc, char **argv);
 void run_detector(int argc, char **argv);
+void run_pack(int argc, char **argv);
+void run_archive(int argc, char **argv);
+void run_path_table(int argc, char **argv);
+void run_truth_index(int argc, char **argv);
 
 int main(int argc, char **argv)
 {
@@ -33,6 +37,14 @@ int main(int argc, char **argv)
         run_detector(argc, argv);
     } else if (0 == strcmp(argv[1], "rnn")){
         run_char_rnn(argc, argv);
+    } else if (0 == strcmp(argv[1], "pack")){
+        run_pack(argc, argv);
+    } else if (0 == strcmp(argv[1], "archive")){
+        run_archive(argc, argv);
+    } else if (0 == strcmp(argv[1], "paths")){
+        run_path_table(argc, argv);
+    } else if (0 == strcmp(argv[1], "truth")){
+        run_truth_index(argc, argv);
     } else {
         fprintf(stderr, "Not an option: %s gpu_index: %d\n", argv[1], gpu_index);
     }
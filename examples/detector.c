@@ -5,40 +5,41 @@
 #include "utils.h"
 #include "parser.h"
 #include "data.h"
+#include "data_loader.h"
+#include "file_reader.h"
 #include "option_list.h"
 #include "network.h"
 
-pthread_mutex_t mutex;
-int load_over;
-batch_detect train_global;
-
 typedef struct load_args{
-    char **paths;
-    int classes, train_set_size, w, h, test, batch, subdivisions, max_boxes;
+    path_table *paths;
+    truth_index *truth;
+    sampler *samples;
+    uint64_t position;      // of the samples of ticket 0
+    int classes, w, h, test, batch, subdivisions, max_boxes;
     float hue, saturation, exposure, jitter;
 } load_args;
 
-void *load_detect_data_thread(void *args_point)
+/* item is a batch loaded before or zeroed, its buffers are reused; batch ticket takes the samples from its position,
+ * the reads of the images of batch next start before it decodes */
+static void load_detector_batch(void *args_point, void *item, uint64_t ticket, uint64_t next)
 {
     load_args args = *(load_args *)args_point;
-    while(1){
-        pthread_mutex_lock(&mutex);
-        if(load_over == 0){
-            train_global = load_data_detection(args.batch * args.subdivisions, args.paths, args.train_set_size, args.w, args.h, args.max_boxes,
-                                               args.classes, args.jitter, args.hue, args.saturation, args.exposure, args.test);
-            load_over = 1;
-            pthread_mutex_unlock(&mutex);
-        } else {
-            pthread_mutex_unlock(&mutex);
-        }
-        usleep(10000);
-    }
+    int n = args.batch * args.subdivisions;
+    load_data_detection(n, args.paths, args.truth, args.samples, args.position + ticket * n,
+                        next == (uint64_t)-1 ? next : args.position + next * n, (batch_detect *)item,
+                        args.w, args.h, args.max_boxes, args.classes, args.jitter, args.hue, args.saturation,
+                        args.exposure, args.test);
+}
+
+static void free_detector_batch(void *item)
+{
+    free_batch_detect(*(batch_detect *)item);
 }
 
 void train_detector(char *datacfg, char *cfgfile, char *weightfile)
 {
     char *base = basecfg(cfgfile);
-    srand(time(0));
+    rand_seed(time(0));
     network *net = load_network(cfgfile, weightfile);
     net->output_layer = net->n - 1;
 
@@ -47,31 +48,39 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile)
     char *train_list = option_find_str(options, "train", "data/train.list");
 
     int train_set_size = 0;
-    char **paths = NULL;
-    struct list *plist = NULL;
-    plist = get_paths(train_list);
-    paths = (char **)list_to_array(plist);
-    train_set_size = plist->size;
+    path_table *paths = load_path_table(train_list);
+    train_set_size = paths->count;
     train_set_size = option_find_int(options, "train_num", train_set_size);
+    // compiled ground truth, built from the label files the first time, see `cnn truth`
+    char *truth_file = option_find_str(options, "truth", 0);
+    truth_index *truth = truth_file ? open_truth_index(paths, train_list, truth_file) : NULL;
     double time;
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
-    int max_epoch = (int)net->max_batches * net->batch * net->subdivisions / train_set_size;
+    int replica = option_find_int(options, "replica", 0);
+    int replicas = option_find_int(options, "replicas", 1);
+    int max_epoch = sampler_epoch((uint64_t)net->max_batches * net->batch * net->subdivisions, train_set_size, 0,
+                                  replicas);
     fprintf(stderr, "image net has seen: %lu, train_set_size: %d, max_batches of net: %d, net->classes: %d,"
            "net->batch: %d, max_epoch: %d\n\n",
            net->seen, train_set_size, net->max_batches, net->classes, net->batch, max_epoch);
 
     net->batch_train = net->seen / net->batch / net->subdivisions;
-    net->epoch = net->seen / train_set_size;
+    net->epoch = sampler_epoch(net->seen, train_set_size, replica, replicas);
     float avg_loss = -1;
     float max_accuracy = -1;
     int burn_in = 1000;
     batch_detect train;
     load_args args = {0};
     args.paths = paths;
+    args.truth = truth;
+    // every image once per epoch from the position the weights were saved at, see train_classifier
+    sampler *samples = make_sampler(train_set_size, option_find_int(options, "sample_seed", 1),
+                                    replica, replicas);
+    args.samples = samples;
+    args.position = net->seen;
     args.batch = net->batch;
     args.subdivisions = net->subdivisions;
     args.classes =  net->classes;
-    args.train_set_size = train_set_size;
     args.w = net->w;
     args.h = net->h;
     args.max_boxes = net->max_boxes;
@@ -80,32 +89,16 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile)
     args.saturation = net->saturation;
     args.exposure=net->exposure;
     args.test = net->test;
-    pthread_mutex_init(&mutex, NULL);
-    pthread_t load_data_thread_id;
-    pthread_create(&load_data_thread_id, NULL, load_detect_data_thread, &args);
-    usleep(1000000);
+    set_file_read_depth(option_find_int(options, "read_depth", 16));
+    data_loader *loader = make_data_loader(option_find_int(options, "prefetch", 4),
+                                           option_find_int(options, "load_threads", 2), sizeof(batch_detect),
+                                           load_detector_batch, free_detector_batch, &args);
     while(net->batch_train < net->max_batches){
         time = what_time_is_it_now();
         update_current_learning_rate(net);
         if(net->batch_train < burn_in) net->learning_rate = net->learning_rate_init * pow((float)net->batch_train / burn_in, 4);
         else if(net->batch_train == burn_in) net->learning_rate = net->learning_rate_init;
-        while(1){
-            /*
-            train = load_data_detection(net->batch * net->subdivisions, paths, train_set_size, net->w, net->h, net->max_boxes,
-                                        net->classes, net->jitter, net->hue, net->saturation, net->exposure, net->test);
-            break;
-            */
-            pthread_mutex_lock(&mutex);
-            if(load_over == 1){
-                train = train_global;
-                load_over = 0;
-                pthread_mutex_unlock(&mutex);
-                break;
-            }
-            pthread_mutex_unlock(&mutex);
-            printf("wait load_over\n");
-            usleep(5000);
-        }
+        data_loader_get(loader, &train);
 
         /*
         printf("Loaded: %lf seconds\n", what_time_is_it_now() - time);
@@ -122,13 +115,13 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile)
             save_image_png(im, "truth11");
         }
         */
-        printf("load data spend %f \n", what_time_is_it_now() - time);
+        printf("load stall %f \n", loader->stall);
         train_network_detect(net, train);
-        free_batch_detect(train);
+        data_loader_put(loader, &train);
         //sleep(1.5);
 
         int epoch_old = net->epoch;
-        net->epoch = net->seen / train_set_size;
+        net->epoch = sampler_epoch(net->seen, train_set_size, replica, replicas);
         float loss = net->loss;
         if(loss > 999999 || loss < -999999 || loss != loss || (loss + 1.0 == loss)) {  // NaN ≠ NaN, Inf + 1 = Inf
             //fprintf(stderr, "\n\nloss too large: %f, exit\n", loss);
@@ -156,15 +149,15 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile)
             }
         }
     }
+    fprintf(stderr, "data loader stalled %.2f seconds in total\n", loader->stall_total);
+    free_data_loader(loader);
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
     free_network(net);
-    if(paths) free_ptr(paths);
-    if(plist){
-        free_list_contents(plist);
-        free_list(plist);
-    }
+    free_sampler(samples);
+    if(truth) free_truth_index(truth);
+    if(paths) free_path_table(paths);
     free(base);
 }
 
@@ -190,7 +183,7 @@ void print_detector_detections(FILE **fps, char *id, detection *dets, int total,
 
 void validate_detector(char *datacfg, char *cfgfile, char *weightfile)
 {
-    srand(time(0));
+    rand_seed(time(0));
     network *net = load_network(cfgfile, weightfile);
     net->test = 1;      // 0: train, 1: valid
     net->output_layer = net->n - 1;
@@ -199,9 +192,8 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile)
     char *label_list = option_find_str(options, "names", "data/names.list");
     char **labels = get_labels(label_list);
     char *valid_list = option_find_str(options, "valid", "data/train.list");
-    struct list *plist = get_paths(valid_list);
-    char **paths = (char **)list_to_array(plist);
-    int valid_set_size = plist->size;
+    path_table *paths = load_path_table(valid_list);
+    int valid_set_size = paths->count;
     fprintf(stderr, "valid_set_size: %d, net->classes: %d, net->batch: %d\n", valid_set_size, net->classes, net->batch);
     if(net->batch != 1){
         printf("\nerror: net->batch != 1\n");
@@ -226,13 +218,13 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile)
     double start = what_time_is_it_now();
     for(int i = 0; i < valid_set_size; i++){
         int image_original_w, image_original_h;
-        image train = load_data_detection_valid(paths[i], net->w, net->h, &image_original_w, &image_original_h);
+        image train = load_data_detection_valid(table_path(paths, i), net->w, net->h, &image_original_w, &image_original_h);
         forward_network_test(net, train.data);
         fprintf(stderr, "%d loss: %f\n", i, net->loss);
         int nboxes = 0;
         detection *dets = get_network_boxes(net, image_original_w, image_original_h, thresh, map, 0, &nboxes);
         if (nms) do_nms_sort(dets, nboxes, net->classes, nms);
-        print_detector_detections(fps, paths[i], dets, nboxes, net->classes, image_original_w, image_original_h);
+        print_detector_detections(fps, table_path(paths, i), dets, nboxes, net->classes, image_original_w, image_original_h);
         free_image(train);
         free_ptr(dets);
     }
@@ -242,11 +234,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile)
     fprintf(stderr, "Total Detection Time: %f Seconds\n", what_time_is_it_now() - start);
     free_network(net);
     free_ptrs((void**)labels, net->classes);
-    if(paths) free_ptr(paths);
-    if(plist){
-        free_list_contents(plist);
-        free_list(plist);
-    }
+    if(paths) free_path_table(paths);
 }
 
 void run_detector(int argc, char **argv)
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+#include "parser.h"
+#include "data.h"
+#include "image_pack.h"
+#include "image_archive.h"
+#include "option_list.h"
+#include "network.h"
+
+// decode, resize and label the images of the train list of the data cfg at the input size of the network
+void pack_images(char *datacfg, char *cfgfile, char *outfile, int shard_size)
+{
+    network *net = load_network_custom(cfgfile, 0, 1, 1);
+    struct list *options = read_data_cfg(datacfg);
+    char *label_list = option_find_str(options, "labels", "data/labels.list");
+    char **labels = get_labels(label_list);
+    char *train_list = option_find_str(options, "train", "data/train.list");
+    path_table *paths = load_path_table(train_list);
+    resolve_path_labels(paths, labels, net->classes);
+    int n = option_find_int(options, "train_num", paths->count);
+    if(n > paths->count) n = paths->count;
+    write_image_pack(paths, n, labels, net->classes, net->w, net->h, net->c, shard_size, outfile);
+    free_ptrs((void **)labels, net->classes);
+    free_network(net);
+    free_path_table(paths);
+}
+
+// concatenate the encoded images of the train list of the data cfg into one indexed file
+void archive_images(char *datacfg, char *outfile)
+{
+    struct list *options = read_data_cfg(datacfg);
+    char *label_list = option_find_str(options, "labels", "data/labels.list");
+    int classes = 0;
+    char **labels = get_labels_and_num(label_list, &classes);
+    char *train_list = option_find_str(options, "train", "data/train.list");
+    path_table *paths = load_path_table(train_list);
+    resolve_path_labels(paths, labels, classes);
+    int n = option_find_int(options, "train_num", paths->count);
+    if(n > paths->count) n = paths->count;
+    write_image_archive(paths, n, labels, classes, outfile);
+    free_ptrs((void **)labels, classes);
+    free_path_table(paths);
+}
+
+void run_archive(int argc, char **argv)
+{
+    double time_start = what_time_is_it_now();
+    if(argc < 3){
+        fprintf(stderr, "usage: %s %s [data cfg] -out [archive]\n", argv[0], argv[1]);
+        return;
+    }
+    char *outfile = find_char_arg(argc, argv, "-out", "data/train.archive");
+    archive_images(argv[2], outfile);
+    fprintf(stderr, "\n\ntotal %.2lf seconds\n\n\n", what_time_is_it_now() - time_start);
+}
+
+// the binary form of a list of image paths, which load_path_table maps without parsing
+void run_path_table(int argc, char **argv)
+{
+    if(argc < 3){
+        fprintf(stderr, "usage: %s %s [list] -out [table]\n", argv[0], argv[1]);
+        return;
+    }
+    char *outfile = find_char_arg(argc, argv, "-out", "data/train.paths");
+    path_table *paths = load_path_table(argv[2]);
+    save_path_table(paths, outfile);
+    fprintf(stderr, "%s: %d paths, %.1f MB\n", outfile, paths->count, paths->arena_size / 1024.0 / 1024.0);
+    free_path_table(paths);
+}
+
+// the boxes of the label files of a detection list in one file, which load_data_detection maps
+void run_truth_index(int argc, char **argv)
+{
+    if(argc < 3){
+        fprintf(stderr, "usage: %s %s [list] -out [index]\n", argv[0], argv[1]);
+        return;
+    }
+    char *outfile = find_char_arg(argc, argv, "-out", "data/train.truth");
+    path_table *paths = load_path_table(argv[2]);
+    truth_index *truth = build_truth_index(paths, argv[2]);
+    save_truth_index(truth, outfile);
+    free_truth_index(truth);
+    free_path_table(paths);
+}
+
+void run_pack(int argc, char **argv)
+{
+    double time_start = what_time_is_it_now();
+    if(argc < 4){
+        fprintf(stderr, "usage: %s %s [data cfg] [cfg] -out [index] -shard [images per shard]\n", argv[0], argv[1]);
+        return;
+    }
+    char *outfile = find_char_arg(argc, argv, "-out", "data/train.pack");
+    int shard_size = find_int_arg(argc, argv, "-shard", 100000);
+    pack_images(argv[2], argv[3], outfile, shard_size);
+    fprintf(stderr, "\n\ntotal %.2lf seconds\n\n\n", what_time_is_it_now() - time_start);
+}
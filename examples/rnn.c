@@ -1,5 +1,9 @@
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include <locale.h>
@@ -11,23 +15,72 @@
 #include "data.h"
 #include "option_list.h"
 #include "network.h"
+#include "rnn_session.h"
 
 typedef struct {
     float *x;
+    int *index;  // token ids instead of one-hot x, when the network starts with [embedding]
     int *y;
 } float_pair;
 
-float_pair get_rnn_data(wint_t *text, size_t *offsets, int inputs, size_t len, int batch, int steps)
+/* binary token file written by `cnn rnn tokenize`: the header, the character of every id ([vocab] uint32, version 2),
+ * then count ids of width bytes each (uint16 when the vocabulary fits, uint32 otherwise); training maps it instead of
+ * decoding the text. Version 2 ids are ranked by decreasing frequency, as the log-uniform proposal of
+ * [sampled_softmax] expects; version 1 ids are the characters themselves */
+#define TOKEN_FILE_MAGIC "CNNT"
+#define TOKEN_FILE_VERSION 2
+typedef struct {
+    char magic[4];
+    int version, width, vocab;
+    uint64_t count;
+} token_file_header;
+
+typedef struct {
+    wint_t *text;           // text file: one wint_t per character
+    unsigned char *map;     // token file: the mapped header and ids
+    const unsigned char *ids;
+    const uint32_t *chars;  // [vocab], character of each id, NULL: the ids are the characters
+    size_t map_size, len;
+    int width, vocab;
+} token_corpus;
+
+static inline int corpus_token(const token_corpus *corpus, size_t i)
 {
-    float *x = calloc(batch * steps * inputs, sizeof(float));
+    if(corpus->text) return (int)corpus->text[i];
+    return corpus->width == 2 ? ((const uint16_t *)corpus->ids)[i] : (int)((const uint32_t *)corpus->ids)[i];
+}
+
+// the character of id, U+FFFD for an id past the vocabulary
+static inline wint_t token_char(const token_corpus *vocab, int id)
+{
+    if(!vocab->chars) return (wint_t)id;
+    return id < vocab->vocab ? vocab->chars[id] : 0xFFFD;
+}
+
+// the id of character c, -1: not in the vocabulary
+static int char_token(const token_corpus *vocab, wint_t c)
+{
+    if(!vocab->chars) return (int)c;
+    for(int i = 0; i < vocab->vocab; ++i){
+        if(vocab->chars[i] == c) return i;
+    }
+    return -1;
+}
+
+float_pair get_rnn_data(const token_corpus *corpus, size_t *offsets, int inputs, int batch, int steps, int use_index)
+{
+    size_t len = corpus->len;
+    float *x = use_index ? 0 : calloc(batch * steps * inputs, sizeof(float));
+    int *index = use_index ? calloc(batch * steps, sizeof(int)) : 0;
     int *y = calloc(batch * steps, sizeof(int));
 //#pragma omp parallel for
     for(int j = 0; j < steps; ++j){
         for(int i = 0; i < batch; ++i){
             //offsets[i] = 0;
-            int curr = (int)text[offsets[i] % len];
-            int next = (int)text[(offsets[i] + 1) % len];
-            x[(j*batch + i)*inputs + curr] = 1;
+            int curr = corpus_token(corpus, offsets[i] % len);
+            int next = corpus_token(corpus, (offsets[i] + 1) % len);
+            if(use_index) index[j*batch + i] = curr;
+            else x[(j*batch + i)*inputs + curr] = 1;
             y[j*batch + i] = next;
             //printf("%d %d %lc %d %lc", i, curr, curr, next, next);
             offsets[i] = (offsets[i] + 1) % len;
@@ -35,6 +88,7 @@ float_pair get_rnn_data(wint_t *text, size_t *offsets, int inputs, size_t len, i
     }
     float_pair p;
     p.x = x;
+    p.index = index;
     p.y = y;
     return p;
 }
@@ -70,11 +124,121 @@ wint_t *parse_tokens(char *filename, size_t *n)
     return text;
 }
 
+#define TOKEN_CHARS 0x110000    // unicode code points
+
+static const uint64_t *char_frequency;
+
+// decreasing frequency, then increasing character
+static int char_frequency_comparator(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    if(char_frequency[x] != char_frequency[y]) return char_frequency[x] < char_frequency[y] ? 1 : -1;
+    return x < y ? -1 : 1;
+}
+
+/* write the characters of a text file as a binary token file, the ids ranked by decreasing frequency; the vocabulary
+ * in the file maps them back to characters */
+void tokenize_char_rnn(char *filename, char *outfile)
+{
+    setlocale(LC_ALL, "");
+    FILE *fp = fopen(filename, "r");
+    if(!fp) file_error(filename);
+    token_file_header header = {TOKEN_FILE_MAGIC, TOKEN_FILE_VERSION, 2, 0, 0};
+    uint64_t *frequency = calloc(TOKEN_CHARS, sizeof(uint64_t));
+    wint_t c;
+    while((c = fgetwc(fp)) != WEOF){
+        if(c >= TOKEN_CHARS){
+            fprintf(stderr, "%s: character %u out of the unicode range\n", filename, (unsigned)c);
+            exit(-1);
+        }
+        header.vocab += frequency[c]++ == 0;
+        ++header.count;
+    }
+    uint32_t *chars = calloc(header.vocab, sizeof(uint32_t));
+    int vocab = 0;
+    for(uint32_t i = 0; i < TOKEN_CHARS; ++i){
+        if(frequency[i]) chars[vocab++] = i;
+    }
+    char_frequency = frequency;
+    qsort(chars, header.vocab, sizeof(uint32_t), char_frequency_comparator);
+    int *id = calloc(TOKEN_CHARS, sizeof(int));
+    for(int i = 0; i < header.vocab; ++i) id[chars[i]] = i;
+    if(header.vocab > 65536) header.width = 4;
+    rewind(fp);
+    FILE *out = fopen(outfile, "wb");
+    if(!out) file_error(outfile);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(chars, sizeof(uint32_t), header.vocab, out);
+    int chunk = 1 << 16;
+    unsigned char *ids = calloc(chunk, header.width);
+    int n = 0;
+    while((c = fgetwc(fp)) != WEOF){
+        if(header.width == 2) ((uint16_t *)ids)[n] = (uint16_t)id[c];
+        else ((uint32_t *)ids)[n] = (uint32_t)id[c];
+        if(++n == chunk){
+            fwrite(ids, header.width, n, out);
+            n = 0;
+        }
+    }
+    fwrite(ids, header.width, n, out);
+    if(fclose(out) != 0) file_error(outfile);
+    fclose(fp);
+    fprintf(stderr, "%s: %lu tokens, vocab %d, %d bytes per token -> %s, most frequent:",
+            filename, (unsigned long)header.count, header.vocab, header.width, outfile);
+    for(int i = 0; i < header.vocab && i < 16; ++i){
+        fprintf(stderr, " U+%04X %.2f%%", chars[i], 100.0 * frequency[chars[i]] / header.count);
+    }
+    fprintf(stderr, "\n");
+    free_ptr(ids);
+    free_ptr(id);
+    free_ptr(chars);
+    free_ptr(frequency);
+}
+
+// a binary token file is mapped, the pages are shared with the other jobs reading it; a text file is decoded
+token_corpus load_token_corpus(char *filename)
+{
+    token_corpus corpus = {0};
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    token_file_header header = {{0}};
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(filename);
+    if(read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, TOKEN_FILE_MAGIC, 4) != 0){
+        close(fd);
+        corpus.text = parse_tokens(filename, &corpus.len);
+        return corpus;
+    }
+    size_t vocab_size = header.version >= 2 ? (size_t)header.vocab * sizeof(uint32_t) : 0;
+    if(header.version < 1 || header.version > TOKEN_FILE_VERSION || (header.width != 2 && header.width != 4) ||
+       (size_t)st.st_size < sizeof(header) + vocab_size + header.count * header.width){
+        fprintf(stderr, "%s: bad token file, version %d, width %d, %lu tokens in %lu bytes\n", filename,
+                header.version, header.width, (unsigned long)header.count, (unsigned long)st.st_size);
+        exit(-1);
+    }
+    corpus.map_size = st.st_size;
+    corpus.map = mmap(0, corpus.map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(corpus.map == MAP_FAILED) file_error(filename);
+    if(vocab_size) corpus.chars = (const uint32_t *)(corpus.map + sizeof(header));
+    corpus.ids = corpus.map + sizeof(header) + vocab_size;
+    corpus.len = header.count;
+    corpus.width = header.width;
+    corpus.vocab = header.vocab;
+    return corpus;
+}
+
+void free_token_corpus(token_corpus *corpus)
+{
+    if(corpus->map) munmap(corpus->map, corpus->map_size);
+    free_ptr(corpus->text);
+}
+
 void train_char_rnn(char *cfgfile, char *weightfile, char *filename)
 {
-    srand(time(0));
-    size_t train_set_size = 0;
-    wint_t *text = parse_tokens(filename, &train_set_size);
+    rand_seed(time(0));
+    token_corpus corpus = load_token_corpus(filename);
+    size_t train_set_size = corpus.len;
     char *backup_directory = "/var/darknet/weight";
     char *base = basecfg(cfgfile);
     network *net = load_network(cfgfile, weightfile);
@@ -86,9 +250,24 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename)
     if(max_epoch / 10 > 1) save_epoch = max_epoch / 20;
     fprintf(stderr, "%s: train data size %lu, max_batches: %d, max epoch: %d\n",
             base, train_set_size, net->max_batches, max_epoch);
+    if(corpus.vocab > net->inputs){
+        fprintf(stderr, "%s: token ids up to %d, the network has %d inputs\n", filename, corpus.vocab - 1, net->inputs);
+        exit(-1);
+    }
+    int use_index = net->layers_type[0] == EMBEDDING;
+    if(net->layers_type[net->n - 1] == SAMPLED_SOFTMAX && !corpus.chars){
+        fprintf(stderr, "%s: the token ids are characters, not ranked by frequency as the log-uniform samples of "
+                "[sampled_softmax] assume, train on the output of `cnn rnn tokenize`\n", filename);
+    }
+    /* truncated bptt with bptt_k1 < time_steps: every row reads its own contiguous stream, the windows overlap by
+     * time_steps - bptt_k1 steps whose loss is masked, and the next window starts from the state after bptt_k1 steps */
+    int overlap = net->time_steps - net->bptt_k1;
     size_t *offsets = calloc(net->batch, sizeof(size_t));
     for(int j = 0; j < net->batch; ++j){
-        offsets[j] = rand_size_t() % train_set_size;
+        offsets[j] = overlap ? j * (train_set_size / net->batch) : rand_size_t() % train_set_size;
+    }
+    if(overlap){
+        fprintf(stderr, "truncated bptt: windows of %d steps, advance %d steps\n", net->time_steps, net->bptt_k1);
     }
 
     net->batch_train = net->seen / (net->batch * net->time_steps);
@@ -100,9 +279,20 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename)
     while(net->batch_train < net->max_batches){
         update_current_learning_rate(net);
         time=clock();
-        float_pair p = get_rnn_data(text, offsets, net->inputs, train_set_size, net->batch, net->time_steps);
-        train_network(net, p.x, p.y);
-        free(p.x);
+        float_pair p = get_rnn_data(&corpus, offsets, net->inputs, net->batch, net->time_steps, use_index);
+        if(overlap){
+            for(int j = 0; j < net->batch; ++j){
+                offsets[j] = (offsets[j] + train_set_size - overlap) % train_set_size;
+            }
+            if(net->batch_train > 0){
+                for(int i = 0; i < overlap * net->batch; ++i) p.y[i] = -1;  // trained in the last window
+            }
+        }
+        if(use_index) train_network_index(net, p.index, p.y);
+        else train_network(net, p.x, p.y);
+        if(overlap) set_recurrent_state_step(net, net->bptt_k1 - 1);
+        if(p.x) free(p.x);
+        if(p.index) free(p.index);
         free(p.y);
         float loss = net->loss;
         if(loss > 999999 || loss < -999999 || loss != loss || (loss + 1.0 == loss)) {  // NaN ≠ NaN, Inf + 1 = Inf
@@ -126,8 +316,8 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename)
                 net->epoch+1, net->batch_train, net->correct_num / (net->accuracy_count + 0.00001F),
                 loss, avg_loss, net->learning_rate, sec(clock()-time), net->seen, max_accuracy);
 
-        for(int j = 0; j < net->batch; ++j){
-            if(rand()%64 == 0){
+        for(int j = 0; j < net->batch && !overlap; ++j){
+            if(rand_int(0, 63) == 0){
                 offsets[j] = rand_size_t() % train_set_size;
                 reset_rnn_state(net, j);
                 reset_lstm_state(net, j);
@@ -145,75 +335,172 @@ void train_char_rnn(char *cfgfile, char *weightfile, char *filename)
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
     free_ptr(offsets);
-    free_ptr(text);
+    free_token_corpus(&corpus);
 }
 
-void test_char_rnn(char *cfgfile, char *weightfile, int num, char *seed)
+/* sample the next token among the topk most probable ones (topk <= 0: all) whose probability mass reaches topp
+ * (>= 1: all); the partial sort grows until it covers topp. Without both the tokens below .001 are dropped */
+int sample_char_rnn(float *out, int n, int topk, float topp, int *candidates)
 {
-    setlocale(LC_ALL, "");
-    srand(time(0));
-    network *net = load_network(cfgfile, weightfile);
-    net->test = 1;      // 0: train, 1: valid
+    if(topk <= 0 && topp >= 1){
+        for(int j = 0; j < n; ++j){
+            if (out[j] < .001) out[j] = 0;
+        }
+        return sample_array(out, n);
+    }
+    int k = (topk <= 0 || topk > n) ? n : topk;
+    int m = (topp < 1 && k > 64) ? 64 : k;
+    float sum = 0;
+    while(1){
+        top_k(out, n, m, candidates);
+        int covered = 0;
+        int j = 0;
+        sum = 0;
+        for(; j < m && !covered; ++j){
+            sum += out[candidates[j]];
+            covered = sum >= topp;
+        }
+        if(covered || m == k){
+            m = j;
+            break;
+        }
+        m = 2*m < k ? 2*m : k;
+    }
+    float r = rand_uniform(0, sum);
+    for(int j = 0; j < m; ++j){
+        r -= out[candidates[j]];
+        if(r <= 0) return candidates[j];
+    }
+    return candidates[m - 1];
+}
+
+/* beam search with one session per beam: each step all the beams are one batched forward, every beam proposes its
+ * beam most probable tokens, the beam best of the beam*beam candidates are kept and take the state of their parent */
+void beam_char_rnn(rnn_scheduler *s, rnn_session **beams, int beam, int c, int num, wint_t *text, float *score)
+{
+    int size = beams[0]->state_size;
+    int *token = calloc(beam, sizeof(int));
+    int *candidates = calloc(beam * beam, sizeof(int));
+    float *candidate_score = calloc(beam * beam, sizeof(float));
+    int *best = calloc(beam, sizeof(int));
+    float *states = calloc(beam * size, sizeof(float));
+    wint_t *prev_text = calloc(beam * num, sizeof(wint_t));
+    for(int k = 0; k < beam; ++k){
+        token[k] = c;
+        score[k] = (k == 0) ? 0 : -FLT_MAX;  // the beams start equal, only the first one is expanded
+    }
+    for(int i = 0; i < num; ++i){
+        for(int k = 0; k < beam; ++k) rnn_session_step(s, beams[k], token[k]);
+        rnn_scheduler_run(s);
+        for(int k = 0; k < beam; ++k){
+            top_k(beams[k]->output, s->outputs, beam, candidates + k*beam);
+            for(int j = 0; j < beam; ++j){
+                float p = (score[k] == -FLT_MAX) ? 0 : beams[k]->output[candidates[k*beam + j]];
+                candidate_score[k*beam + j] = p > 0 ? score[k] + logf(p) : -FLT_MAX;
+            }
+        }
+        top_k(candidate_score, beam * beam, beam, best);
+        memcpy(prev_text, text, beam * num * sizeof(wint_t));
+        for(int j = 0; j < beam; ++j) rnn_session_snapshot(beams[best[j] / beam], states + j*size);
+        for(int j = 0; j < beam; ++j){
+            rnn_session_restore(beams[j], states + j*size);
+            memcpy(text + j*num, prev_text + best[j] / beam * num, i * sizeof(wint_t));
+            token[j] = candidates[best[j]];
+            text[j*num + i] = token[j];
+            score[j] = candidate_score[best[j]];
+        }
+    }
+    free_ptr(token);
+    free_ptr(candidates);
+    free_ptr(candidate_score);
+    free_ptr(best);
+    free_ptr(states);
+    free_ptr(prev_text);
+}
 
-    int c = 0;
-    int len = strlen(seed);
-    float *input = calloc(net->inputs, sizeof(float));
+/* streams independent samples from the same seed, or a beam search with beam > 0; one session per stream or beam,
+ * every step of all of them is one batched forward */
+void test_char_rnn(char *cfgfile, char *weightfile, int num, char *seed, int streams, int beam, int topk, float topp,
+                   char *vocab_file)
+{
+    setlocale(LC_ALL, "");
+    rand_seed(time(0));
+    token_corpus vocab = {0};   // the token file of the training, its ids are mapped back to characters
+    if(vocab_file) vocab = load_token_corpus(vocab_file);
+    if(beam > 0) streams = beam;
+    network *net = load_network_custom(cfgfile, weightfile, streams, 1);
+    rnn_scheduler *scheduler = make_rnn_scheduler(net);
+    if(beam > scheduler->outputs) error("beam must not be larger than the number of tokens");
+    rnn_session **sessions = calloc(streams, sizeof(rnn_session *));
+    for(int k = 0; k < streams; ++k) sessions[k] = make_rnn_session(scheduler);
+    int *c = calloc(streams, sizeof(int));
+    int *candidates = calloc(scheduler->outputs, sizeof(int));
+    wint_t *text = calloc(streams * num, sizeof(wint_t));
 
+    size_t seed_len = mbstowcs(0, seed, 0);
+    if(seed_len == (size_t)-1) error("the seed is not valid text in the current locale");
+    int len = seed_len;
+    wchar_t *seed_chars = calloc(len + 1, sizeof(wchar_t));
+    mbstowcs(seed_chars, seed, len + 1);
+    int *seed_ids = calloc(len + 1, sizeof(int));
+    for(int i = 0; i < len; ++i){
+        seed_ids[i] = char_token(&vocab, seed_chars[i]);
+        if(seed_ids[i] < 0){
+            fprintf(stderr, "seed character %lc is not in the vocabulary of %s\n", seed_chars[i], vocab_file);
+            exit(-1);
+        }
+    }
     printf("seed string:");
     for(int i = 0; i < len-1; ++i){
-        c = seed[i];
-        input[c] = 1;
-        forward_network_test(net, input);
-        input[c] = 0;
-        printf("%lc", c);
-    }
-    if(len) c = seed[len-1];
-    printf("%lc", c);
+        for(int k = 0; k < streams; ++k) rnn_session_step(scheduler, sessions[k], seed_ids[i]);
+        rnn_scheduler_run(scheduler);
+        printf("%lc", seed_chars[i]);
+    }
+    for(int k = 0; k < streams; ++k) c[k] = len ? seed_ids[len-1] : 0;
+    printf("%lc", token_char(&vocab, c[0]));
     printf("\nseed string over, generate start:\n\n");
-    for(int i = 0; i < num; ++i){
-        input[c] = 1;
-        forward_network_test(net, input);
-#ifndef GPU
-        float *out = get_network_layer_data(net, net->output_layer, 0, 0);
-#else
-        int network_output_size = get_network_output_size_layer(net, net->output_layer);
-        float *network_output_gpu = get_network_layer_data(net, net->output_layer, 0, 1);
-        float *out = malloc(network_output_size * sizeof(float));
-        cuda_pull_array(network_output_gpu, out, network_output_size);
-#endif
-        float max = -FLT_MAX;
-        float min = FLT_MAX;
-        for(int j = 0; j < net->classes; ++j){
-            if(out[j] > max) max = out[j];
-            if(out[j] < min) min = out[j];
-            //printf("%d %lc %f\n",j, j, out[j]);
-        }
-        //printf("test_char_rnn max: %.10f, min: %.10f\n", max, min);
-
-        input[c] = 0;
-        if(1){
-            for(int j = 0; j < net->inputs; ++j){
-                if (out[j] < .001) out[j] = 0;
-            }
-            c = sample_array(out, net->inputs);
-        } else {
-            float max = -FLT_MAX;
-            int max_index = -1;
-            for(int j = 0; j < net->inputs; ++j){
-                if (out[j] > max){
-                    max = out[j];
-                    max_index = j;
-                }
+    double time_start = what_time_is_it_now();
+    if(beam > 0){
+        float *score = calloc(beam, sizeof(float));
+        beam_char_rnn(scheduler, sessions, beam, c[0], num, text, score);
+        for(int k = 0; k < beam; ++k){
+            printf("beam %d, log probability %f:\n", k, score[k]);
+            for(int i = 0; i < num; ++i) printf("%lc", token_char(&vocab, text[k*num + i]));
+            printf("\n\n");
+        }
+        free_ptr(score);
+    } else {
+        // only the ids of the vocabulary are sampled when there is one, the outputs past it were never trained
+        int tokens = (vocab.chars && vocab.vocab < scheduler->outputs) ? vocab.vocab : scheduler->outputs;
+        for(int i = 0; i < num; ++i){
+            for(int k = 0; k < streams; ++k) rnn_session_step(scheduler, sessions[k], c[k]);
+            rnn_scheduler_run(scheduler);
+            for(int k = 0; k < streams; ++k){
+                c[k] = sample_char_rnn(sessions[k]->output, tokens, topk, topp, candidates);
+                text[k*num + i] = c[k];
             }
-            c = max_index;
+            if(streams == 1) printf("%lc", token_char(&vocab, c[0]));
+        }
+        for(int k = 0; streams > 1 && k < streams; ++k){
+            printf("stream %d:\n", k);
+            for(int i = 0; i < num; ++i) printf("%lc", token_char(&vocab, text[k*num + i]));
+            printf("\n\n");
         }
-        printf("%lc", c);
-#ifdef GPU
-        free_ptr(out);
-#endif
     }
+    double time_used = what_time_is_it_now() - time_start;
     printf("\n");
-    free_ptr(input);
+    fprintf(stderr, "%d streams, %d tokens in %.3lf seconds, %.1lf tokens/s\n",
+            streams, streams * num, time_used, streams * num / (time_used + 1e-9));
+    for(int k = 0; k < streams; ++k) free_rnn_session(sessions[k]);
+    free_ptr(sessions);
+    free_rnn_scheduler(scheduler);
+    free_network(net);
+    free_ptr(c);
+    free_ptr(candidates);
+    free_ptr(text);
+    free_ptr(seed_chars);
+    free_ptr(seed_ids);
+    free_token_corpus(&vocab);
 }
 
 void generate_token(char *token_file)
@@ -229,23 +516,33 @@ void run_char_rnn(int argc, char **argv)
 {
     double time_start = what_time_is_it_now();;
     if(argc < 4){
-        fprintf(stderr, "usage: %s %s [train/generate] [cfg] [weights (optional)]\n", argv[0], argv[1]);
+        fprintf(stderr, "usage: %s %s [train/generate] [cfg] [weights (optional)] [-vocab tokens]\n"
+                "       %s %s tokenize [text] -out [tokens]\n", argv[0], argv[1], argv[0], argv[1]);
         return;
     }
     char *filename = find_char_arg(argc, argv, "-data", "data/shakespeare.txt");
     char *seed = find_char_arg(argc, argv, "-seed", "\n\n");
     int len = find_int_arg(argc, argv, "-len", 20);
+    int streams = find_int_arg(argc, argv, "-streams", 1);
+    int beam = find_int_arg(argc, argv, "-beam", 0);
+    int topk = find_int_arg(argc, argv, "-topk", 0);
+    float topp = find_float_arg(argc, argv, "-topp", 1);
+    char *vocab = find_char_arg(argc, argv, "-vocab", 0);
 
     char *cfg = argv[3];
     char *weights = (argc > 4) ? argv[4] : 0;
     if(0==strcmp(argv[2], "train")){
         train_char_rnn(cfg, weights, filename);
     } else if(0==strcmp(argv[2], "generate")){
-        test_char_rnn(cfg, weights, len, seed);
+        test_char_rnn(cfg, weights, len, seed, streams, beam, topk, topp, vocab);
     } else if(0==strcmp(argv[2], "generate_token")){
         generate_token(filename);
+    } else if(0==strcmp(argv[2], "tokenize")){
+        char *outfile = find_char_arg(argc, argv, "-out", "data/tokens.bin");
+        tokenize_char_rnn(argv[3], outfile);
     } else {
-        fprintf(stderr, "usage: %s %s [train/generate] [cfg] [weights (optional)]\n", argv[0], argv[1]);
+        fprintf(stderr, "usage: %s %s [train/generate] [cfg] [weights (optional)]\n"
+                "       %s %s tokenize [text] -out [tokens]\n", argv[0], argv[1], argv[0], argv[1]);
     }
     fprintf(stderr, "\n\ntotal %.2lf seconds\n\n\n", what_time_is_it_now() - time_start);
 }
@@ -163,3 +163,151 @@ extern "C" void gradient_array_gpu(float *x, int n, ACTIVATION a, float *delta)
     gradient_array_kernel<<<cuda_gridsize(n), BLOCK>>>(x, n, a, delta);
     check_error(cudaPeekAtLastError());
 }
+
+__global__ void lstm_forward_kernel(int n, int outputs, float *wx, float *ux, float *gate, float *c, float *h)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int k = (index / outputs)*4*outputs + index % outputs;
+    float f = logistic_activate_kernel(wx[k] + ux[k]);
+    float i = logistic_activate_kernel(wx[k + outputs] + ux[k + outputs]);
+    float g = tanh_activate_kernel(wx[k + 2*outputs] + ux[k + 2*outputs]);
+    float o = logistic_activate_kernel(wx[k + 3*outputs] + ux[k + 3*outputs]);
+    gate[k] = f;
+    gate[k + outputs] = i;
+    gate[k + 2*outputs] = g;
+    gate[k + 3*outputs] = o;
+    float cell = f*c[index] + i*g;
+    c[index] = cell;
+    h[index] = o*tanh_activate_kernel(cell);
+}
+
+__global__ void lstm_backward_kernel(int n, int outputs, float *gate, float *prev_c, float *c, float *dh, float *dc,
+                                     float *dgate_w, float *dgate_u)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int k = (index / outputs)*4*outputs + index % outputs;
+    float f = gate[k];
+    float i = gate[k + outputs];
+    float g = gate[k + 2*outputs];
+    float o = gate[k + 3*outputs];
+    float tc = tanh_activate_kernel(c[index]);
+    float dcell = dc[index] + dh[index]*o*(1 - tc*tc);
+    float df = dcell*prev_c[index]*f*(1 - f);
+    float di = dcell*g*i*(1 - i);
+    float dg = dcell*i*(1 - g*g);
+    float d_o = dh[index]*tc*o*(1 - o);
+    dc[index] = dcell*f;
+    dgate_w[k] = dgate_u[k] = df;
+    dgate_w[k + outputs] = dgate_u[k + outputs] = di;
+    dgate_w[k + 2*outputs] = dgate_u[k + 2*outputs] = dg;
+    dgate_w[k + 3*outputs] = dgate_u[k + 3*outputs] = d_o;
+}
+
+extern "C" void lstm_forward_gpu(int batch, int outputs, float *wx, float *ux, float *gate, float *c, float *h)
+{
+    int n = batch*outputs;
+    lstm_forward_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, wx, ux, gate, c, h);
+    check_error(cudaPeekAtLastError());
+}
+
+extern "C" void lstm_backward_gpu(int batch, int outputs, float *gate, float *prev_c, float *c, float *dh, float *dc,
+                                  float *dgate_w, float *dgate_u)
+{
+    int n = batch*outputs;
+    lstm_backward_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, gate, prev_c, c, dh, dc, dgate_w, dgate_u);
+    check_error(cudaPeekAtLastError());
+}
+
+__global__ void gru_forward_gate_kernel(int n, int outputs, float *wx, float *ux, float *gate, float *state,
+                                        float *forgot_state)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int b = index / outputs;
+    int j = index % outputs;
+    float z = logistic_activate_kernel(ux[b*3*outputs + j] + wx[b*2*outputs + j]);
+    float r = logistic_activate_kernel(ux[b*3*outputs + outputs + j] + wx[b*2*outputs + outputs + j]);
+    gate[b*2*outputs + j] = z;
+    gate[b*2*outputs + outputs + j] = r;
+    forgot_state[index] = r*state[index];
+}
+
+__global__ void gru_forward_output_kernel(int n, int outputs, float *wh, float *ux, float *gate, float *cand,
+                                          float *state, float *output)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int b = index / outputs;
+    int j = index % outputs;
+    float z = gate[b*2*outputs + j];
+    float h = tanh_activate_kernel(ux[b*3*outputs + 2*outputs + j] + wh[index]);
+    cand[index] = h;
+    float out = z*h + (1 - z)*state[index];
+    output[index] = out;
+    state[index] = out;
+}
+
+__global__ void gru_backward_output_kernel(int n, int outputs, float *gate, float *cand, float *state, float *delta,
+                                           float *prev_delta, float *dgate_w, float *dgate_u, float *dcand)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int b = index / outputs;
+    int j = index % outputs;
+    float z = gate[b*2*outputs + j];
+    float h = cand[index];
+    float dz = delta[index]*(h - state[index])*z*(1 - z);
+    float dh = delta[index]*z*(1 - h*h);
+    if(prev_delta) prev_delta[index] += delta[index]*(1 - z);
+    dgate_w[b*2*outputs + j] = dgate_u[b*3*outputs + j] = dz;
+    dcand[index] = dgate_u[b*3*outputs + 2*outputs + j] = dh;
+}
+
+__global__ void gru_backward_gate_kernel(int n, int outputs, float *gate, float *state, float *forgot_delta,
+                                         float *prev_delta, float *dgate_w, float *dgate_u)
+{
+    int index = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(index >= n) return;
+    int b = index / outputs;
+    int j = index % outputs;
+    float r = gate[b*2*outputs + outputs + j];
+    float dr = forgot_delta[index]*state[index]*r*(1 - r);
+    if(prev_delta) prev_delta[index] += forgot_delta[index]*r;
+    dgate_w[b*2*outputs + outputs + j] = dgate_u[b*3*outputs + outputs + j] = dr;
+}
+
+extern "C" void gru_forward_gate_gpu(int batch, int outputs, float *wx, float *ux, float *gate, float *state,
+                                     float *forgot_state)
+{
+    int n = batch*outputs;
+    gru_forward_gate_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, wx, ux, gate, state, forgot_state);
+    check_error(cudaPeekAtLastError());
+}
+
+extern "C" void gru_forward_output_gpu(int batch, int outputs, float *wh, float *ux, float *gate, float *cand,
+                                       float *state, float *output)
+{
+    int n = batch*outputs;
+    gru_forward_output_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, wh, ux, gate, cand, state, output);
+    check_error(cudaPeekAtLastError());
+}
+
+extern "C" void gru_backward_output_gpu(int batch, int outputs, float *gate, float *cand, float *state, float *delta,
+                                        float *prev_delta, float *dgate_w, float *dgate_u, float *dcand)
+{
+    int n = batch*outputs;
+    gru_backward_output_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, gate, cand, state, delta, prev_delta,
+                                                             dgate_w, dgate_u, dcand);
+    check_error(cudaPeekAtLastError());
+}
+
+extern "C" void gru_backward_gate_gpu(int batch, int outputs, float *gate, float *state, float *forgot_delta,
+                                      float *prev_delta, float *dgate_w, float *dgate_u)
+{
+    int n = batch*outputs;
+    gru_backward_gate_kernel<<<cuda_gridsize(n), BLOCK>>>(n, outputs, gate, state, forgot_delta, prev_delta,
+                                                           dgate_w, dgate_u);
+    check_error(cudaPeekAtLastError());
+}
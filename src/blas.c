@@ -1,8 +1,11 @@
 #include "blas.h"
+#include "activations.h"
+#include "utils.h"
 #include "math.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <float.h>
 
 void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2, int c2, float s1, float s2, float *out)
 {
@@ -181,6 +184,11 @@ void l2_cpu(int batch, int n, float *pred, int *truth_label_index, float *delta,
     float diff = 0.0F;
     for(int b = 0; b < batch; ++b){
         int index = b * n;
+        if(truth_label_index[b] < 0){  // masked row
+            memset(error + index, 0, n * sizeof(float));
+            memset(delta + index, 0, n * sizeof(float));
+            continue;
+        }
         for(int i = 0; i < n; ++i){
             if(truth_label_index[b] == i){
                 diff = 1.0F - pred[i + index];
@@ -203,6 +211,23 @@ float dot_cpu(int N, float *X, int INCX, float *Y, int INCY)
     return dot;
 }
 
+void softmax_cpu(float *input, int n, float *output)
+{
+    float sum = 0;
+    float largest = -FLT_MAX;
+    for(int i = 0; i < n; ++i){
+        if(input[i] > largest) largest = input[i];
+    }
+    for(int i = 0; i < n; ++i){
+        float e = exp(input[i] - largest);
+        sum += e;
+        output[i] = e;
+    }
+    for(int i = 0; i < n; ++i){
+        output[i] /= sum;
+    }
+}
+
 void softmax_x_ent_cpu(int batch, int n, float *pred, int *truth, float *delta, float *error)
 {
     for(int b = 0; b < batch; ++b){
@@ -238,6 +263,122 @@ void mult_add_into_cpu(int num, float *a, float *b, float *c)
     }
 }
 
+// gate rows are laid out [f i g o] per batch item, wx and ux are the recurrent and input pre-activations
+void lstm_forward_cpu(int batch, int outputs, float *wx, float *ux, float *gate, float *c, float *h)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int k = b*4*outputs + j;
+            int index = b*outputs + j;
+            float f = logistic_activate(wx[k] + ux[k]);
+            float i = logistic_activate(wx[k + outputs] + ux[k + outputs]);
+            float g = tanh_activate(wx[k + 2*outputs] + ux[k + 2*outputs]);
+            float o = logistic_activate(wx[k + 3*outputs] + ux[k + 3*outputs]);
+            gate[k] = f;
+            gate[k + outputs] = i;
+            gate[k + 2*outputs] = g;
+            gate[k + 3*outputs] = o;
+            c[index] = f*c[index] + i*g;
+            h[index] = o*tanh_activate(c[index]);
+        }
+    }
+}
+
+// dc carries the cell gradient from step t+1 in and hands the one for step t-1 back out
+void lstm_backward_cpu(int batch, int outputs, float *gate, float *prev_c, float *c, float *dh, float *dc,
+                       float *dgate_w, float *dgate_u)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int k = b*4*outputs + j;
+            int index = b*outputs + j;
+            float f = gate[k];
+            float i = gate[k + outputs];
+            float g = gate[k + 2*outputs];
+            float o = gate[k + 3*outputs];
+            float tc = tanh_activate(c[index]);
+            float dcell = dc[index] + dh[index]*o*(1 - tc*tc);
+            float df = dcell*prev_c[index]*f*(1 - f);
+            float di = dcell*g*i*(1 - i);
+            float dg = dcell*i*(1 - g*g);
+            float d_o = dh[index]*tc*o*(1 - o);
+            dc[index] = dcell*f;
+            dgate_w[k] = dgate_u[k] = df;
+            dgate_w[k + outputs] = dgate_u[k + outputs] = di;
+            dgate_w[k + 2*outputs] = dgate_u[k + 2*outputs] = dg;
+            dgate_w[k + 3*outputs] = dgate_u[k + 3*outputs] = d_o;
+        }
+    }
+}
+
+/* wx holds the recurrent [z r] pre-activations and ux the input [z r h] ones */
+void gru_forward_gate_cpu(int batch, int outputs, float *wx, float *ux, float *gate, float *state, float *forgot_state)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int index = b*outputs + j;
+            float z = logistic_activate(ux[b*3*outputs + j] + wx[b*2*outputs + j]);
+            float r = logistic_activate(ux[b*3*outputs + outputs + j] + wx[b*2*outputs + outputs + j]);
+            gate[b*2*outputs + j] = z;
+            gate[b*2*outputs + outputs + j] = r;
+            forgot_state[index] = r*state[index];
+        }
+    }
+}
+
+void gru_forward_output_cpu(int batch, int outputs, float *wh, float *ux, float *gate, float *cand, float *state,
+                            float *output)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int index = b*outputs + j;
+            float z = gate[b*2*outputs + j];
+            float h = tanh_activate(ux[b*3*outputs + 2*outputs + j] + wh[index]);
+            cand[index] = h;
+            output[index] = z*h + (1 - z)*state[index];
+            state[index] = output[index];
+        }
+    }
+}
+
+/* gradients of z and of the candidate pre-activation, prev_delta may be 0 on the first step */
+void gru_backward_output_cpu(int batch, int outputs, float *gate, float *cand, float *state, float *delta,
+                             float *prev_delta, float *dgate_w, float *dgate_u, float *dcand)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int index = b*outputs + j;
+            float z = gate[b*2*outputs + j];
+            float h = cand[index];
+            float dz = delta[index]*(h - state[index])*z*(1 - z);
+            float dh = delta[index]*z*(1 - h*h);
+            if(prev_delta) prev_delta[index] += delta[index]*(1 - z);
+            dgate_w[b*2*outputs + j] = dgate_u[b*3*outputs + j] = dz;
+            dcand[index] = dgate_u[b*3*outputs + 2*outputs + j] = dh;
+        }
+    }
+}
+
+void gru_backward_gate_cpu(int batch, int outputs, float *gate, float *state, float *forgot_delta,
+                           float *prev_delta, float *dgate_w, float *dgate_u)
+{
+    #pragma omp parallel for num_threads(thread_group())
+    for(int b = 0; b < batch; ++b){
+        for(int j = 0; j < outputs; ++j){
+            int index = b*outputs + j;
+            float r = gate[b*2*outputs + outputs + j];
+            float dr = forgot_delta[index]*state[index]*r*(1 - r);
+            if(prev_delta) prev_delta[index] += forgot_delta[index]*r;
+            dgate_w[b*2*outputs + outputs + j] = dgate_u[b*3*outputs + outputs + j] = dr;
+        }
+    }
+}
+
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
 {
     int i, j, k, b;
@@ -28,10 +28,21 @@ void normalize_delta_cpu(float *x, float *mean, float *variance, float *mean_del
 void smooth_l1_cpu(int n, float *pred, float *truth, float *delta, float *error);
 void l2_cpu(int batch, int n, float *pred, int *truth_label_index, float *delta, float *error);
 void softmax_x_ent_cpu(int batch, int n, float *pred, int *truth, float *delta, float *error);
+void softmax_cpu(float *input, int n, float *output);
 void l2normalize_cpu(float *x, int batch, int filters, int spatial, float *norm_data);
 void backward_l2normalize_cpu(int batch, int filters, int spatial, float *norm_data, float *output, float *delta, float *previous_delta);
 void weighted_delta_cpu(int num, float *state, float *h, float *z, float *delta_state, float *delta_h, float *delta_z, float *delta);
 void mult_add_into_cpu(int num, float *a, float *b, float *c);
+void lstm_forward_cpu(int batch, int outputs, float *wx, float *ux, float *gate, float *c, float *h);
+void lstm_backward_cpu(int batch, int outputs, float *gate, float *prev_c, float *c, float *dh, float *dc,
+                       float *dgate_w, float *dgate_u);
+void gru_forward_gate_cpu(int batch, int outputs, float *wx, float *ux, float *gate, float *state, float *forgot_state);
+void gru_forward_output_cpu(int batch, int outputs, float *wh, float *ux, float *gate, float *cand, float *state,
+                            float *output);
+void gru_backward_output_cpu(int batch, int outputs, float *gate, float *cand, float *state, float *delta,
+                             float *prev_delta, float *dgate_w, float *dgate_u, float *dcand);
+void gru_backward_gate_cpu(int batch, int outputs, float *gate, float *state, float *forgot_delta,
+                           float *prev_delta, float *dgate_w, float *dgate_u);
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out);
 
 #ifdef GPU
@@ -79,6 +90,16 @@ void weight_normalize_gpu(int inputs, int outputs, float *x);
 void weighted_delta_gpu(int num, float *state, float *h, float *z, float *delta_state, float *delta_h, float *delta_z, float *delta);
 void weighted_sum_gpu(float *a, float *b, float *s, int num, float *c);
 void mult_add_into_gpu(int num, float *a, float *b, float *c);
+void lstm_forward_gpu(int batch, int outputs, float *wx, float *ux, float *gate, float *c, float *h);
+void lstm_backward_gpu(int batch, int outputs, float *gate, float *prev_c, float *c, float *dh, float *dc,
+                       float *dgate_w, float *dgate_u);
+void gru_forward_gate_gpu(int batch, int outputs, float *wx, float *ux, float *gate, float *state, float *forgot_state);
+void gru_forward_output_gpu(int batch, int outputs, float *wh, float *ux, float *gate, float *cand, float *state,
+                            float *output);
+void gru_backward_output_gpu(int batch, int outputs, float *gate, float *cand, float *state, float *delta,
+                             float *prev_delta, float *dgate_w, float *dgate_u, float *dcand);
+void gru_backward_gate_gpu(int batch, int outputs, float *gate, float *state, float *forgot_delta,
+                           float *prev_delta, float *dgate_w, float *dgate_u);
 void upsample_gpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out);
 #endif
 #endif
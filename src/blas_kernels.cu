@@ -557,7 +557,7 @@ __global__ void specific_margin_add_kernel(int batch, int inputs, float *input,
     int b = index / inputs;
     if(b >= batch) return;
     int i = index % inputs;
-    if(i == truth_label_index_gpu[b]){
+    if(truth_label_index_gpu[b] >= 0 && i == truth_label_index_gpu[b]){
         if(input[b * inputs + truth_label_index_gpu[b]] > -label_specific_margin_bias){
             input[b * inputs + truth_label_index_gpu[b]] += label_specific_margin_bias;
             //printf("exceed -label_specific_margin_bias %d", i);
@@ -582,7 +582,9 @@ __global__ void is_max_gpu_kernel(int batch, int inputs, float *output_gpu, int
     int b = index / inputs;
     if(b >= batch) return;
     int i = index % inputs;
-    if(i != truth_label_index_gpu[b] && output_gpu[b * inputs + i] >= output_gpu[b * inputs + truth_label_index_gpu[b]]){
+    if(truth_label_index_gpu[b] < 0){  // masked row, never counted as correct
+        is_not_max[b] = 1;
+    } else if(i != truth_label_index_gpu[b] && output_gpu[b * inputs + i] >= output_gpu[b * inputs + truth_label_index_gpu[b]]){
         is_not_max[b] = 1;
     }
 }
@@ -868,7 +870,9 @@ __global__ void l2_kernel(int batch, int n, float *pred, int *truth_label_index_
         int b = id / n;
         int i = id % n;
         int index = b * n + i;
-        if(i == truth_label_index_gpu[b]){
+        if(truth_label_index_gpu[b] < 0){  // masked row
+            diff = 0.0F;
+        } else if(i == truth_label_index_gpu[b]){
             diff = 1.0F - pred[index];
         } else {
             diff = 0.0F - pred[index];
@@ -133,6 +133,63 @@ void free_connected_layer(void *input)
     free_ptr(layer);
 }
 
+void increment_layer(connected_layer *l, int steps)
+{
+    int num = l->outputs*l->batch*steps;
+    l->output += num;
+    l->delta += num;
+    if(l->x) l->x += num;
+    if(l->x_norm) l->x_norm += num;
+
+#ifdef GPU
+    l->output_gpu += num;
+    l->delta_gpu += num;
+    if(l->x_gpu) l->x_gpu += num;
+    if(l->x_norm_gpu) l->x_norm_gpu += num;
+#endif
+}
+
+/* rows [offset, offset + outputs) of an existing layer, sharing its parameter buffers. free with free_ptr */
+connected_layer *make_connected_layer_view(const connected_layer *layer, int offset, int outputs)
+{
+    connected_layer *l = calloc(1, sizeof(connected_layer));
+    *l = *layer;
+    l->outputs = outputs;
+    l->output = l->delta = l->x = l->x_norm = 0;
+    l->weights = layer->weights + offset * layer->inputs;
+    l->weight_updates = layer->weight_updates + offset * layer->inputs;
+    l->biases = layer->biases + offset;
+    l->bias_updates = layer->bias_updates + offset;
+    if(l->batch_normalize){
+        l->scales = layer->scales + offset;
+        l->scale_updates = layer->scale_updates + offset;
+        l->mean = layer->mean + offset;
+        l->variance = layer->variance + offset;
+        l->mean_delta = layer->mean_delta + offset;
+        l->variance_delta = layer->variance_delta + offset;
+        l->rolling_mean = layer->rolling_mean + offset;
+        l->rolling_variance = layer->rolling_variance + offset;
+    }
+#ifdef GPU
+    l->output_gpu = l->delta_gpu = l->x_gpu = l->x_norm_gpu = 0;
+    l->weights_gpu = layer->weights_gpu + offset * layer->inputs;
+    l->weight_updates_gpu = layer->weight_updates_gpu + offset * layer->inputs;
+    l->biases_gpu = layer->biases_gpu + offset;
+    l->bias_updates_gpu = layer->bias_updates_gpu + offset;
+    if(l->batch_normalize){
+        l->scales_gpu = layer->scales_gpu + offset;
+        l->scale_updates_gpu = layer->scale_updates_gpu + offset;
+        l->mean_gpu = layer->mean_gpu + offset;
+        l->variance_gpu = layer->variance_gpu + offset;
+        l->mean_delta_gpu = layer->mean_delta_gpu + offset;
+        l->variance_delta_gpu = layer->variance_delta_gpu + offset;
+        l->rolling_mean_gpu = layer->rolling_mean_gpu + offset;
+        l->rolling_variance_gpu = layer->rolling_variance_gpu + offset;
+    }
+#endif
+    return l;
+}
+
 void forward_connected_batchnorm_layer(const connected_layer *layer, int test)
 {
     if(0 == test){    // 0: train, 1: valid
@@ -201,6 +258,46 @@ void forward_connected_layer(connected_layer *layer, float *input, int test)
     printf("forward_connected_layer max: %f, min: %f\n", max, min);*/
 }
 
+/* forward of a recurrent sub layer for all steps in one gemm, batchnorm statistics stay per step */
+void forward_connected_layer_steps(connected_layer *layer, float *input, int steps, int test)
+{
+    if(layer->weight_normalize && 0 == test){         // 0: train, 1: valid
+        for(int i = 0; i < layer->outputs; i++){
+            float sum = 1e-6;
+            for(int j = 0; j < layer->inputs; j++){
+                float temp = layer->weights[i * layer->inputs + j];
+                sum += temp * temp;
+            }
+            float scale = sqrtf(sum);
+            for(int j = 0; j < layer->inputs; j++){
+                layer->weights[i * layer->inputs + j] /= scale;
+            }
+        }
+    }
+    int m = layer->batch * steps;
+    gemm(0, 1, m, layer->outputs, layer->inputs, 1, input, layer->inputs, layer->weights, layer->inputs, 0,
+         layer->output, layer->outputs);
+    for(int i = 0; i < steps; ++i){
+        if(layer->batch_normalize){
+            forward_connected_batchnorm_layer(layer, test);
+        }
+        if(layer->bias_term){
+            for(int b = 0; b < layer->batch; ++b){
+                for(int j = 0; j < layer->outputs; ++j){
+                    layer->output[b*layer->outputs + j] += layer->biases[j];
+                }
+            }
+        }
+        increment_layer(layer, 1);
+    }
+    increment_layer(layer, -steps);
+
+    int all_outputs = layer->outputs * m;
+    for(int i = 0; i < all_outputs; ++i){
+        layer->output[i] = activate(layer->output[i], layer->activation);
+    }
+}
+
 void update_connected_layer(connected_layer *layer, float learning_rate, float momentum, float decay)
 {
     for(int i = 0; i < layer->outputs; i ++){
@@ -276,6 +373,33 @@ void backward_connected_layer(connected_layer *layer, float *input, float *delta
     }
 }
 
+void backward_connected_layer_steps(connected_layer *layer, float *input, float *delta, int steps, int test)
+{
+    int m = layer->batch * steps;
+    int all_outputs = layer->outputs * m;
+    for(int i = 0; i < all_outputs; ++i){
+        layer->delta[i] *= gradient(layer->output[i], layer->activation);
+    }
+    for(int i = 0; i < m; ++i){
+        for(int j = 0; j < layer->outputs; ++j){
+            layer->bias_updates[j] += (layer->delta + i * layer->outputs)[j];
+        }
+    }
+    if(layer->batch_normalize){
+        for(int i = 0; i < steps; ++i){
+            backward_connected_batchnorm_layer(layer, test);
+            increment_layer(layer, 1);
+        }
+        increment_layer(layer, -steps);
+    }
+    gemm(1, 0, layer->outputs, layer->inputs, m, 1, layer->delta, layer->outputs, input, layer->inputs, 1,
+         layer->weight_updates, layer->inputs);
+    if(delta) {
+        gemm(0, 0, m, layer->inputs, layer->outputs, 1, layer->delta, layer->outputs, layer->weights, layer->inputs, 1,
+             delta, layer->inputs);
+    }
+}
+
 #ifdef GPU
 
 void update_connected_layer_gpu(connected_layer *layer, float learning_rate, float momentum, float decay)
@@ -339,6 +463,27 @@ void forward_connected_layer_gpu(connected_layer *layer, float *input, int test)
     cuda_compare(layer->output_gpu, layer->output, layer->batch * layer->outputs, cuda_compare_error_string); */
 }
 
+void forward_connected_layer_steps_gpu(connected_layer *layer, float *input, int steps, int test)
+{
+    if(layer->weight_normalize && 0 == test){         // 0: train, 1: valid
+        weight_normalize_gpu(layer->inputs, layer->outputs, layer->weights_gpu);
+    }
+    int m = layer->batch * steps;
+    gemm_gpu(0, 1, m, layer->outputs, layer->inputs, 1, input, layer->inputs, layer->weights_gpu, layer->inputs, 0,
+             layer->output_gpu, layer->outputs);
+    if(layer->bias_term){
+        add_bias_gpu(layer->output_gpu, layer->biases_gpu, m, layer->outputs, 1);
+    }
+    if(layer->batch_normalize){
+        for(int i = 0; i < steps; ++i){
+            forward_connected_batchnorm_layer_gpu(layer, test);
+            increment_layer(layer, 1);
+        }
+        increment_layer(layer, -steps);
+    }
+    activate_array_gpu(layer->output_gpu, layer->outputs*m, layer->activation);
+}
+
 void backward_connected_batchnorm_layer_gpu(const connected_layer *layer, int test)
 {
     if(0 != test){    // 0: train, 1: valid
@@ -387,6 +532,26 @@ void backward_connected_layer_gpu(connected_layer *layer, float *input, float *d
     cuda_compare(layer->delta_gpu, layer->delta, layer->batch * layer->outputs, cuda_compare_error_string);*/
 }
 
+void backward_connected_layer_steps_gpu(connected_layer *layer, float *input, float *delta, int steps, int test)
+{
+    int m = layer->batch * steps;
+    gradient_array_gpu(layer->output_gpu, layer->outputs*m, layer->activation, layer->delta_gpu);
+    backward_bias_gpu(layer->bias_updates_gpu, layer->delta_gpu, m, layer->outputs, 1);
+    if(layer->batch_normalize){
+        for(int i = 0; i < steps; ++i){
+            backward_connected_batchnorm_layer_gpu(layer, test);
+            increment_layer(layer, 1);
+        }
+        increment_layer(layer, -steps);
+    }
+    gemm_gpu(1, 0, layer->outputs, layer->inputs, m, 1, layer->delta_gpu, layer->outputs, input, layer->inputs, 1,
+             layer->weight_updates_gpu, layer->inputs);
+    if(delta) {
+        gemm_gpu(0, 0, m, layer->inputs, layer->outputs, 1, layer->delta_gpu, layer->outputs, layer->weights_gpu,
+                 layer->inputs, 1, delta, layer->inputs);
+    }
+}
+
 void pull_connected_layer(const connected_layer *layer)
 {
     cuda_pull_array(layer->weights_gpu, layer->weights, layer->inputs*layer->outputs);
@@ -31,16 +31,26 @@ typedef struct{
 connected_layer *make_connected_layer(int inputs, int outputs, int batch, int steps, ACTIVATION activation, int weight_normalize,
                                       int bias_term, float lr_mult, float lr_decay_mult, float bias_mult,
                                       float bias_decay_mult, int weight_filler, float sigma, int batch_normalize);
+connected_layer *make_connected_layer_view(const connected_layer *layer, int offset, int outputs);
 void free_connected_layer(void *input);
 void forward_connected_layer(connected_layer *layer, float *input, int test);
 void backward_connected_layer(connected_layer *layer, float *input, float *delta, int test);
+void forward_connected_layer_steps(connected_layer *layer, float *input, int steps, int test);
+void backward_connected_layer_steps(connected_layer *layer, float *input, float *delta, int steps, int test);
 void update_connected_layer(connected_layer *layer, float learning_rate, float momentum, float decay);
+void forward_connected_batchnorm_layer(const connected_layer *layer, int test);
+void backward_connected_batchnorm_layer(const connected_layer *layer, int test);
 image get_connected_image(const connected_layer *layer);
+void increment_layer(connected_layer *l, int steps);
 
 #ifdef GPU
 void forward_connected_layer_gpu(connected_layer *layer, float *input, int test);
 void backward_connected_layer_gpu(connected_layer *layer, float *input, float *delta, int test);
+void forward_connected_layer_steps_gpu(connected_layer *layer, float *input, int steps, int test);
+void backward_connected_layer_steps_gpu(connected_layer *layer, float *input, float *delta, int steps, int test);
 void update_connected_layer_gpu(connected_layer *layer, float learning_rate, float momentum, float decay);
+void forward_connected_batchnorm_layer_gpu(const connected_layer *layer, int test);
+void backward_connected_batchnorm_layer_gpu(const connected_layer *layer, int test);
 void push_connected_layer(const connected_layer *layer);
 void pull_connected_layer(const connected_layer *layer);
 #endif
@@ -29,6 +29,7 @@ void forward_cost_layer(const cost_layer *l, float *input, network *net)
     l2_cpu(l->batch, l->inputs, input, net->truth_label_index, l->delta, l->output);
 
     for(int b = 0; b < l->batch; ++b){
+        if(net->truth_label_index[b] < 0) continue;  // masked row
         int index = b * l->inputs;
         int max_i = net->truth_label_index[b];
         double max = input[index + net->truth_label_index[b]];
@@ -69,6 +70,7 @@ void forward_cost_layer_gpu(const cost_layer *l, float *input_gpu, network *net)
     float *input_temp = calloc(l->inputs*l->batch, sizeof(float));
     cuda_pull_array(input_gpu, input_temp, l->batch*l->inputs);
     for(int b = 0; b < l->batch; ++b){
+        if(net->truth_label_index[b] < 0) continue;  // masked row
         int max_i = 0;
         double max = input_temp[b * l->inputs];
         for(int j = 0; j < net->classes; ++j){
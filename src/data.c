@@ -2,10 +2,15 @@
 #include "list.h"
 #include "utils.h"
 #include "image.h"
+#include "file_reader.h"
+#include "image_augment.h"
+#include "image_cache.h"
+#include "text_table.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 struct list *get_paths(char *filename)
 {
@@ -28,6 +33,150 @@ void free_batch(batch *b)
     b->truth_label_index = NULL;
 }
 
+// size b for n images of w x h x c, the buffers of a batch loaded into it before are kept when they are large enough
+void reserve_batch(batch *b, int n, int w, int h, int c)
+{
+    if(!b->data || (size_t)b->n * b->w * b->h * b->c < (size_t)n * w * h * c){
+        free(b->data);
+        b->data = calloc((size_t)n * w * h * c, sizeof(float));
+    }
+    if(!b->truth_label_index || b->n < n){
+        free(b->truth_label_index);
+        b->truth_label_index = calloc(n, sizeof(int));
+    }
+    memset(b->truth_label_index, 0, n * sizeof(int));
+    b->n = n;
+    b->w = w;
+    b->h = h;
+    b->c = c;
+}
+
+static pthread_key_t load_scratch_key;
+static pthread_once_t load_scratch_once = PTHREAD_ONCE_INIT;
+
+static void finish_file_batch(file_batch *f);
+
+static void free_load_scratch(void *p)
+{
+    load_scratch *s = (load_scratch *)p;
+    for(int i = 0; i < 2; ++i){
+        file_batch *f = s->files + i;
+        finish_file_batch(f);
+        free_file_reads(&f->reads);
+        free_file_buffers(f->buffers, f->size);
+        free_ptr(f->buffers);
+        free_ptr(f->index);
+        free_ptr(f->order);
+        free_ptr(f->paths);
+        free_ptr(f->cached);
+    }
+    free_ptr(s->index);
+    free_ptr(s->bytes);
+    free_ptr(s);
+}
+
+static void make_load_scratch_key()
+{
+    pthread_key_create(&load_scratch_key, free_load_scratch);
+}
+
+// the scratch of the calling thread with room for n images, valid until its next batch
+load_scratch *get_load_scratch(int n)
+{
+    pthread_once(&load_scratch_once, make_load_scratch_key);
+    load_scratch *s = pthread_getspecific(load_scratch_key);
+    if(!s){
+        s = calloc(1, sizeof(load_scratch));
+        pthread_setspecific(load_scratch_key, s);
+    }
+    if(n > s->size){
+        s->index = realloc(s->index, n * sizeof(int));
+        s->size = n;
+    }
+    return s;
+}
+
+static void reserve_file_batch(file_batch *f, int n)
+{
+    if(n > f->size){
+        f->index = realloc(f->index, n * sizeof(int));
+        f->order = realloc(f->order, n * sizeof(int));
+        f->paths = realloc(f->paths, n * sizeof(char *));
+        f->cached = realloc(f->cached, n * sizeof(image_cache_entry *));
+        memset(f->cached + f->size, 0, (n - f->size) * sizeof(image_cache_entry *));
+        f->buffers = realloc(f->buffers, n * sizeof(file_buffer));
+        memset(f->buffers + f->size, 0, (n - f->size) * sizeof(file_buffer));
+        f->size = n;
+    }
+}
+
+// the cached images of f->index [0, n) are held, the reads of the others started
+static void start_file_batch(file_batch *f, path_table *paths, int n, image_cache *cache)
+{
+    f->n = n;
+    f->hits = 0;
+    f->cache = cache;
+    for(int i = 0; i < n; ++i){
+        f->cached[i] = cache ? image_cache_get(cache, f->index[i]) : NULL;
+        if(f->cached[i]) f->order[f->hits++] = i;
+    }
+    int misses = 0;
+    for(int i = 0; i < n; ++i){
+        if(f->cached[i]) continue;
+        f->order[f->hits + misses] = i;
+        f->paths[misses++] = table_path(paths, f->index[i]);
+    }
+    f->reading = file_read_depth() > 0;
+    if(f->reading) start_file_reads(&f->reads, f->paths, misses, f->buffers);
+    f->started = 1;
+}
+
+// wait for the reads and give back the cached images the decode did not take
+static void finish_file_batch(file_batch *f)
+{
+    if(!f->started) return;
+    if(f->reading) end_file_reads(&f->reads);
+    f->reading = 0;
+    for(int i = 0; i < f->n; ++i){
+        if(f->cached[i]) image_cache_release(f->cache, f->cached[i]);
+        f->cached[i] = NULL;
+    }
+    f->started = 0;
+}
+
+static void start_sampled_file_batch(file_batch *f, path_table *paths, sampler *samples, uint64_t position, int n,
+                                     image_cache *cache)
+{
+    finish_file_batch(f);
+    reserve_file_batch(f, n);
+    f->samples = samples;
+    f->position = position;
+    f->first = sampler_at(samples, position, f->index, n);
+    start_file_batch(f, paths, n, cache);
+}
+
+/* the file batch of the calling thread for the n samples at position, the one the thread started ahead when it is
+ * for them; the reads of the samples at next (-1: none), the thread's next batch, are started as well */
+static file_batch *take_file_batch(path_table *paths, sampler *samples, uint64_t position, uint64_t next, int n,
+                                   image_cache *cache)
+{
+    load_scratch *s = get_load_scratch(0);
+    file_batch *f = s->files + s->current;
+    if(!f->started || f->samples != samples || f->position != position || f->n != n || f->cache != cache){
+        start_sampled_file_batch(f, paths, samples, position, n, cache);
+    }
+    if(next != (uint64_t)-1) start_sampled_file_batch(s->files + !s->current, paths, samples, next, n, cache);
+    return f;
+}
+
+// the decode of f is done, the batch started ahead becomes the current one
+static void end_file_batch(file_batch *f)
+{
+    finish_file_batch(f);
+    load_scratch *s = get_load_scratch(0);
+    s->current = f == s->files ? 1 : 0;
+}
+
 
 void fill_truth(char *path, char **labels, int classes, int *truth_label_index)
 {
@@ -39,51 +188,40 @@ void fill_truth(char *path, char **labels, int classes, int *truth_label_index)
     }
 }
 
+// the class of path i, read from the table once resolve_path_labels has run, otherwise searched for like fill_truth
+void fill_path_truth(path_table *paths, int i, char **labels, int classes, int *truth_label_index)
+{
+    if(paths->label){
+        if(paths->label[i] >= 0) *truth_label_index = paths->label[i];
+    } else {
+        fill_truth(table_path(paths, i), labels, classes, truth_label_index);
+    }
+}
+
+// csv rows of label,pixels..., parsed in parallel from the mapped file straight into image_all
 void load_csv_images(char *filename, char **labels, int classes, int train_set_size, int image_size, float *image_all,
                      int *truth_lable_all, float hue, float saturation, float exposure, int test)
 {
-    FILE *fp = fopen(filename, "r");
-    if(!fp) file_error(filename);
-    int fields = 0;  // the number of pixel per image
-    int w, h;
-    int n = 0;
-    char *line;
-    while((line = fgetl(fp)) && (n < train_set_size)){
-        char class = line[0];
-        if(0 == fields){
-            fields = count_fields(line);
-            w = sqrtf(fields);
-            h = sqrtf(fields);
-        }
-        float *value = parse_fields(line, fields);
-        memcpy(image_all + n * image_size, value + 1, image_size * sizeof(float));
-        image crop;
-        crop.w = w;
-        crop.h = h;
-        crop.c = 1;
-        crop.data = image_all + n * image_size;
-        if(crop.c == 3 && test == 0) {      // 0: train, 1: valid
-            random_distort_image(crop, hue, saturation, exposure);
-        }
-        normalize_array(image_all + n * image_size, image_size);
-        /*float max = -FLT_MAX, min = FLT_MAX;
-        for(int i = 0; i < crop.w * crop.h * crop.c; ++i){
-            if(crop.data[i] > max) max = crop.data[i];
-            if(crop.data[i] < min) min = crop.data[i];
-        }
-        printf("input image max: %f, min: %f\n", max, min);
-        exit(-1);*/
-
+    text_table *t = open_text_table(filename);
+    if(t->cols - 1 != image_size){
+        fprintf(stderr, "%s: %d pixels per row, the network takes %d\n", filename, t->cols - 1, image_size);
+        exit(-1);
+    }
+    int n = t->rows < train_set_size ? t->rows : train_set_size;
+    float *class = calloc(n, sizeof(float));
+    read_text_table(t, n, 1, class, image_all);
+    free_text_table(t);
+    #pragma omp parallel for
+    for(int i = 0; i < n; ++i){
+        normalize_array(image_all + (size_t)i * image_size, image_size);
         char name[16] = {0};
-        sprintf(name, "%c.png", class);
-        fill_truth(name, labels, classes, truth_lable_all + n);
-        free(line);
-        free(value);
-        n += 1;
+        sprintf(name, "%d.png", (int)class[i]);
+        fill_truth(name, labels, classes, truth_lable_all + i);
     }
-    fclose(fp);
+    free_ptr(class);
 }
 
+// every image once, padded with random ones to train_set_size_real, in one Fisher-Yates pass
 int *get_random_index(int train_set_size, int train_set_size_real)
 {
     int *index = calloc(train_set_size_real, sizeof(int));
@@ -91,17 +229,14 @@ int *get_random_index(int train_set_size, int train_set_size_real)
         if(i < train_set_size) {
             index[i] = i;
         } else {
-            index[i] = rand() % train_set_size;
+            index[i] = rand_size_t() % train_set_size;
         }
     }
-    /* shuffle the int array  */
-    for(int j = 0; j < 5; j++){
-        for(int i = 0; i < train_set_size_real; i++) {
-            int index_random = rand() % train_set_size_real;
-            int temp = index[i];
-            index[i] = index[index_random];
-            index[index_random] = temp;
-        }
+    for(int i = train_set_size_real - 1; i > 0; --i){
+        int j = rand_size_t() % (i + 1);
+        int temp = index[i];
+        index[i] = index[j];
+        index[j] = temp;
     }
     return index;
 }
@@ -151,7 +286,7 @@ batch *load_csv_image_to_memory(char *filename, int batch_size, char **labels, i
     return train_data;
 }
 
-batch *load_image_to_memory(char **paths, int batch_size, char **labels, int classes, int train_set_size,
+batch *load_image_to_memory(path_table *paths, int batch_size, char **labels, int classes, int train_set_size,
                             int *batch_num_return, int w, int h, int c, float hue, float saturation, float exposure,
                             int flip, float mean_value, float scale, int test)
 {
@@ -175,32 +310,22 @@ batch *load_image_to_memory(char **paths, int batch_size, char **labels, int cla
         train_data[i].data = calloc(batch_size * image_size, sizeof(float));
         train_data[i].truth_label_index = calloc(batch_size, sizeof(int));
         for(int j = 0; j < batch_size; ++j){
-            char *image_path = NULL;
+            int path_index = test == 0 ? index[i * batch_size + j] : i * batch_size + j;      // test 0: train, 1: valid
+            char *image_path = table_path(paths, path_index);
+            augment_args a = make_augment_args(w, h);
             if(test == 0) {      // 0: train, 1: valid
-                image_path = paths[index[i * batch_size + j]];
-            } else {
-                image_path = paths[i * batch_size + j];
+                rand_stream((uint64_t)i * batch_size + j);
+                if(flip) a.flip = rand_int(0, 1);
+                random_augment_color(&a, hue, saturation, exposure);
             }
-            image img = load_image(image_path, w, h, c);
-            if(test == 0) {      // 0: train, 1: valid
-                if(flip){
-                    if(rand() % 2){
-                        flip_image(img);
-                    }
-                }
-                random_distort_image(img, hue, saturation, exposure);
-            }
-            if(mean_value > 0.001){
-                for(int k = 0; k < image_size; ++k){
-                    // load_image_stb divide 255.0F
-                    img.data[k] = (img.data[k] * 255.0F - mean_value) * scale;
-                }
-            }
-
-            memcpy(train_data[i].data + j * image_size, img.data, image_size * sizeof(float));
-            free_image(img);
+            a.mean_value = mean_value;
+            a.scale = scale;
+            int iw, ih, ic;
+            unsigned char *pixels = load_image_pixels(image_path, &iw, &ih, &ic, c);
+            augment_image_into(pixels, iw, ih, c, 0, a, train_data[i].data + (size_t)j * image_size);
+            free(pixels);
             //normalize_array(b.data + i * image_size, image_size);
-            fill_truth(image_path, labels, classes, train_data[i].truth_label_index + j);
+            fill_path_truth(paths, path_index, labels, classes, train_data[i].truth_label_index + j);
         }
     }
     free_ptr(index);
@@ -210,61 +335,80 @@ batch *load_image_to_memory(char **paths, int batch_size, char **labels, int cla
     return train_data;
 }
 
-batch random_batch(char **paths, int batch_size, char **labels, int classes, int train_set_size, int w, int h, int c,
-                   float hue, float saturation, float exposure, int flip, float mean_value, float scale, int test)
+/* the images of the sampler from position on, or of the list in order in test mode; next: the position of the next
+ * batch of the calling thread, its reads start before this batch decodes, -1: none; the images are decoded in the
+ * order their reads complete; cache: decoded images kept across batches, NULL decodes every draw; b keeps its buffers
+ * from the last batch */
+void random_batch(path_table *paths, batch *b, sampler *samples, uint64_t position, uint64_t next, int batch_size,
+                  char **labels, int classes, int w, int h, int c, float hue, float saturation, float exposure,
+                  int flip, float mean_value, float scale, int test, image_cache *cache)
 {
     static int test_index = 0;
     int image_size = h * w * c;
-    batch b;
-    b.w = w;
-    b.h = h;
-    b.c = c;
-    b.n = batch_size;
-    b.data = calloc(batch_size * image_size, sizeof(float));
-    //b.truth = calloc(batch_size * classes, sizeof(float));
-    b.truth_label_index = calloc(batch_size, sizeof(int));
-
-#pragma omp parallel for
-    for(int i = 0; i < batch_size; ++i){
-        int index = 0;
-        image img;
-        if(test == 0) {      // 0: train, 1: valid
-            index = rand() % train_set_size;
-            img = load_image(paths[index], w, h, c);
-            if(flip){
-                if(rand() % 2){
-                    flip_image(img);
-                }
-            }
-            random_distort_image(img, hue, saturation, exposure);
+    reserve_batch(b, batch_size, w, h, c);
+
+    file_batch *f;
+    if(test){
+        load_scratch *s = get_load_scratch(0);
+        f = s->files + s->current;
+        finish_file_batch(f);
+        reserve_file_batch(f, batch_size);
+        f->samples = NULL;
+        for(int i = 0; i < batch_size; ++i) f->index[i] = test_index + i;
+        test_index += batch_size;
+        start_file_batch(f, paths, batch_size, cache);
+    } else {
+        f = take_file_batch(paths, samples, position, next, batch_size, cache);
+    }
+    int *index = f->index;
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int k = 0; k < batch_size; ++k){
+        int i, iw, ih, ic;
+        unsigned char *pixels = NULL;
+        image_cache_entry *e = NULL;
+        if(k < f->hits){
+            i = f->order[k];
+            e = f->cached[i];
+            f->cached[i] = NULL;
         } else {
-            index = test_index;
-            //printf("index: %d %s %f %f\n", index, paths[index], mean_value, scale);
-            img = load_image(paths[index], w, h, c);
-            //flip_image(img); printf("in random_batch: flip_image to extract feature, ");
-            test_index += 1;
-        }
-        //save_image_png(img, "input.jpg");
-        if(mean_value > 0.001){
-            for(int k = 0; k < image_size; ++k){
-                // load_image_stb divide 255.0F
-                img.data[k] = (img.data[k] * 255.0F - mean_value) * scale;
+            int j = f->reading ? next_file_read(&f->reads) : k - f->hits;
+            i = f->order[f->hits + j];
+            if(f->reading){
+                pixels = load_image_memory_pixels(f->buffers[j].data, f->buffers[j].size, &iw, &ih, &ic, c);
+            } else {
+                pixels = load_image_pixels(f->paths[j], &iw, &ih, &ic, c);
             }
+            if(cache) e = image_cache_put(cache, index[i], pixels, iw, ih, c);
         }
-        memcpy(b.data + i * image_size, img.data, image_size * sizeof(float));
-        /*float max = -FLT_MAX, min = FLT_MAX;
-        for(int i = 0; i < img.w * img.h * img.c; ++i){
-            if(img.data[i] > max) max = img.data[i];
-            if(img.data[i] < min) min = img.data[i];
+        augment_args a = make_augment_args(w, h);
+        if(test == 0) {      // 0: train, 1: valid
+            rand_stream(f->first + (uint64_t)i * samples->replicas);
+            if(flip) a.flip = rand_int(0, 1);
+            random_augment_color(&a, hue, saturation, exposure);
         }
-        printf("input image max: %f, min: %f\n", max, min);
-        */
-        free_image(img);
-        fill_truth(paths[index], labels, classes, b.truth_label_index + i);
-        //printf("index: %d %s %d %f %f\n", index, paths[index], b.truth_label_index[i], mean_value, scale);
-        //exit(-1);
+        a.mean_value = mean_value;
+        a.scale = scale;
+        if(e){
+            augment_image_into(e->pixels, e->w, e->h, c, 0, a, b->data + (size_t)i * image_size);
+            image_cache_release(cache, e);
+        } else {
+            augment_image_into(pixels, iw, ih, c, 0, a, b->data + (size_t)i * image_size);
+            free(pixels);
+        }
+        fill_path_truth(paths, index[i], labels, classes, b->truth_label_index + i);
     }
-    return b;
+    end_file_batch(f);
+}
+
+// size bytes of the scratch, kept like the rest of it
+unsigned char *load_scratch_bytes(load_scratch *s, size_t size)
+{
+    if(size > s->bytes_size){
+        free_ptr(s->bytes);
+        s->bytes = malloc(size);
+        s->bytes_size = size;
+    }
+    return s->bytes;
 }
 
 char **get_labels(char *filename)
@@ -302,16 +446,6 @@ matrix make_matrix(int rows, int cols)
     return m;
 }
 
-char **get_random_paths(char **paths, int n, int train_set_size)
-{
-    char **random_paths = calloc(n, sizeof(char*));
-    for(int i = 0; i < n; ++i){
-        int index = rand()%train_set_size;
-        random_paths[i] = paths[index];
-    }
-    return random_paths;
-}
-
 box_label *read_boxes(char *filename, int *n)
 {
     FILE *file = fopen(filename, "r");
@@ -347,7 +481,7 @@ void randomize_boxes(box_label *b, int n)
     int i;
     for(i = 0; i < n; ++i){
         box_label swap = b[i];
-        int index = rand()%n;
+        int index = rand_size_t()%n;
         b[i] = b[index];
         b[index] = swap;
     }
@@ -392,16 +526,19 @@ void correct_boxes(box_label *boxes, int n, float dx, float dy, float sx, float
     }
 }
 
-void fill_truth_detection(char *path, int max_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+// the label file of an image: /train/ replaced by /labels/ and the image extension by .txt
+void detection_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "/train/", "/labels/", labelpath);
     find_replace(labelpath, ".jpg", ".txt", labelpath);
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
+}
+
+static void fill_truth_boxes(box_label *boxes, int count, int max_boxes, float *truth, int flip, float dx, float dy,
+                             float sx, float sy)
+{
     randomize_boxes(boxes, count);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > max_boxes) count = max_boxes;
@@ -428,13 +565,63 @@ void fill_truth_detection(char *path, int max_boxes, float *truth, int classes,
         truth[(i-sub)*5+3] = h;
         truth[(i-sub)*5+4] = id;
     }
+}
+
+void fill_truth_detection(char *path, int max_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
+    char labelpath[4096];
+    detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *boxes = read_boxes(labelpath, &count);
+    fill_truth_boxes(boxes, count, max_boxes, truth, flip, dx, dy, sx, sy);
     free(boxes);
 }
 
+// the same truth from the boxes of image i in the compiled index
+void fill_truth_detection_index(const truth_index *t, int i, int max_boxes, float *truth, int flip, float dx,
+                                float dy, float sx, float sy)
+{
+    int count = t->first[i + 1] - t->first[i];
+    box_label stack_boxes[64];      // the heap only for images with more boxes
+    box_label *boxes = count <= 64 ? stack_boxes : calloc(count, sizeof(box_label));
+    for(int j = 0; j < count; ++j){
+        truth_box b = t->boxes[t->first[i] + j];
+        boxes[j].id = b.id;
+        boxes[j].x = b.x;
+        boxes[j].y = b.y;
+        boxes[j].w = b.w;
+        boxes[j].h = b.h;
+        boxes[j].left   = b.x - b.w/2;
+        boxes[j].right  = b.x + b.w/2;
+        boxes[j].top    = b.y - b.h/2;
+        boxes[j].bottom = b.y + b.h/2;
+    }
+    fill_truth_boxes(boxes, count, max_boxes, truth, flip, dx, dy, sx, sy);
+    if(boxes != stack_boxes) free(boxes);
+}
+
+// the images and the truth of a detection batch are each one block, rows in the layout of net->input and net->truth
+static void reserve_matrix(matrix *m, int rows, int cols)
+{
+    if(!m->vals || (size_t)m->rows * m->cols < (size_t)rows * cols){
+        if(m->vals) free(m->vals[0]);
+        free(m->vals);
+        m->vals = calloc(rows, sizeof(float *));
+        m->vals[0] = calloc((size_t)rows * cols, sizeof(float));
+    } else if(m->rows < rows){
+        m->vals = realloc(m->vals, rows * sizeof(float *));
+    }
+    m->rows = rows;
+    m->cols = cols;
+    for(int i = 1; i < rows; ++i) m->vals[i] = m->vals[0] + (size_t)i * cols;
+}
+
 void free_batch_detect(batch_detect d)
 {
-    free_matrix(d.X);
-    free_matrix(d.y);
+    if(d.X.vals) free(d.X.vals[0]);
+    free(d.X.vals);
+    if(d.y.vals) free(d.y.vals[0]);
+    free(d.y.vals);
 }
 
 image load_data_detection_valid(char *path, int w, int h, int *image_w, int *image_h)
@@ -447,24 +634,33 @@ image load_data_detection_valid(char *path, int w, int h, int *image_w, int *ima
     return boxed_image;
 }
 
-batch_detect load_data_detection(int n, char **paths, int train_set_size, int w, int h, int max_boxes, int classes,
-                         float jitter, float hue, float saturation, float exposure, int test)
+/* n images of the sampler from position on, decoded in the order their reads complete; next: as for random_batch;
+ * d keeps its buffers from the last batch */
+void load_data_detection(int n, path_table *paths, truth_index *truth, sampler *samples, uint64_t position,
+                         uint64_t next, batch_detect *d, int w, int h, int max_boxes, int classes, float jitter,
+                         float hue, float saturation, float exposure, int test)
 {
-    char **random_paths = get_random_paths(paths, n, train_set_size);
-    batch_detect d = {0};
-    d.X.rows = n;
-    d.X.vals = calloc(d.X.rows, sizeof(float*));
-    d.X.cols = h*w*3;
-    d.y = make_matrix(n, 5*max_boxes);
-#pragma omp parallel for
-    for(int i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
-        image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
+    file_batch *f = take_file_batch(paths, samples, position, next, n, NULL);
+    int *index = f->index;
+    reserve_matrix(&d->X, n, h*w*3);
+    reserve_matrix(&d->y, n, 5*max_boxes);
+    memset(d->y.vals[0], 0, (size_t)n * d->y.cols * sizeof(float));
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int k = 0; k < n; ++k){
+        int j = f->reading ? next_file_read(&f->reads) : k;
+        int i = f->order[j];
+        rand_stream(f->first + (uint64_t)i * samples->replicas);
+        int iw, ih, ic;
+        unsigned char *pixels;
+        if(f->reading){
+            pixels = load_image_memory_pixels(f->buffers[j].data, f->buffers[j].size, &iw, &ih, &ic, 3);
+        } else {
+            pixels = load_image_pixels(f->paths[j], &iw, &ih, &ic, 3);
+        }
 
-        float dw = jitter * orig.w;
-        float dh = jitter * orig.h;
-        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
+        float dw = jitter * iw;
+        float dh = jitter * ih;
+        float new_ar = (iw + rand_uniform(-dw, dw)) / (ih + rand_uniform(-dh, dh));
         float scale = rand_uniform(.35, 1);;
         float nw, nh;
         if(new_ar < 1){
@@ -476,18 +672,24 @@ batch_detect load_data_detection(int n, char **paths, int train_set_size, int w,
         }
         float dx = rand_uniform(0, w - nw);
         float dy = rand_uniform(0, h - nh);
-        place_image(orig, nw, nh, dx, dy, sized);
-        random_distort_image(sized, hue, saturation, exposure);
-
-        int flip = 0;
+        augment_args a = make_augment_args(w, h);
+        a.place = 1;
+        a.nw = nw;
+        a.nh = nh;
+        a.dx = dx;
+        a.dy = dy;
+        a.fill = .5;
+        random_augment_color(&a, hue, saturation, exposure);
         if(test == 0) {      // 0: train, 1: valid
-            flip = rand()%2;
-            if(flip) flip_image(sized);
+            a.flip = rand_int(0, 1);
+        }
+        augment_image_into(pixels, iw, ih, 3, 0, a, d->X.vals[i]);
+        free(pixels);
+        if(truth){
+            fill_truth_detection_index(truth, index[i], max_boxes, d->y.vals[i], a.flip, -dx/w, -dy/h, nw/w, nh/h);
+        } else {
+            fill_truth_detection(f->paths[j], max_boxes, d->y.vals[i], classes, a.flip, -dx/w, -dy/h, nw/w, nh/h);
         }
-        d.X.vals[i] = sized.data;
-        fill_truth_detection(random_paths[i], max_boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
-        free_image(orig);
     }
-    free(random_paths);
-    return d;
+    end_file_batch(f);
 }
@@ -2,6 +2,11 @@
 #define DATA_H
 
 #include "image.h"
+#include "image_cache.h"
+#include "path_table.h"
+#include "truth_index.h"
+#include "file_reader.h"
+#include "sampler.h"
 
 typedef struct{
     int n;  // number of image
@@ -27,22 +32,60 @@ typedef struct{
     matrix y;
 } batch_detect;
 
-batch random_batch(char **paths, int batch_size, char **labels, int classes, int train_set_size, int w, int h, int c,
-                   float hue, float saturation, float exposure, int flip, float mean_value, float scale, int test);
+/* the images of a batch of files: the samples, the ones the cache holds and the reads of the others, started before
+ * the batch decodes, while the batch before it of the thread decodes when it was started ahead */
+typedef struct{
+    int size;
+    int n, hits;                    // images, images the cache holds
+    int started;                    // reads in flight or cached images held, until finish_file_batch
+    sampler *samples;
+    uint64_t position, first;       // the sampler position it was started at, the sample number of index[0]
+    int *index;                     // [n]
+    int *order;                     // [n] the batch slots of the cached images, then of the read ones as in paths
+    char **paths;                   // [n - hits]
+    image_cache *cache;
+    image_cache_entry **cached;     // [n]
+    file_buffer *buffers;           // [n - hits]
+    int reading;                    // the images are read ahead into buffers, 0: read in the decode
+    file_reads reads;
+} file_batch;
+
+/* per thread scratch of the batch functions, grown to the largest batch and kept across batches, the read buffers
+ * included, so that loading a batch into a reused one does not allocate; freed when the thread exits */
+typedef struct{
+    int size;
+    int *index;
+    file_batch files[2];        // the batch the thread loads and the next one it started ahead
+    int current;
+    unsigned char *bytes;       // raw pixels, see load_scratch_bytes
+    size_t bytes_size;
+} load_scratch;
+
+void random_batch(path_table *paths, batch *b, sampler *samples, uint64_t position, uint64_t next, int batch_size,
+                  char **labels, int classes, int w, int h, int c, float hue, float saturation, float exposure,
+                  int flip, float mean_value, float scale, int test, image_cache *cache);
+void reserve_batch(batch *b, int n, int w, int h, int c);
+load_scratch *get_load_scratch(int n);
+unsigned char *load_scratch_bytes(load_scratch *s, size_t size);
 void free_batch(batch *b);
+void fill_truth(char *path, char **labels, int classes, int *truth_label_index);
+void fill_path_truth(path_table *paths, int i, char **labels, int classes, int *truth_label_index);
 char **get_labels(char *filename);
 char **get_labels_and_num(char *filename, int *num);
 struct list *get_paths(char *filename);
 batch *load_csv_image_to_memory(char *filename, int batch_size, char **labels, int classes, int train_set_size,
                                 int *batch_num_return, int w, int h, int c, float hue, float saturation, float exposure, int test);
-batch *load_image_to_memory(char **paths, int batch_size, char **labels, int classes, int train_set_size,
+batch *load_image_to_memory(path_table *paths, int batch_size, char **labels, int classes, int train_set_size,
                             int *batch_num_return, int w, int h, int c, float hue, float saturation, float exposure,
                             int flip, float mean_value, float scale, int test);
 
 void free_matrix(matrix m);
 matrix make_matrix(int rows, int cols);
-batch_detect load_data_detection(int n, char **paths, int train_set_size, int w, int h, int boxes, int classes,
-                                 float jitter, float hue, float saturation, float exposure, int test);
+void load_data_detection(int n, path_table *paths, truth_index *truth, sampler *samples, uint64_t position,
+                         uint64_t next, batch_detect *d, int w, int h, int boxes, int classes, float jitter, float hue,
+                         float saturation, float exposure, int test);
+void detection_label_path(char *path, char *labelpath);
+box_label *read_boxes(char *filename, int *n);
 image load_data_detection_valid(char *path, int w, int h, int *image_w, int *image_h);
 void free_batch_detect(batch_detect d);
 #endif
@@ -0,0 +1,121 @@
+#include "data_loader.h"
+#include "utils.h"
+
+static void *data_loader_thread(void *args)
+{
+    data_loader *l = (data_loader *)args;
+    void *item = calloc(1, l->item_size);
+    uint64_t next = (uint64_t)-1;   // the ticket taken ahead by the last load
+    while(1){
+        pthread_mutex_lock(&l->mutex);
+        uint64_t ticket = next;
+        if(ticket == (uint64_t)-1){
+            while(!l->stop && l->issued - l->taken >= (uint64_t)l->slots) pthread_cond_wait(&l->not_full, &l->mutex);
+            ticket = l->issued++;
+        }
+        // the slot of the ticket is free once the tickets slots before it were taken
+        while(!l->stop && ticket - l->taken >= (uint64_t)l->slots) pthread_cond_wait(&l->not_full, &l->mutex);
+        if(l->stop){
+            pthread_mutex_unlock(&l->mutex);
+            break;
+        }
+        // a thread may be a ticket ahead of the slots, its reads run while the batches in the slots wait
+        next = l->issued - l->taken < (uint64_t)(l->slots + l->threads) ? l->issued++ : (uint64_t)-1;
+        if(l->spares > 0){
+            l->spares -= 1;
+            memcpy(item, l->spare + l->spares * l->item_size, l->item_size);
+        }
+        pthread_mutex_unlock(&l->mutex);
+
+        l->load(l->args, item, ticket, next);
+
+        pthread_mutex_lock(&l->mutex);
+        int slot = ticket % l->slots;
+        memcpy(l->items + slot * l->item_size, item, l->item_size);
+        memset(item, 0, l->item_size);      // the slot owns the buffers now
+        l->ready[slot] = 1;
+        pthread_cond_signal(&l->not_empty);
+        pthread_mutex_unlock(&l->mutex);
+    }
+    free_ptr(item);
+    return 0;
+}
+
+data_loader *make_data_loader(int slots, int threads, size_t item_size, load_item_func load, free_item_func free_item,
+                              void *args)
+{
+    if(slots < 1) slots = 1;
+    if(threads < 1) threads = 1;
+    data_loader *l = calloc(1, sizeof(data_loader));
+    l->slots = slots;
+    l->threads = threads;
+    l->item_size = item_size;
+    l->load = load;
+    l->free_item = free_item;
+    l->args = args;
+    l->items = calloc(slots, item_size);
+    l->ready = calloc(slots, sizeof(char));
+    l->spare = calloc(slots + threads, item_size);
+    pthread_mutex_init(&l->mutex, NULL);
+    pthread_cond_init(&l->not_full, NULL);
+    pthread_cond_init(&l->not_empty, NULL);
+    l->thread_ids = calloc(threads, sizeof(pthread_t));
+    for(int i = 0; i < threads; ++i){
+        if(pthread_create(l->thread_ids + i, NULL, data_loader_thread, l)) error("data loader: thread creation failed");
+    }
+    fprintf(stderr, "data loader: %d slots, %d threads\n", slots, threads);
+    return l;
+}
+
+// stop the threads after their current load and free the batches that were not taken
+void free_data_loader(data_loader *l)
+{
+    pthread_mutex_lock(&l->mutex);
+    l->stop = 1;
+    pthread_cond_broadcast(&l->not_full);
+    pthread_mutex_unlock(&l->mutex);
+    for(int i = 0; i < l->threads; ++i) pthread_join(l->thread_ids[i], NULL);
+    for(int i = 0; i < l->slots; ++i){
+        if(l->ready[i] && l->free_item) l->free_item(l->items + i * l->item_size);
+    }
+    for(int i = 0; i < l->spares; ++i){
+        if(l->free_item) l->free_item(l->spare + i * l->item_size);
+    }
+    pthread_mutex_destroy(&l->mutex);
+    pthread_cond_destroy(&l->not_full);
+    pthread_cond_destroy(&l->not_empty);
+    free_ptr(l->thread_ids);
+    free_ptr(l->items);
+    free_ptr(l->ready);
+    free_ptr(l->spare);
+    free_ptr(l);
+}
+
+// take the next batch in ticket order, the caller owns it
+void data_loader_get(data_loader *l, void *item)
+{
+    double start = what_time_is_it_now();
+    pthread_mutex_lock(&l->mutex);
+    int slot = l->taken % l->slots;
+    while(!l->ready[slot]) pthread_cond_wait(&l->not_empty, &l->mutex);
+    memcpy(item, l->items + slot * l->item_size, l->item_size);
+    l->ready[slot] = 0;
+    l->taken += 1;
+    pthread_cond_broadcast(&l->not_full);
+    pthread_mutex_unlock(&l->mutex);
+    l->stall = what_time_is_it_now() - start;
+    l->stall_total += l->stall;
+}
+
+// give back a batch taken with data_loader_get, a thread loads a later batch into its buffers
+void data_loader_put(data_loader *l, void *item)
+{
+    pthread_mutex_lock(&l->mutex);
+    if(l->spares < l->slots + l->threads){
+        memcpy(l->spare + l->spares * l->item_size, item, l->item_size);
+        l->spares += 1;
+        item = NULL;
+    }
+    pthread_mutex_unlock(&l->mutex);
+    if(item && l->free_item) l->free_item(item);
+}
@@ -0,0 +1,46 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* A bounded ring of prepared training batches filled by a pool of loader threads. A thread takes the next ticket,
+ * loads batch number ticket into its own item and copies it into the slot of the ticket; when all the slots are
+ * full or being loaded the threads sleep until the trainer takes one (back-pressure). A thread also takes its next
+ * ticket before it loads, up to one per thread past the slots, and passes it to the load function so that the
+ * reads of that batch run while this one decodes and while it waits for a slot (-1: none). data_loader_get returns
+ * the batches in ticket order, whichever thread finishes first, blocks until the next one is ready and records the
+ * time it waited. The load function derives everything random from the ticket, so a run is the same for any number
+ * of threads. A batch the trainer is done with goes back with data_loader_put, and a thread loads its next batch
+ * into it, so once every batch in flight has been allocated the load function is expected to reuse their buffers */
+typedef void (*load_item_func)(void *args, void *item, uint64_t ticket, uint64_t next);
+typedef void (*free_item_func)(void *item);
+
+typedef struct{
+    int slots, threads;
+    size_t item_size;
+    load_item_func load;
+    free_item_func free_item;
+    void *args;
+    char *items;            // [slots][item_size], the batch of ticket t in slot t % slots
+    char *ready;            // [slots]
+    uint64_t issued, taken; // tickets handed to the threads, batches taken by the trainer
+    char *spare;            // [slots + threads][item_size], batches returned by the trainer for reuse
+    int spares;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_full, not_empty;
+    pthread_t *thread_ids;
+    double stall, stall_total;  // seconds the last get and all the gets waited for a batch
+} data_loader;
+
+data_loader *make_data_loader(int slots, int threads, size_t item_size, load_item_func load, free_item_func free_item,
+                              void *args);
+void free_data_loader(data_loader *l);
+void data_loader_get(data_loader *l, void *item);
+void data_loader_put(data_loader *l, void *item);
+
+#endif
@@ -28,14 +28,19 @@ dropout_layer *make_dropout_layer(int w, int h, int c, int batch, int inputs, fl
     return l;
 } 
 
-void forward_dropout_layer(const dropout_layer *l, float *input, int test)
+// seen, index: the samples the network has seen and the index of the layer, the random streams of the rows
+void forward_dropout_layer(const dropout_layer *l, float *input, uint64_t seen, int index, int test)
 {
     if (0 != test) return;  // 0: train, 1: valid
-    for(int i = 0; i < l->batch * l->inputs; ++i){
-        float r = rand_uniform(0, 1);
-        l->rand[i] = r;
-        if(r < l->probability) input[i] = 0;
-        else input[i] *= l->scale;
+    #pragma omp parallel for
+    for(int b = 0; b < l->batch; ++b){
+        rand_stream(rand_layer_stream(seen, index, b));
+        for(int i = b * l->inputs; i < (b + 1) * l->inputs; ++i){
+            float r = rand_uniform(0, 1);
+            l->rand[i] = r;
+            if(r < l->probability) input[i] = 0;
+            else input[i] *= l->scale;
+        }
     }
 }
 
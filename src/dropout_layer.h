@@ -17,7 +17,7 @@ typedef struct {
 
 dropout_layer *make_dropout_layer(int w, int h, int c, int batch, int inputs, float probability);
 void resize_dropout_layer(dropout_layer *l, int inputs);
-void forward_dropout_layer(const dropout_layer *l, float *input, int test);
+void forward_dropout_layer(const dropout_layer *l, float *input, uint64_t seen, int index, int test);
 void backward_dropout_layer(const dropout_layer *l, float *delta);
 image get_dropout_image(const dropout_layer *layer);
 
@@ -0,0 +1,190 @@
+#include "embedding_layer.h"
+
+image get_embedding_image(const embedding_layer *layer)
+{
+    int h = 1;
+    int w = 1;
+    int c = layer->outputs;
+    return float_to_image(h,w,c,NULL);
+}
+
+embedding_layer *make_embedding_layer(int batch, int inputs, int outputs, int steps, float lr_mult, float lr_decay_mult,
+                                      int weight_filler, float sigma)
+{
+    fprintf(stderr, "Embedding Layer:    %d inputs, %d outputs\n", inputs, outputs);
+    embedding_layer *l = calloc(1, sizeof(embedding_layer));
+    l->batch = batch;
+    l->steps = steps;
+    l->inputs = inputs;
+    l->outputs = outputs;
+    l->lr_mult = lr_mult;
+    l->lr_decay_mult = lr_decay_mult;
+
+    l->output = calloc(batch*steps*outputs, sizeof(float));
+    l->delta = calloc(batch*steps*outputs, sizeof(float));
+    l->weights = calloc(inputs*outputs, sizeof(float));
+    l->weight_updates = calloc(inputs*outputs, sizeof(float));
+    // same filler as a connected layer on the one-hot input
+    if(weight_filler == 1){   // xavier
+        float scale = sqrtf(2.0F / inputs);
+        for(int i = 0; i < inputs*outputs; ++i) l->weights[i] = scale*rand_uniform(-1, 1);
+    } else if(weight_filler == 2){   // gaussian
+        for(int i = 0; i < inputs*outputs; ++i) l->weights[i] = rand_normal_me(0, sigma);
+    } else {
+        fprintf(stderr, "weight_filler not support\n");
+        exit(-1);
+    }
+
+    l->update = make_sparse_update(inputs, outputs, batch*steps);
+    l->catch_up_rows = calloc(batch*steps, sizeof(int));
+    l->skips = calloc(batch*steps, sizeof(int));
+
+#ifdef GPU
+    l->output_gpu = cuda_make_array(l->output, batch*steps*outputs);
+    l->delta_gpu = cuda_make_array(l->delta, batch*steps*outputs);
+    l->weights_gpu = cuda_make_array(l->weights, inputs*outputs);
+    l->weight_updates_gpu = cuda_make_array(l->weight_updates, inputs*outputs);
+    l->index_gpu = cuda_make_int_array(0, batch*steps);
+    l->rows_gpu = cuda_make_int_array(0, batch*steps);
+    l->skips_gpu = cuda_make_int_array(0, batch*steps);
+#endif
+    return l;
+}
+
+void free_embedding_layer(void *input)
+{
+    embedding_layer *layer = (embedding_layer *)input;
+    if(layer->output) free_ptr(layer->output);
+    if(layer->delta) free_ptr(layer->delta);
+    if(layer->weights) free_ptr(layer->weights);
+    if(layer->weight_updates) free_ptr(layer->weight_updates);
+    if(layer->update) free_sparse_update(layer->update);
+    if(layer->catch_up_rows) free_ptr(layer->catch_up_rows);
+    if(layer->skips) free_ptr(layer->skips);
+#ifdef GPU
+    if(layer->output_gpu) cuda_free(layer->output_gpu);
+    if(layer->delta_gpu) cuda_free(layer->delta_gpu);
+    if(layer->weights_gpu) cuda_free(layer->weights_gpu);
+    if(layer->weight_updates_gpu) cuda_free(layer->weight_updates_gpu);
+    if(layer->index_gpu) cuda_free(layer->index_gpu);
+    if(layer->rows_gpu) cuda_free(layer->rows_gpu);
+    if(layer->skips_gpu) cuda_free(layer->skips_gpu);
+#endif
+    free_ptr(layer);
+}
+
+static void check_embedding_index(const embedding_layer *l, const int *index)
+{
+    for(int i = 0; i < l->batch*l->steps; ++i){
+        if(index[i] < 0 || index[i] >= l->inputs){
+            fprintf(stderr, "embedding layer: token id %d out of range [0, %d)\n", index[i], l->inputs);
+            exit(-1);
+        }
+    }
+}
+
+static float embedding_decay_coef(const embedding_layer *l, float decay)
+{
+    return -decay * l->lr_decay_mult * (l->batch * l->steps);
+}
+
+static float embedding_rate_coef(const embedding_layer *l, float learning_rate)
+{
+    return learning_rate * l->lr_mult / (l->batch * l->steps);
+}
+
+void forward_embedding_layer(embedding_layer *l, const int *index)
+{
+    check_embedding_index(l, index);
+    for(int i = 0; i < l->batch*l->steps; ++i){
+        sparse_update_catch_up(l->update, l->weights, l->weight_updates, index[i]);
+        memcpy(l->output + i*l->outputs, l->weights + index[i]*l->outputs, l->outputs*sizeof(float));
+    }
+}
+
+void backward_embedding_layer(embedding_layer *l, const int *index)
+{
+    for(int i = 0; i < l->batch*l->steps; ++i){
+        sparse_update_touch(l->update, index[i]);
+        axpy_cpu(l->outputs, 1, l->delta + i*l->outputs, 1, l->weight_updates + index[i]*l->outputs, 1);
+    }
+}
+
+void update_embedding_layer(embedding_layer *l, float learning_rate, float momentum, float decay)
+{
+    sparse_update_apply(l->update, l->weights, l->weight_updates, embedding_decay_coef(l, decay),
+                        embedding_rate_coef(l, learning_rate), momentum);
+}
+
+// bring every row up to date, the weights are then the same as with dense updates
+void flush_embedding_layer(embedding_layer *l)
+{
+    sparse_update_flush(l->update, l->weights, l->weight_updates);
+}
+
+#ifdef GPU
+void push_embedding_layer(const embedding_layer *l)
+{
+    cuda_push_array(l->weights_gpu, l->weights, l->inputs*l->outputs);
+    cuda_push_array(l->weight_updates_gpu, l->weight_updates, l->inputs*l->outputs);
+}
+
+void pull_embedding_layer(const embedding_layer *l)
+{
+    cuda_pull_array(l->weights_gpu, l->weights, l->inputs*l->outputs);
+    cuda_pull_array(l->weight_updates_gpu, l->weight_updates, l->inputs*l->outputs);
+}
+
+// the row bookkeeping of sparse_update stays on the host, the rows are caught up and updated by kernels
+void forward_embedding_layer_gpu(embedding_layer *l, const int *index)
+{
+    check_embedding_index(l, index);
+    sparse_update *s = l->update;
+    int rows_num = 0;
+    for(int i = 0; i < l->batch*l->steps; ++i){
+        int r = index[i];
+        if(s->row_count[r] < s->count){
+            l->catch_up_rows[rows_num] = r;
+            l->skips[rows_num] = s->count - s->row_count[r];
+            s->row_count[r] = s->count;
+            ++rows_num;
+        }
+    }
+    if(rows_num > 0){
+        cuda_push_array_int(l->rows_gpu, l->catch_up_rows, rows_num);
+        cuda_push_array_int(l->skips_gpu, l->skips, rows_num);
+        embedding_update_gpu(rows_num, l->outputs, l->rows_gpu, l->skips_gpu, l->weights_gpu, l->weight_updates_gpu,
+                             s->a, s->b, s->momentum, 0);
+    }
+    cuda_push_array_int(l->index_gpu, (int *)index, l->batch*l->steps);
+    embedding_forward_gpu(l->batch*l->steps, l->outputs, l->index_gpu, l->weights_gpu, l->output_gpu);
+}
+
+void backward_embedding_layer_gpu(embedding_layer *l, const int *index)
+{
+    for(int i = 0; i < l->batch*l->steps; ++i) sparse_update_touch(l->update, index[i]);
+    embedding_backward_gpu(l->batch*l->steps, l->outputs, l->index_gpu, l->delta_gpu, l->weight_updates_gpu);
+}
+
+void update_embedding_layer_gpu(embedding_layer *l, float learning_rate, float momentum, float decay)
+{
+    // the touched rows were all read, and so caught up, by forward_embedding_layer_gpu
+    sparse_update *s = l->update;
+    float a = embedding_decay_coef(l, decay);
+    float b = embedding_rate_coef(l, learning_rate);
+    if(s->rows_num > 0){
+        for(int i = 0; i < s->rows_num; ++i){
+            s->row_count[s->rows[i]] = s->count + 1;
+            s->touched[s->rows[i]] = 0;
+        }
+        cuda_push_array_int(l->rows_gpu, s->rows, s->rows_num);
+        embedding_update_gpu(s->rows_num, l->outputs, l->rows_gpu, 0, l->weights_gpu, l->weight_updates_gpu,
+                             a, b, momentum, 1);
+    }
+    s->rows_num = 0;
+    s->count += 1;
+    s->a = a;
+    s->b = b;
+    s->momentum = momentum;
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef EMBEDDING_LAYER_H
+#define EMBEDDING_LAYER_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "cuda.h"
+#include "blas.h"
+#include "image.h"
+#include "sparse_update.h"
+
+/* A connected layer over one-hot inputs, stored transposed so that a token id selects one row of weights.
+ * inputs is the vocabulary size, the layer reads one token id per step and batch row instead of inputs floats.
+ * Only the rows of the tokens seen since the last update are updated, see sparse_update.h */
+typedef struct{
+    int inputs, outputs, batch, steps;
+    float lr_mult, lr_decay_mult;
+    float *output, *delta, *weights, *weight_updates;  // weights: [inputs][outputs]
+    sparse_update *update;
+    int *catch_up_rows, *skips;  // rows and their skipped iterations to catch up, used by the gpu path
+
+    float *output_gpu, *delta_gpu, *weights_gpu, *weight_updates_gpu;
+    int *index_gpu, *rows_gpu, *skips_gpu;
+} embedding_layer;
+
+image get_embedding_image(const embedding_layer *layer);
+embedding_layer *make_embedding_layer(int batch, int inputs, int outputs, int steps, float lr_mult, float lr_decay_mult,
+                                      int weight_filler, float sigma);
+void free_embedding_layer(void *input);
+void forward_embedding_layer(embedding_layer *l, const int *index);
+void backward_embedding_layer(embedding_layer *l, const int *index);
+void update_embedding_layer(embedding_layer *l, float learning_rate, float momentum, float decay);
+void flush_embedding_layer(embedding_layer *l);
+
+#ifdef GPU
+void forward_embedding_layer_gpu(embedding_layer *l, const int *index);
+void backward_embedding_layer_gpu(embedding_layer *l, const int *index);
+void update_embedding_layer_gpu(embedding_layer *l, float learning_rate, float momentum, float decay);
+void push_embedding_layer(const embedding_layer *l);
+void pull_embedding_layer(const embedding_layer *l);
+
+void embedding_forward_gpu(int n, int outputs, const int *index, const float *weights, float *output);
+void embedding_backward_gpu(int n, int outputs, const int *index, const float *delta, float *weight_updates);
+void embedding_update_gpu(int rows_num, int outputs, const int *rows, const int *skips, float *weights,
+                          float *weight_updates, float a, float b, float momentum, int with_gradient);
+#endif
+#endif
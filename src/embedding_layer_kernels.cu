@@ -0,0 +1,91 @@
+#include "cuda_runtime.h"
+#include "curand.h"
+#include "cublas_v2.h"
+
+extern "C" {
+#include "embedding_layer.h"
+#include "cuda.h"
+}
+
+__global__ void embedding_forward_kernel(int size, int outputs, const int *index, const float *weights, float *output)
+{
+    int id = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(id >= size) return;
+    int i = id / outputs;
+    int j = id % outputs;
+    output[id] = weights[index[i]*outputs + j];
+}
+
+__global__ void embedding_backward_kernel(int size, int outputs, const int *index, const float *delta,
+                                          float *weight_updates)
+{
+    int id = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(id >= size) return;
+    int i = id / outputs;
+    int j = id % outputs;
+    atomicAdd(weight_updates + index[i]*outputs + j, delta[id]);
+}
+
+/* skips: catch up the skipped iterations as sparse_update_catch_up in sparse_update.c,
+ * with_gradient: then apply the update with the accumulated gradient */
+__global__ void embedding_update_kernel(int size, int outputs, const int *rows, const int *skips, float *weights,
+                                        float *weight_updates, float a, float b, float momentum, int with_gradient)
+{
+    int id = (blockIdx.x + blockIdx.y*gridDim.x) * blockDim.x + threadIdx.x;
+    if(id >= size) return;
+    int i = id / outputs;
+    int j = id % outputs;
+    int index = rows[i]*outputs + j;
+    float w = weights[index];
+    float u = weight_updates[index];
+
+    int skip = skips ? skips[i] : 0;
+    if(skip > 0){
+        double p[4] = {1, 0, 0, 1};
+        double m[4] = {1 + (double)a*b, b, (double)momentum*a, momentum};
+        while(skip){
+            if(skip & 1){
+                double t0 = p[0]*m[0] + p[1]*m[2], t1 = p[0]*m[1] + p[1]*m[3];
+                double t2 = p[2]*m[0] + p[3]*m[2], t3 = p[2]*m[1] + p[3]*m[3];
+                p[0] = t0; p[1] = t1; p[2] = t2; p[3] = t3;
+            }
+            double t0 = m[0]*m[0] + m[1]*m[2], t1 = m[0]*m[1] + m[1]*m[3];
+            double t2 = m[2]*m[0] + m[3]*m[2], t3 = m[2]*m[1] + m[3]*m[3];
+            m[0] = t0; m[1] = t1; m[2] = t2; m[3] = t3;
+            skip >>= 1;
+        }
+        float w0 = w;
+        w = p[0]*w0 + p[1]*u;
+        u = p[2]*w0 + p[3]*u;
+    }
+    if(with_gradient){
+        u += a * w;
+        w += b * u;
+        u *= momentum;
+    }
+    weights[index] = w;
+    weight_updates[index] = u;
+}
+
+void embedding_forward_gpu(int n, int outputs, const int *index, const float *weights, float *output)
+{
+    int size = n*outputs;
+    embedding_forward_kernel<<<cuda_gridsize(size), BLOCK>>>(size, outputs, index, weights, output);
+    check_error(cudaPeekAtLastError());
+}
+
+void embedding_backward_gpu(int n, int outputs, const int *index, const float *delta, float *weight_updates)
+{
+    int size = n*outputs;
+    embedding_backward_kernel<<<cuda_gridsize(size), BLOCK>>>(size, outputs, index, delta, weight_updates);
+    check_error(cudaPeekAtLastError());
+}
+
+void embedding_update_gpu(int rows_num, int outputs, const int *rows, const int *skips, float *weights,
+                          float *weight_updates, float a, float b, float momentum, int with_gradient)
+{
+    int size = rows_num*outputs;
+    embedding_update_kernel<<<cuda_gridsize(size), BLOCK>>>(size, outputs, rows, skips, weights, weight_updates,
+                                                            a, b, momentum, with_gradient);
+    check_error(cudaPeekAtLastError());
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef IO_URING
+#include <errno.h>
+#include <liburing.h>
+#endif
+
+#include "file_reader.h"
+#include "utils.h"
+
+static int read_depth = 0;
+static int reader_threads = 0;
+static file_reads *reader_head = NULL, *reader_tail = NULL;     // jobs with files not handed out yet
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reader_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t reader_done = PTHREAD_COND_INITIALIZER;
+
+void set_file_read_depth(int depth)
+{
+    read_depth = depth > 0 ? depth : 0;
+}
+
+int file_read_depth()
+{
+    return read_depth;
+}
+
+// open the file and size its buffer, the caller reads it and closes the descriptor
+static int open_file_buffer(char *path, file_buffer *buffer)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) file_error(path);
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(path);
+    buffer->size = st.st_size;
+    if(!buffer->data || buffer->size > buffer->capacity){
+        free(buffer->data);
+        buffer->capacity = buffer->size ? buffer->size : 1;
+        buffer->data = malloc(buffer->capacity);
+    }
+    return fd;
+}
+
+static void read_file_buffer(char *path, file_buffer *buffer)
+{
+    int fd = open_file_buffer(path, buffer);
+    size_t got = 0;
+    while(got < buffer->size){
+        ssize_t r = pread(fd, buffer->data + got, buffer->size - got, got);
+        if(r <= 0) file_error(path);
+        got += r;
+    }
+    close(fd);
+}
+
+// with reader_mutex held
+static void file_read_done(file_reads *r, int i)
+{
+    r->completed[r->done++] = i;
+    pthread_cond_broadcast(&reader_done);
+}
+
+static void *file_reader_thread(void *args)
+{
+    pthread_mutex_lock(&reader_mutex);
+    while(1){
+        while(!reader_head) pthread_cond_wait(&reader_work, &reader_mutex);
+        file_reads *job = reader_head;
+        int i = job->next++;
+        if(job->next == job->n){
+            reader_head = job->link;
+            if(!reader_head) reader_tail = NULL;
+        }
+        pthread_mutex_unlock(&reader_mutex);
+
+        read_file_buffer(job->paths[i], job->buffers + i);
+
+        pthread_mutex_lock(&reader_mutex);
+        file_read_done(job, i);
+    }
+    return 0;
+}
+
+// the loader threads share one pool, their jobs are served in arrival order
+static void start_file_reads_pool(file_reads *r)
+{
+    pthread_mutex_lock(&reader_mutex);
+    for(; reader_threads < read_depth; ++reader_threads){
+        pthread_t id;
+        if(pthread_create(&id, NULL, file_reader_thread, NULL)) error("file reader: thread creation failed");
+        pthread_detach(id);
+    }
+    if(reader_tail) reader_tail->link = r;
+    else reader_head = r;
+    reader_tail = r;
+    pthread_cond_broadcast(&reader_work);
+    pthread_mutex_unlock(&reader_mutex);
+}
+
+#ifdef IO_URING
+/* two rings per loader thread, for the reads of its batch and of the one it starts ahead; set up on first use and
+ * torn down when the thread exits */
+typedef struct file_ring{
+    struct io_uring ring;
+    int entries;                // 0: not set up yet, -1: io_uring is not available
+    file_reads *reads;          // the reads using the ring, NULL: free
+} file_ring;
+
+static pthread_key_t file_ring_key;
+static pthread_once_t file_ring_once = PTHREAD_ONCE_INIT;
+
+static void wait_file_reads(file_reads *r);
+
+static void free_file_rings(void *p)
+{
+    file_ring *rings = (file_ring *)p;
+    for(int i = 0; i < 2; ++i){
+        if(rings[i].reads){     // started and not ended yet, end_file_reads finds them read
+            wait_file_reads(rings[i].reads);
+            rings[i].reads->ring = NULL;
+        }
+        if(rings[i].entries > 0) io_uring_queue_exit(&rings[i].ring);
+    }
+    free_ptr(rings);
+}
+
+static void make_file_ring_key()
+{
+    pthread_key_create(&file_ring_key, free_file_rings);
+}
+
+// a free ring of the calling thread, NULL when io_uring is not available or both rings are in use
+static file_ring *get_file_ring()
+{
+    pthread_once(&file_ring_once, make_file_ring_key);
+    file_ring *rings = pthread_getspecific(file_ring_key);
+    if(!rings){
+        rings = calloc(2, sizeof(file_ring));
+        pthread_setspecific(file_ring_key, rings);
+    }
+    for(int i = 0; i < 2; ++i){
+        file_ring *f = rings + i;
+        if(f->reads) continue;
+        if(f->entries == 0) f->entries = io_uring_queue_init(read_depth, &f->ring, 0) == 0 ? read_depth : -1;
+        return f->entries > 0 ? f : NULL;
+    }
+    return NULL;
+}
+
+static void submit_file_reads(struct io_uring *ring, int wait)
+{
+    int ret;
+    do{
+        ret = wait ? io_uring_submit_and_wait(ring, 1) : io_uring_submit(ring);
+    } while(ret == -EINTR);
+    if(ret < 0) error("file reader: io_uring submit failed");
+}
+
+// a free sqe, when the submission queue is full the queued reads are submitted first
+static struct io_uring_sqe *get_file_read_sqe(struct io_uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    while(!(sqe = io_uring_get_sqe(ring))) submit_file_reads(ring, 0);
+    return sqe;
+}
+
+// queue the reads of files not started yet that fit in the ring, the caller submits them
+static void queue_file_reads(file_reads *r)
+{
+    int depth = read_depth < r->ring->entries ? read_depth : r->ring->entries;
+    while(r->submitted < r->n && r->in_flight < depth){
+        int i = r->submitted++;
+        r->fds[i] = open_file_buffer(r->paths[i], r->buffers + i);
+        if(r->buffers[i].size == 0) file_error(r->paths[i]);
+        struct io_uring_sqe *sqe = get_file_read_sqe(&r->ring->ring);
+        io_uring_prep_read(sqe, r->fds[i], r->buffers[i].data, r->buffers[i].size, 0);
+        io_uring_sqe_set_data(sqe, (void *)(intptr_t)i);
+        r->in_flight += 1;
+    }
+}
+
+// wait for reads of the ring to complete and refill it; one thread at a time, without reader_mutex
+static void reap_file_reads(file_reads *r)
+{
+    struct io_uring *ring = &r->ring->ring;
+    submit_file_reads(ring, 1);
+    struct io_uring_cqe *cqe;
+    while(io_uring_peek_cqe(ring, &cqe) == 0){
+        int i = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+        if(res <= 0) file_error(r->paths[i]);
+        r->got[i] += res;
+        if(r->got[i] < r->buffers[i].size){     // short read, queue the rest
+            struct io_uring_sqe *sqe = get_file_read_sqe(ring);
+            io_uring_prep_read(sqe, r->fds[i], r->buffers[i].data + r->got[i], r->buffers[i].size - r->got[i],
+                               r->got[i]);
+            io_uring_sqe_set_data(sqe, (void *)(intptr_t)i);
+        } else {
+            close(r->fds[i]);
+            r->in_flight -= 1;
+            pthread_mutex_lock(&reader_mutex);
+            file_read_done(r, i);
+            pthread_mutex_unlock(&reader_mutex);
+        }
+    }
+    queue_file_reads(r);
+    submit_file_reads(ring, 0);
+}
+#endif
+
+// with reader_mutex held, until another read of r completed; with a ring one of the waiting threads reaps it
+static void wait_file_read(file_reads *r)
+{
+#ifdef IO_URING
+    if(r->ring && !r->reaping){
+        r->reaping = 1;
+        pthread_mutex_unlock(&reader_mutex);
+        reap_file_reads(r);
+        pthread_mutex_lock(&reader_mutex);
+        r->reaping = 0;
+        pthread_cond_broadcast(&reader_done);
+        return;
+    }
+#endif
+    pthread_cond_wait(&reader_done, &reader_mutex);
+}
+
+static void wait_file_reads(file_reads *r)
+{
+    pthread_mutex_lock(&reader_mutex);
+    while(r->done < r->n) wait_file_read(r);
+    pthread_mutex_unlock(&reader_mutex);
+}
+
+/* start reading the n files into buffers and return, r is zeroed or was ended; paths and buffers have to stay until
+ * end_file_reads, the buffers of the files next_file_read did not return yet are not to be touched */
+void start_file_reads(file_reads *r, char **paths, int n, file_buffer *buffers)
+{
+    if(n > r->size){
+        r->completed = realloc(r->completed, n * sizeof(int));
+        r->fds = realloc(r->fds, n * sizeof(int));
+        r->got = realloc(r->got, n * sizeof(size_t));
+        r->size = n;
+    }
+    r->paths = paths;
+    r->buffers = buffers;
+    r->n = n > 0 ? n : 0;
+    r->next = r->done = r->taken = 0;
+    r->link = NULL;
+    r->ring = NULL;
+    r->submitted = r->in_flight = r->reaping = 0;
+    if(r->n == 0) return;
+#ifdef IO_URING
+    r->ring = get_file_ring();
+    if(r->ring){
+        r->ring->reads = r;
+        for(int i = 0; i < n; ++i) r->got[i] = 0;
+        queue_file_reads(r);
+        submit_file_reads(&r->ring->ring, 0);
+        return;
+    }
+#endif
+    start_file_reads_pool(r);
+}
+
+// the index of a file that has been read and was not returned before, in completion order; -1 once all were
+int next_file_read(file_reads *r)
+{
+    pthread_mutex_lock(&reader_mutex);
+    while(r->taken == r->done && r->taken < r->n) wait_file_read(r);
+    int i = r->taken < r->n ? r->completed[r->taken++] : -1;
+    pthread_mutex_unlock(&reader_mutex);
+    return i;
+}
+
+// wait for the reads that did not complete yet, the buffers keep the files and r can be started again
+void end_file_reads(file_reads *r)
+{
+    wait_file_reads(r);
+#ifdef IO_URING
+    if(r->ring) r->ring->reads = NULL;
+#endif
+    r->ring = NULL;
+}
+
+// the arrays of r, after end_file_reads
+void free_file_reads(file_reads *r)
+{
+    free_ptr(r->completed);
+    free_ptr(r->fds);
+    free_ptr(r->got);
+    r->size = 0;
+}
+
+void free_file_buffers(file_buffer *buffers, int n)
+{
+    for(int i = 0; i < n; ++i){
+        free_ptr(buffers[i].data);
+        buffers[i].data = NULL;
+        buffers[i].capacity = 0;
+    }
+}
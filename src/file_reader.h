@@ -0,0 +1,41 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <stddef.h>
+
+/* Whole-file reads issued ahead of the decode: start_file_reads keeps up to read_depth reads in flight, with io_uring
+ * when built with IO_URING=1 and the kernel allows it, else on a shared pool of read_depth blocking reader threads,
+ * and returns at once. next_file_read hands out the files in the order their reads complete, so the decoders start
+ * on the first file read instead of the whole batch and the caller can start the reads of its next batch before it
+ * decodes this one. The decoders work from memory (load_image_memory_pixels), so the I/O depth does not depend on
+ * how many threads decode. A depth of 0 turns it off and the images are read inside the decode as before */
+typedef struct{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;        // bytes allocated at data, a buffer is reused for the next file when it fits
+} file_buffer;
+
+/* the reads of one batch; a caller keeps it with the batch and starts it again for the next one, the arrays are
+ * kept and grown to the largest batch */
+typedef struct file_reads{
+    char **paths;
+    file_buffer *buffers;
+    int n, next, done, taken;   // files handed to the readers, read, handed out by next_file_read
+    int size;                   // room of the arrays
+    int *completed;             // [size], the files in the order their reads completed
+    struct file_reads *link;
+    struct file_ring *ring;     // io_uring only, NULL: the reads go to the pool
+    int submitted, in_flight, reaping;
+    int *fds;                   // [size]
+    size_t *got;                // [size]
+} file_reads;
+
+void set_file_read_depth(int depth);
+int file_read_depth();
+void start_file_reads(file_reads *r, char **paths, int n, file_buffer *buffers);
+int next_file_read(file_reads *r);
+void end_file_reads(file_reads *r);
+void free_file_reads(file_reads *r);
+void free_file_buffers(file_buffer *buffers, int n);
+
+#endif
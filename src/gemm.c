@@ -1,11 +1,12 @@
 #include "gemm.h"
+#include "utils.h"
 
 void gemm_nn(int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
         float *C, int ldc)
 {
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(thread_group())
     for(int i = 0; i < M; ++i){
         for(int k = 0; k < K; ++k){
             register float A_PART = ALPHA*A[i*lda+k];
@@ -21,7 +22,7 @@ void gemm_nt(int M, int N, int K, float ALPHA,
         float *B, int ldb,
         float *C, int ldc)
 {
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(thread_group())
     for(int i = 0; i < M; ++i){
         for(int j = 0; j < N; ++j){
             register float sum = 0;
@@ -38,7 +39,7 @@ void gemm_tn(int M, int N, int K, float ALPHA,
         float *B, int ldb,
         float *C, int ldc)
 {
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(thread_group())
     for(int i = 0; i < M; ++i){
         for(int k = 0; k < K; ++k){
             register float A_PART = ALPHA*A[k*lda+i];
@@ -54,7 +55,7 @@ void gemm_tt(int M, int N, int K, float ALPHA,
         float *B, int ldb,
         float *C, int ldc)
 {
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(thread_group())
     for(int i = 0; i < M; ++i){
         for(int j = 0; j < N; ++j){
             register float sum = 0;
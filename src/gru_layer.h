@@ -14,20 +14,23 @@
 
 typedef struct{
     int inputs, outputs, batch, steps;
-    float *output, *delta, *state, *prev_state, *forgot_state, *forgot_delta, *prev_delta, *r_cpu, *z_cpu, *h_cpu;
+    float *output, *delta, *state, *prev_state, *forgot_state, *forgot_delta, *gate_cpu, *cand_cpu;
 
-    float *output_gpu, *delta_gpu, *state_gpu, *prev_state_gpu, *forgot_state_gpu, *forgot_delta_gpu, *prev_delta_gpu, *r_gpu, *z_gpu, *h_gpu;
-    connected_layer *wr, *wz, *wh, *ur, *uz, *uh;
+    float *output_gpu, *delta_gpu, *state_gpu, *prev_state_gpu, *forgot_state_gpu, *forgot_delta_gpu, *gate_gpu, *cand_gpu;
+    connected_layer *u, *w;  // u: [z r h] on the input, w: [z r] on the state
+    connected_layer *wh;
+    connected_layer *wr, *wz, *ur, *uz, *uh;  // per gate views into u and w, used by save/load
 } gru_layer;
 
-void increment_layer(connected_layer *l, int steps);
-
 image get_gru_image(const gru_layer *layer);
 gru_layer *make_gru_layer(int batch, int inputs, int outputs, int steps, int batch_normalize);
 void free_gru_layer(void *input);
 void forward_gru_layer(gru_layer *l, float *input, int test);
 void backward_gru_layer(gru_layer *l, float *input, float *delta, int test);
 void update_gru_layer(const gru_layer *l, float learning_rate, float momentum, float decay);
+void forward_gru_layer_begin(gru_layer *l, int test);
+void forward_gru_layer_step(gru_layer *l, float *input, int i, int test);
+void backward_gru_layer_step(gru_layer *l, float *input, float *delta, int i, int test);
 
 #ifdef GPU
 void forward_gru_layer_gpu(gru_layer *l, float *input, int test);
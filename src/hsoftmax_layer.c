@@ -0,0 +1,229 @@
+#include "network.h"
+
+hsoftmax_layer *make_hsoftmax_layer(int batch, int inputs, int outputs, char *tree_file, float lr_mult,
+                                    float lr_decay_mult, float bias_mult, float bias_decay_mult)
+{
+    hsoftmax_layer *l = calloc(1, sizeof(hsoftmax_layer));
+    l->batch = batch;
+    l->inputs = inputs;
+    l->outputs = outputs;
+    l->lr_mult = lr_mult;
+    l->lr_decay_mult = lr_decay_mult;
+    l->bias_mult = bias_mult;
+    l->bias_decay_mult = bias_decay_mult;
+
+    FILE *fp = fopen(tree_file, "r");
+    if(!fp) file_error(tree_file);
+    fclose(fp);
+    l->hier = read_tree(tree_file);
+    tree *hier = l->hier;
+
+    l->class_node = calloc(outputs, sizeof(int));
+    for(int c = 0; c < outputs; ++c) l->class_node[c] = -1;
+    int mapped = 0;
+    for(int i = 0; i < hier->n; ++i){
+        if(!hier->leaf[i]) continue;
+        char *end;
+        long c = strtol(hier->name[i], &end, 10);
+        if(*end == 0 && c >= 0 && c < outputs && l->class_node[c] < 0){
+            l->class_node[c] = i;
+            ++mapped;
+        }
+    }
+    for(int i = 0; i < hier->n; ++i){
+        if(!hier->leaf[i]) continue;
+        int size = 0;
+        for(int k = i; k >= 0; k = hier->parent[k]) size += hier->group_size[hier->group[k]];
+        if(size > l->path_size) l->path_size = size;
+    }
+    fprintf(stderr, "HSoftmax:           %d inputs, %d outputs, tree %s: %d nodes, %d groups, %d classes, "
+            "path size %d\n", inputs, outputs, tree_file, hier->n, hier->groups, mapped, l->path_size);
+
+    int n = hier->n;
+    l->weights = calloc(n*inputs, sizeof(float));
+    l->weight_updates = calloc(n*inputs, sizeof(float));
+    l->biases = calloc(n, sizeof(float));
+    l->bias_updates = calloc(n, sizeof(float));
+    float scale = sqrtf(2.0F / inputs);
+    for(int i = 0; i < n*inputs; ++i) l->weights[i] = scale*rand_uniform(-1, 1);
+    l->weight_update = make_sparse_update(n, inputs, n);
+    l->bias_update = make_sparse_update(n, 1, n);
+
+    l->output = calloc(batch*outputs, sizeof(float));
+    l->delta = calloc(batch*inputs, sizeof(float));
+    l->prob = calloc(batch*l->path_size, sizeof(float));
+    l->node_prob = calloc(batch*n, sizeof(float));
+    l->cost = calloc(1, sizeof(float));
+#ifdef GPU
+    l->input_cpu = calloc(batch*inputs, sizeof(float));
+    l->output_gpu = cuda_make_array(l->output, batch*outputs);
+    l->delta_gpu = cuda_make_array(l->delta, batch*inputs);
+#endif
+    return l;
+}
+
+void free_hsoftmax_layer(void *input)
+{
+    hsoftmax_layer *l = (hsoftmax_layer *)input;
+    tree *hier = l->hier;
+    for(int i = 0; i < hier->n; ++i) free_ptr(hier->name[i]);
+    free_ptr(hier->name);
+    free_ptr(hier->leaf);
+    free_ptr(hier->parent);
+    free_ptr(hier->child);
+    free_ptr(hier->group);
+    free_ptr(hier->group_size);
+    free_ptr(hier->group_offset);
+    free_ptr(hier);
+    free_ptr(l->class_node);
+    free_ptr(l->weights);
+    free_ptr(l->weight_updates);
+    free_ptr(l->biases);
+    free_ptr(l->bias_updates);
+    free_sparse_update(l->weight_update);
+    free_sparse_update(l->bias_update);
+    free_ptr(l->output);
+    free_ptr(l->delta);
+    free_ptr(l->prob);
+    free_ptr(l->node_prob);
+    free_ptr(l->cost);
+#ifdef GPU
+    free_ptr(l->input_cpu);
+    if(l->output_gpu) cuda_free(l->output_gpu);
+    if(l->delta_gpu) cuda_free(l->delta_gpu);
+#endif
+    free_ptr(l);
+}
+
+// softmax over the tree nodes of group g
+static void hsoftmax_group(hsoftmax_layer *l, int g, float *x, float *prob)
+{
+    int offset = l->hier->group_offset[g];
+    int size = l->hier->group_size[g];
+    for(int i = 0; i < size; ++i){
+        int k = offset + i;
+        sparse_update_catch_up(l->weight_update, l->weights, l->weight_updates, k);
+        sparse_update_catch_up(l->bias_update, l->biases, l->bias_updates, k);
+        prob[i] = dot_cpu(l->inputs, l->weights + k*l->inputs, 1, x, 1) + l->biases[k];
+    }
+    softmax_cpu(prob, size, prob);
+}
+
+static int hsoftmax_truth_node(const hsoftmax_layer *l, int truth)
+{
+    if(truth < 0 || truth >= l->outputs || l->class_node[truth] < 0){
+        fprintf(stderr, "hsoftmax layer: class %d is not a leaf of the tree\n", truth);
+        exit(-1);
+    }
+    return l->class_node[truth];
+}
+
+void forward_hsoftmax_layer(hsoftmax_layer *l, float *input, network *net)
+{
+    tree *hier = l->hier;
+    float loss = 0;
+    if(net->test == 0 && net->truth_label_index){    // 0: train, 1: valid
+        // only the groups on the path from the truth leaf to the root
+        for(int b = 0; b < l->batch; ++b){
+            if(net->truth_label_index[b] < 0) continue;  // masked row
+            float *x = input + b*l->inputs;
+            float *prob = l->prob + b*l->path_size;
+            int correct = 1;
+            for(int k = hsoftmax_truth_node(l, net->truth_label_index[b]); k >= 0; k = hier->parent[k]){
+                int g = hier->group[k];
+                hsoftmax_group(l, g, x, prob);
+                int i = k - hier->group_offset[g];
+                loss -= logf(fmaxf(prob[i], FLT_MIN));
+                for(int j = 0; j < hier->group_size[g]; ++j){
+                    if(prob[j] > prob[i]) correct = 0;
+                }
+                prob += hier->group_size[g];
+            }
+            net->correct_num += correct;
+        }
+    } else {
+        int n = hier->n;
+        sparse_update_flush(l->weight_update, l->weights, l->weight_updates);
+        sparse_update_flush(l->bias_update, l->biases, l->bias_updates);
+        for(int b = 0; b < l->batch; ++b) copy_cpu(n, l->biases, 1, l->node_prob + b*n, 1);
+        gemm(0, 1, l->batch, n, l->inputs, 1, input, l->inputs, l->weights, l->inputs, 1, l->node_prob, n);
+        for(int b = 0; b < l->batch; ++b){
+            float *node_prob = l->node_prob + b*n;
+            for(int g = 0; g < hier->groups; ++g){
+                softmax_cpu(node_prob + hier->group_offset[g], hier->group_size[g], node_prob + hier->group_offset[g]);
+            }
+            hierarchy_predictions(node_prob, n, hier, 0, 1);
+            float *output = l->output + b*l->outputs;
+            for(int c = 0; c < l->outputs; ++c){
+                output[c] = (l->class_node[c] < 0) ? 0 : node_prob[l->class_node[c]];
+            }
+            if(net->truth_label_index && net->truth_label_index[b] >= 0){
+                int truth = net->truth_label_index[b];
+                int max_i = max_index(output, l->outputs);
+                if(max_i == truth) net->correct_num += 1;
+                loss -= logf(fmaxf(output[truth], FLT_MIN));
+            }
+        }
+    }
+    l->cost[0] = loss;
+    net->loss = loss;
+}
+
+void backward_hsoftmax_layer(hsoftmax_layer *l, float *input, float *delta, network *net)
+{
+    tree *hier = l->hier;
+    for(int b = 0; b < l->batch; ++b){
+        if(net->truth_label_index[b] < 0) continue;
+        float *x = input + b*l->inputs;
+        float *prob = l->prob + b*l->path_size;
+        for(int k = hsoftmax_truth_node(l, net->truth_label_index[b]); k >= 0; k = hier->parent[k]){
+            int g = hier->group[k];
+            for(int i = 0; i < hier->group_size[g]; ++i){
+                int j = hier->group_offset[g] + i;
+                float d = (j == k) - prob[i];
+                if(delta) axpy_cpu(l->inputs, d, l->weights + j*l->inputs, 1, delta + b*l->inputs, 1);
+                axpy_cpu(l->inputs, d, x, 1, l->weight_updates + j*l->inputs, 1);
+                l->bias_updates[j] += d;
+                sparse_update_touch(l->weight_update, j);
+                sparse_update_touch(l->bias_update, j);
+            }
+            prob += hier->group_size[g];
+        }
+    }
+}
+
+void update_hsoftmax_layer(hsoftmax_layer *l, float learning_rate, float momentum, float decay)
+{
+    sparse_update_apply(l->bias_update, l->biases, l->bias_updates, -decay * l->bias_decay_mult * l->batch,
+                        learning_rate * l->bias_mult / l->batch, momentum);
+    sparse_update_apply(l->weight_update, l->weights, l->weight_updates, -decay * l->lr_decay_mult * l->batch,
+                        learning_rate * l->lr_mult / l->batch, momentum);
+}
+
+void flush_hsoftmax_layer(hsoftmax_layer *l)
+{
+    sparse_update_flush(l->weight_update, l->weights, l->weight_updates);
+    sparse_update_flush(l->bias_update, l->biases, l->bias_updates);
+}
+
+#ifdef GPU
+// the tree walk runs on the host, like the yolo layer; the parameters only live in host memory
+void forward_hsoftmax_layer_gpu(hsoftmax_layer *l, float *input_gpu, network *net)
+{
+    cuda_pull_array(input_gpu, l->input_cpu, l->batch*l->inputs);
+    forward_hsoftmax_layer(l, l->input_cpu, net);
+    if(net->test != 0 || !net->truth_label_index){
+        cuda_push_array(l->output_gpu, l->output, l->batch*l->outputs);
+    }
+}
+
+void backward_hsoftmax_layer_gpu(hsoftmax_layer *l, float *delta_gpu, network *net)
+{
+    fill_cpu(l->batch*l->inputs, 0, l->delta, 1);
+    backward_hsoftmax_layer(l, l->input_cpu, delta_gpu ? l->delta : 0, net);
+    if(delta_gpu){
+        cuda_push_array(l->delta_gpu, l->delta, l->batch*l->inputs);
+        axpy_gpu(l->batch*l->inputs, 1, l->delta_gpu, 1, delta_gpu, 1);
+    }
+}
+#endif
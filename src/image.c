@@ -775,12 +775,12 @@ image random_crop_image(image im, int w, int h)
     return crop;
 }
 
-float three_way_max(float a, float b, float c)
+static float three_way_max(float a, float b, float c)
 {
     return (a > b) ? ( (a > c) ? a : c) : ( (b > c) ? b : c) ;
 }
 
-float three_way_min(float a, float b, float c)
+static float three_way_min(float a, float b, float c)
 {
     return (a < b) ? ( (a < c) ? a : c) : ( (b < c) ? b : c) ;
 }
@@ -1111,15 +1111,9 @@ image resize_image(image im, int w, int h)
     return resized;
 }
 
-image load_image_stb(char *filename, int channels)
+// interleaved uint8 pixels to a planar image in [0, 1], frees data
+static image stb_to_image(unsigned char *data, int w, int h, int c)
 {
-    int w, h, c;
-    unsigned char *data = stbi_load(filename, &w, &h, &c, channels);
-    if (!data) {
-        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
-        exit(0);
-    }
-    if(channels) c = channels;
     int i,j,k;
     image im = make_image(w, h, c);
     for(k = 0; k < c; ++k){
@@ -1135,6 +1129,36 @@ image load_image_stb(char *filename, int channels)
     return im;
 }
 
+// decoded interleaved uint8 pixels, channels: the channels wanted, 0 keeps those of the file; free with free
+unsigned char *load_image_pixels(char *filename, int *w, int *h, int *c, int channels)
+{
+    unsigned char *data = stbi_load(filename, w, h, c, channels);
+    if (!data) {
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
+        exit(0);
+    }
+    if(channels) *c = channels;
+    return data;
+}
+
+unsigned char *load_image_memory_pixels(const unsigned char *buffer, int len, int *w, int *h, int *c, int channels)
+{
+    unsigned char *data = stbi_load_from_memory(buffer, len, w, h, c, channels);
+    if (!data) {
+        fprintf(stderr, "Cannot decode image of %d bytes\nSTB Reason: %s\n", len, stbi_failure_reason());
+        exit(-1);
+    }
+    if(channels) *c = channels;
+    return data;
+}
+
+image load_image_stb(char *filename, int channels)
+{
+    int w, h, c;
+    unsigned char *data = load_image_pixels(filename, &w, &h, &c, channels);
+    return stb_to_image(data, w, h, c);
+}
+
 void zero_image(image m)
 {
     memset(m.data, 0, m.h*m.w*m.c*sizeof(float));
@@ -57,6 +57,8 @@ image load_image_color(char *filename, int w, int h);
 image crop_image(image im, int dx, int dy, int w, int h);
 image resize_image(image im, int w, int h);
 image load_image(char *filename, int w, int h, int c);
+unsigned char *load_image_pixels(char *filename, int *w, int *h, int *c, int channels);
+unsigned char *load_image_memory_pixels(const unsigned char *buffer, int len, int *w, int *h, int *c, int channels);
 
 void save_image_png(image im, const char *name);
 image float_to_image(int h, int w, int c, float *data);
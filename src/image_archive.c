@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image_archive.h"
+#include "image.h"
+#include "image_augment.h"
+#include "utils.h"
+
+void write_image_archive(path_table *paths, int n, char **labels, int classes, char *outfile)
+{
+    double time = what_time_is_it_now();
+    FILE *fp = fopen(outfile, "wb");
+    if(!fp) file_error(outfile);
+    image_archive_header header = {IMAGE_ARCHIVE_MAGIC, IMAGE_ARCHIVE_VERSION, n};
+    fwrite(&header, sizeof(header), 1, fp);
+    image_archive_entry *index = calloc(n, sizeof(image_archive_entry));
+    uint64_t offset = sizeof(header);
+    size_t size = 0;
+    unsigned char *buffer = NULL;
+    for(int i = 0; i < n; ++i){
+        char *path = table_path(paths, i);
+        FILE *image_fp = fopen(path, "rb");
+        if(!image_fp) file_error(path);
+        fseek(image_fp, 0, SEEK_END);
+        long length = ftell(image_fp);
+        fseek(image_fp, 0, SEEK_SET);
+        if(length > (long)size){
+            size = length;
+            buffer = realloc(buffer, size);
+        }
+        if(fread(buffer, 1, length, image_fp) != (size_t)length) file_error(path);
+        fclose(image_fp);
+        fwrite(buffer, 1, length, fp);
+        index[i].offset = offset;
+        index[i].length = length;
+        fill_path_truth(paths, i, labels, classes, &index[i].label);
+        offset += length;
+    }
+    header.index_offset = (offset + 7) / 8 * 8;
+    uint64_t pad = 0;
+    fwrite(&pad, 1, header.index_offset - offset, fp);
+    fwrite(index, sizeof(image_archive_entry), n, fp);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    if(fclose(fp) != 0) file_error(outfile);
+    fprintf(stderr, "%s: %d images, %.1f MB, %.1f s\n", outfile, n, header.index_offset / 1024.0 / 1024.0,
+            what_time_is_it_now() - time);
+    free_ptr(index);
+    free_ptr(buffer);
+}
+
+image_archive *open_image_archive(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(filename);
+    image_archive *a = calloc(1, sizeof(image_archive));
+    a->map_size = st.st_size;
+    a->map = mmap(0, a->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(a->map == MAP_FAILED) file_error(filename);
+    const image_archive_header *header = (const image_archive_header *)a->map;
+    if(a->map_size < sizeof(image_archive_header) || memcmp(header->magic, IMAGE_ARCHIVE_MAGIC, 4) != 0 ||
+       header->version != IMAGE_ARCHIVE_VERSION ||
+       a->map_size < header->index_offset + (size_t)header->count * sizeof(image_archive_entry)){
+        fprintf(stderr, "%s: not an image archive of version %d\n", filename, IMAGE_ARCHIVE_VERSION);
+        exit(-1);
+    }
+    a->count = header->count;
+    a->index = (const image_archive_entry *)(a->map + header->index_offset);
+    pthread_mutex_init(&a->mutex, NULL);
+    fprintf(stderr, "%s: %d images\n", filename, a->count);
+    return a;
+}
+
+void free_image_archive(image_archive *a)
+{
+    munmap(a->map, a->map_size);
+    pthread_mutex_destroy(&a->mutex);
+    free_ptr(a);
+}
+
+// the same sampling and augmentation as random_batch, the images are decoded from the archive
+void image_archive_batch(image_archive *a, batch *b, sampler *samples, uint64_t position, int batch_size, int w, int h,
+                         int c, float hue, float saturation, float exposure, int flip, float mean_value, float scale,
+                         int test)
+{
+    int image_size = h * w * c;
+    reserve_batch(b, batch_size, w, h, c);
+    int *order = get_load_scratch(batch_size)->index;
+    int first = 0;
+    uint64_t sample = 0;    // the sample number of order[0], the stream of its augmentation
+    if(test){      // 0: train, 1: valid
+        pthread_mutex_lock(&a->mutex);
+        first = a->next;
+        a->next = (a->next + batch_size) % a->count;
+        pthread_mutex_unlock(&a->mutex);
+    } else {
+        sample = sampler_at(samples, position, order, batch_size);
+    }
+
+    #pragma omp parallel for
+    for(int i = 0; i < batch_size; ++i){
+        int index = test ? (first + i) % a->count : order[i];
+        const image_archive_entry *e = a->index + index;
+        augment_args args = make_augment_args(w, h);
+        if(test == 0){      // 0: train, 1: valid
+            rand_stream(sample + (uint64_t)i * samples->replicas);
+            if(flip) args.flip = rand_int(0, 1);
+            random_augment_color(&args, hue, saturation, exposure);
+        }
+        args.mean_value = mean_value;
+        args.scale = scale;
+        int iw, ih, ic;
+        unsigned char *pixels = load_image_memory_pixels(a->map + e->offset, e->length, &iw, &ih, &ic, c);
+        augment_image_into(pixels, iw, ih, c, 0, args, b->data + (size_t)i * image_size);
+        free(pixels);
+        b->truth_label_index[i] = e->label;
+    }
+}
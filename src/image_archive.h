@@ -0,0 +1,43 @@
+#ifndef IMAGE_ARCHIVE_H
+#define IMAGE_ARCHIVE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "data.h"
+
+/* Encoded images (jpg, png, ...) concatenated into one file by `cnn archive`, followed by an index of offset,
+ * length and label per image. The loader maps the file and decodes from memory with stbi_load_from_memory, so
+ * millions of small images cost no open, stat or read per file */
+#define IMAGE_ARCHIVE_MAGIC "CNNA"
+#define IMAGE_ARCHIVE_VERSION 1
+
+typedef struct{
+    char magic[4];
+    int version, count, pad;
+    uint64_t index_offset;
+} image_archive_header;
+
+typedef struct{
+    uint64_t offset;
+    uint32_t length;
+    int label;
+} image_archive_entry;
+
+typedef struct{
+    int count;
+    unsigned char *map;
+    size_t map_size;
+    const image_archive_entry *index;
+    int next;               // next image in test mode
+    pthread_mutex_t mutex;
+} image_archive;
+
+void write_image_archive(path_table *paths, int n, char **labels, int classes, char *outfile);
+image_archive *open_image_archive(char *filename);
+void free_image_archive(image_archive *a);
+void image_archive_batch(image_archive *a, batch *b, sampler *samples, uint64_t position, int batch_size, int w, int h,
+                         int c, float hue, float saturation, float exposure, int flip, float mean_value, float scale,
+                         int test);
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "image_augment.h"
+#include "utils.h"
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+typedef struct{
+    size_t size;
+    float *data;
+} augment_scratch;
+
+static void free_augment_scratch(void *p)
+{
+    augment_scratch *s = (augment_scratch *)p;
+    free_ptr(s->data);
+    free_ptr(s);
+}
+
+static void make_scratch_key()
+{
+    pthread_key_create(&scratch_key, free_augment_scratch);
+}
+
+// the taps and the row buffer of the calling thread, kept across images, n floats (ints are the same size)
+static float *get_augment_scratch(size_t n)
+{
+    pthread_once(&scratch_once, make_scratch_key);
+    augment_scratch *s = pthread_getspecific(scratch_key);
+    if(!s){
+        s = calloc(1, sizeof(augment_scratch));
+        pthread_setspecific(scratch_key, s);
+    }
+    if(n > s->size){
+        free_ptr(s->data);
+        s->data = calloc(n, sizeof(float));
+        s->size = n;
+    }
+    return s->data;
+}
+
+augment_args make_augment_args(int w, int h)
+{
+    augment_args a = {0};
+    a.w = w;
+    a.h = h;
+    a.saturation = 1;
+    a.exposure = 1;
+    return a;
+}
+
+// the draws of random_distort_image, in its order
+void random_augment_color(augment_args *a, float hue, float saturation, float exposure)
+{
+    a->hue = rand_uniform(-hue, hue);
+    a->saturation = rand_scale(saturation);
+    a->exposure = rand_scale(exposure);
+}
+
+static inline float clamp01(float x)
+{
+    return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+// a channel of hsv_to_rgb, n: 5 red, 3 green, 1 blue
+static inline float hsv_channel(float n, float h, float s, float v)
+{
+    float k = n + h;
+    k = k >= 6 ? k - 6 : k;
+    float m = k < 4 - k ? k : 4 - k;
+    m = m < 1 ? m : 1;
+    m = m > 0 ? m : 0;
+    return clamp01(v - v * s * m);
+}
+
+/* rgb_to_hsv, the changes of distort_image, hsv_to_rgb and constrain_image on one pixel, with selects instead of
+ * the branches on the sextant so that noisy pixels do not cost mispredictions. Where two channels tie for the max
+ * hsv_to_rgb can round h up to 6 and take the wrong sextant, by up to .34 of a channel; hsv_channel has no sextant
+ * to get wrong */
+static inline void distort_pixel(float *p, float hue, float sat, float val)
+{
+    float r = p[0], g = p[1], b = p[2];
+    float max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+    float min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+    float delta = max - min;
+    float inv = delta > 0 ? 1 / delta : 0;
+    float h = r == max ? (g - b) * inv : (g == max ? 2 + (b - r) * inv : 4 + (r - g) * inv);
+    h = h < 0 ? h + 6 : h;
+    float s = max > 0 ? delta / max * sat : 0;
+    float v = max * val;
+    h = h + 6 * hue;
+    h = h > 6 ? h - 6 : (h < 0 ? h + 6 : h);
+    p[0] = hsv_channel(5, h, s, v);
+    p[1] = hsv_channel(3, h, s, v);
+    p[2] = hsv_channel(1, h, s, v);
+}
+
+/* without a hue shift every channel keeps its place between min and max, scaling s and v is then
+ * x' = val * (max - sat * (max - x)), the same as the round trip through hsv but without branches */
+static inline void saturate_exposure_pixel(float *p, float sat, float val)
+{
+    float r = p[0], g = p[1], b = p[2];
+    float max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+    p[0] = clamp01(val * (max - sat * (max - r)));
+    p[1] = clamp01(val * (max - sat * (max - g)));
+    p[2] = clamp01(val * (max - sat * (max - b)));
+}
+
+/* source pixel and weights of the two bilinear taps of every output coordinate, -1: outside the placed image.
+ * Resizing aligns the end points like resize_image, placing scales like place_image; a tap past the last source
+ * pixel weighs 0 (get_pixel_extend). The last output row and column are the last source ones exactly, resize_image
+ * can lose the last row to the float rounding of its scale, by up to a whole pixel value */
+static void augment_taps(int n, int place, int pn, int d, int in, int *i0, int *i1, float *w0, float *w1)
+{
+    float step = n > 1 ? (float)(in - 1) / (n - 1) : 0;
+    for(int i = 0; i < n; ++i){
+        float s;
+        if(place){
+            int k = i - d;
+            if(k < 0 || k >= pn){
+                i0[i] = -1;
+                continue;
+            }
+            s = ((float)k / pn) * in;
+        } else {
+            s = (i == n - 1 || in == 1) ? in - 1 : i * step;
+        }
+        int ix = (int)floorf(s);
+        float f = s - ix;
+        i0[i] = ix;
+        i1[i] = ix + 1 < in ? ix + 1 : ix;
+        w0[i] = 1 - f;
+        w1[i] = ix + 1 < in ? f : 0;
+    }
+}
+
+/* pixels: iw x ih x c uint8, interleaved as decoded by stb or planar as in an image pack; out: a.w x a.h x c
+ * planar floats, e.g. a slot of the batch */
+void augment_image_into(const unsigned char *pixels, int iw, int ih, int c, int planar, augment_args a, float *out)
+{
+    size_t xs = planar ? 1 : c;
+    size_t ks = planar ? (size_t)iw * ih : 1;
+    size_t ys = planar ? iw : (size_t)iw * c;
+    int distort = c == 3 && (a.hue != 0 || a.saturation != 1 || a.exposure != 1);
+    int normalize = a.mean_value > 0.001;
+    float *scratch = get_augment_scratch(4 * (size_t)a.w + 4 * (size_t)a.h + (size_t)a.w * c);
+    int *x0 = (int *)scratch;
+    int *x1 = x0 + a.w;
+    float *wx0 = (float *)(x1 + a.w);
+    float *wx1 = wx0 + a.w;
+    int *y0 = (int *)(wx1 + a.w);
+    int *y1 = y0 + a.h;
+    float *wy0 = (float *)(y1 + a.h);
+    float *wy1 = wy0 + a.h;
+    float *row = wy1 + a.h;     // interleaved output row
+    augment_taps(a.w, a.place, a.nw, a.dx, iw, x0, x1, wx0, wx1);
+    augment_taps(a.h, a.place, a.nh, a.dy, ih, y0, y1, wy0, wy1);
+    for(int y = 0; y < a.h; ++y){
+        int outside = y0[y] < 0;
+        const unsigned char *top = pixels + (outside ? 0 : y0[y] * ys);
+        const unsigned char *bottom = pixels + (outside ? 0 : y1[y] * ys);
+        for(int x = 0; x < a.w; ++x){
+            float *p = row + x * c;
+            if(outside || x0[x] < 0){
+                for(int k = 0; k < c; ++k) p[k] = a.fill;
+            } else {
+                size_t l = x0[x] * xs, r = x1[x] * xs;
+                for(int k = 0; k < c; ++k){
+                    size_t o = k * ks;
+                    float t = wx0[x] * top[l + o] + wx1[x] * top[r + o];
+                    float b = wx0[x] * bottom[l + o] + wx1[x] * bottom[r + o];
+                    p[k] = (wy0[y] * t + wy1[y] * b) * (1.0F / 255.0F);
+                }
+            }
+            if(distort){
+                if(a.hue == 0) saturate_exposure_pixel(p, a.saturation, a.exposure);
+                else distort_pixel(p, a.hue, a.saturation, a.exposure);
+            }
+        }
+        for(int k = 0; k < c; ++k){
+            float *dst = out + ((size_t)k * a.h + y) * a.w;
+            const float *src = row + k;
+            if(a.flip){
+                for(int x = 0; x < a.w; ++x) dst[a.w - 1 - x] = src[x * c];
+            } else {
+                for(int x = 0; x < a.w; ++x) dst[x] = src[x * c];
+            }
+            if(normalize){
+                // the float images of load_image_stb are divided by 255
+                for(int x = 0; x < a.w; ++x) dst[x] = (dst[x] * 255.0F - a.mean_value) * a.scale;
+            }
+        }
+    }
+}
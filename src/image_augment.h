@@ -0,0 +1,25 @@
+#ifndef IMAGE_AUGMENT_H
+#define IMAGE_AUGMENT_H
+
+#include "image.h"
+
+/* One pass from decoded uint8 pixels to the normalized planar float input of the network: bilinear resize (or
+ * placement of a jittered box on a filled canvas for detection), flip, hue/saturation/exposure and mean/scale are
+ * applied per output row, replacing the chain of full image float passes of load_image, resize_image, flip_image,
+ * random_distort_image, place_image and the mean loop. The parameters are sampled by the caller. The output is
+ * not that of the old chain bit for bit: the last row of a resize and the pixels with two channels at the max
+ * differ where the old functions were off, see augment_taps and distort_pixel */
+typedef struct{
+    int w, h;                   // output size
+    int place, nw, nh, dx, dy;  // place: the image is resized to nw x nh at dx, dy, the rest is fill; else to w x h
+    float fill;
+    int flip;
+    float hue, saturation, exposure;    // hue shift, saturation and exposure scales; 0, 1, 1: none
+    float mean_value, scale;    // mean_value > 0.001: (pixel * 255 - mean_value) * scale
+} augment_args;
+
+augment_args make_augment_args(int w, int h);
+void random_augment_color(augment_args *a, float hue, float saturation, float exposure);
+void augment_image_into(const unsigned char *pixels, int iw, int ih, int c, int planar, augment_args a, float *out);
+
+#endif
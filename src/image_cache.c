@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "image_cache.h"
+#include "utils.h"
+
+static uint32_t image_cache_hash(int key)
+{
+    uint32_t x = (uint32_t)key * 2654435761u;
+    return x ^ (x >> 16);
+}
+
+static image_cache_shard *image_cache_shard_of(image_cache *cache, int key)
+{
+    return cache->shards + image_cache_hash(key) % cache->shard_num;
+}
+
+image_cache *make_image_cache(size_t budget, int shard_num)
+{
+    if(shard_num < 1) shard_num = 1;
+    image_cache *cache = calloc(1, sizeof(image_cache));
+    cache->shard_num = shard_num;
+    cache->shards = calloc(shard_num, sizeof(image_cache_shard));
+    for(int i = 0; i < shard_num; ++i){
+        image_cache_shard *s = cache->shards + i;
+        pthread_mutex_init(&s->mutex, NULL);
+        s->bucket_num = 1024;
+        s->buckets = calloc(s->bucket_num, sizeof(image_cache_entry *));
+        s->budget = budget / shard_num;
+    }
+    fprintf(stderr, "image cache: %.0f MB in %d shards\n", budget / 1024.0 / 1024.0, shard_num);
+    return cache;
+}
+
+void free_image_cache(image_cache *cache)
+{
+    for(int i = 0; i < cache->shard_num; ++i){
+        image_cache_shard *s = cache->shards + i;
+        image_cache_entry *e = s->head;
+        while(e){
+            image_cache_entry *next = e->next;
+            free_ptr(e->pixels);
+            free_ptr(e);
+            e = next;
+        }
+        free_ptr(s->buckets);
+        pthread_mutex_destroy(&s->mutex);
+    }
+    free_ptr(cache->shards);
+    free_ptr(cache);
+}
+
+static void lru_unlink(image_cache_shard *s, image_cache_entry *e)
+{
+    if(e->prev) e->prev->next = e->next;
+    else s->head = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else s->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(image_cache_shard *s, image_cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = s->head;
+    if(s->head) s->head->prev = e;
+    s->head = e;
+    if(!s->tail) s->tail = e;
+}
+
+static void hash_remove(image_cache_shard *s, image_cache_entry *e)
+{
+    image_cache_entry **p = s->buckets + (image_cache_hash(e->key) >> 8) % s->bucket_num;
+    while(*p != e) p = &(*p)->hash_next;
+    *p = e->hash_next;
+    s->count -= 1;
+}
+
+static void hash_insert(image_cache_shard *s, image_cache_entry *e)
+{
+    if(s->count >= s->bucket_num){
+        int bucket_num = s->bucket_num * 2;
+        image_cache_entry **buckets = calloc(bucket_num, sizeof(image_cache_entry *));
+        for(int i = 0; i < s->bucket_num; ++i){
+            image_cache_entry *b = s->buckets[i];
+            while(b){
+                image_cache_entry *next = b->hash_next;
+                image_cache_entry **head = buckets + (image_cache_hash(b->key) >> 8) % bucket_num;
+                b->hash_next = *head;
+                *head = b;
+                b = next;
+            }
+        }
+        free_ptr(s->buckets);
+        s->buckets = buckets;
+        s->bucket_num = bucket_num;
+    }
+    image_cache_entry **head = s->buckets + (image_cache_hash(e->key) >> 8) % s->bucket_num;
+    e->hash_next = *head;
+    *head = e;
+    s->count += 1;
+}
+
+static image_cache_entry *hash_find(image_cache_shard *s, int key)
+{
+    image_cache_entry *e = s->buckets[(image_cache_hash(key) >> 8) % s->bucket_num];
+    while(e && e->key != key) e = e->hash_next;
+    return e;
+}
+
+// the pinned entry of key, NULL on a miss
+image_cache_entry *image_cache_get(image_cache *cache, int key)
+{
+    image_cache_shard *s = image_cache_shard_of(cache, key);
+    pthread_mutex_lock(&s->mutex);
+    image_cache_entry *e = hash_find(s, key);
+    if(e){
+        if(e->refs++ == 0) s->pinned += e->size;
+        lru_unlink(s, e);
+        lru_push_front(s, e);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    __atomic_add_fetch(e ? &cache->hits : &cache->misses, 1, __ATOMIC_RELAXED);
+    return e;
+}
+
+/* insert the decoded pixels (the cache owns them) evicting the least recently used unpinned entries, returns the
+ * pinned entry; when another loader inserted key first its entry is returned and pixels are freed. An image that
+ * does not fit next to the pinned entries is detached without evicting anything */
+image_cache_entry *image_cache_put(image_cache *cache, int key, unsigned char *pixels, int w, int h, int c)
+{
+    image_cache_shard *s = image_cache_shard_of(cache, key);
+    size_t size = (size_t)w * h * c;
+    pthread_mutex_lock(&s->mutex);
+    image_cache_entry *e = hash_find(s, key);
+    if(e){
+        if(e->refs++ == 0) s->pinned += e->size;
+        pthread_mutex_unlock(&s->mutex);
+        free_ptr(pixels);
+        return e;
+    }
+    e = calloc(1, sizeof(image_cache_entry));
+    e->key = key;
+    e->w = w;
+    e->h = h;
+    e->c = c;
+    e->refs = 1;
+    e->size = size;
+    e->pixels = pixels;
+    if(size > s->budget || s->pinned + size > s->budget){
+        e->detached = 1;
+        pthread_mutex_unlock(&s->mutex);
+        return e;
+    }
+    image_cache_entry *victim = s->tail;
+    while(victim && s->bytes + size > s->budget){
+        image_cache_entry *prev = victim->prev;
+        if(victim->refs == 0){
+            lru_unlink(s, victim);
+            hash_remove(s, victim);
+            s->bytes -= victim->size;
+            free_ptr(victim->pixels);
+            free_ptr(victim);
+        }
+        victim = prev;
+    }
+    hash_insert(s, e);
+    lru_push_front(s, e);
+    s->bytes += size;
+    s->pinned += size;
+    pthread_mutex_unlock(&s->mutex);
+    return e;
+}
+
+void image_cache_release(image_cache *cache, image_cache_entry *e)
+{
+    image_cache_shard *s = image_cache_shard_of(cache, e->key);
+    pthread_mutex_lock(&s->mutex);
+    e->refs -= 1;
+    if(!e->detached && e->refs == 0) s->pinned -= e->size;
+    int free_entry = e->detached && e->refs == 0;
+    pthread_mutex_unlock(&s->mutex);
+    if(free_entry){
+        free_ptr(e->pixels);
+        free_ptr(e);
+    }
+}
+
+size_t image_cache_bytes(image_cache *cache)
+{
+    size_t bytes = 0;
+    for(int i = 0; i < cache->shard_num; ++i){
+        image_cache_shard *s = cache->shards + i;
+        pthread_mutex_lock(&s->mutex);
+        bytes += s->bytes;
+        pthread_mutex_unlock(&s->mutex);
+    }
+    return bytes;
+}
@@ -0,0 +1,40 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Decoded uint8 images (before resize and augmentation) kept in memory up to a byte budget, so streaming training
+ * decodes an image once while it is resident and still augments it fresh on every draw. The keys are the indexes
+ * of the images in the train list. The cache is split into shards with a lock and an lru list each; an entry in use
+ * by a loader is pinned and is not evicted until it is released */
+typedef struct image_cache_entry{
+    int key, w, h, c, refs, detached;   // detached: not in the cache (too large), freed on the last release
+    size_t size;
+    unsigned char *pixels;
+    struct image_cache_entry *hash_next, *prev, *next;  // bucket chain, lru list from the most recent
+} image_cache_entry;
+
+typedef struct{
+    pthread_mutex_t mutex;
+    image_cache_entry **buckets;
+    int bucket_num, count;
+    image_cache_entry *head, *tail;
+    size_t bytes, budget;
+    size_t pinned;          // bytes of the entries in use, which eviction can not free
+} image_cache_shard;
+
+typedef struct{
+    int shard_num;
+    image_cache_shard *shards;
+    uint64_t hits, misses;
+} image_cache;
+
+image_cache *make_image_cache(size_t budget, int shard_num);
+void free_image_cache(image_cache *cache);
+image_cache_entry *image_cache_get(image_cache *cache, int key);
+image_cache_entry *image_cache_put(image_cache *cache, int key, unsigned char *pixels, int w, int h, int c);
+void image_cache_release(image_cache *cache, image_cache_entry *e);
+size_t image_cache_bytes(image_cache *cache);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image_pack.h"
+#include "image.h"
+#include "image_augment.h"
+#include "list.h"
+#include "utils.h"
+
+#define IMAGE_PACK_CHUNK 256    // images decoded in parallel before they are written
+
+static size_t align_up(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static void write_image_pack_shard(path_table *paths, int start, int n, char **labels, int classes, int w, int h,
+                                   int c, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    image_pack_header header = {IMAGE_PACK_MAGIC, IMAGE_PACK_VERSION, w, h, c, n};
+    header.record_size = align_up(w*h*c, 64);
+    header.labels_offset = sizeof(header);
+    header.data_offset = align_up(header.labels_offset + n * sizeof(int), 4096);
+    fwrite(&header, sizeof(header), 1, fp);
+
+    int *label = calloc(n, sizeof(int));
+    for(int i = 0; i < n; ++i) fill_path_truth(paths, start + i, labels, classes, label + i);
+    fwrite(label, sizeof(int), n, fp);
+    free_ptr(label);
+    fseek(fp, header.data_offset, SEEK_SET);
+
+    // resized by augment_image_into like the batches loaded from the list, so a pack gives the same pixels
+    unsigned char *records = calloc(IMAGE_PACK_CHUNK, header.record_size);
+    float *resized = calloc((size_t)IMAGE_PACK_CHUNK * w*h*c, sizeof(float));
+    for(int first = 0; first < n; first += IMAGE_PACK_CHUNK){
+        int num = n - first < IMAGE_PACK_CHUNK ? n - first : IMAGE_PACK_CHUNK;
+        #pragma omp parallel for
+        for(int i = 0; i < num; ++i){
+            int iw, ih, ic;
+            unsigned char *pixels = load_image_pixels(table_path(paths, start + first + i), &iw, &ih, &ic, c);
+            float *data = resized + (size_t)i * w*h*c;
+            augment_image_into(pixels, iw, ih, c, 0, make_augment_args(w, h), data);
+            free(pixels);
+            unsigned char *record = records + (size_t)i * header.record_size;
+            for(int k = 0; k < w*h*c; ++k){
+                float v = data[k] * 255.0F + 0.5F;
+                record[k] = v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+            }
+        }
+        fwrite(records, header.record_size, num, fp);
+    }
+    free_ptr(resized);
+    free_ptr(records);
+    if(fclose(fp) != 0) file_error(filename);
+}
+
+// the shards are <outfile>.000, <outfile>.001, ..., outfile lists them
+void write_image_pack(path_table *paths, int n, char **labels, int classes, int w, int h, int c, int shard_size,
+                      char *outfile)
+{
+    double time = what_time_is_it_now();
+    FILE *index = fopen(outfile, "w");
+    if(!index) file_error(outfile);
+    int shards = 0;
+    for(int start = 0; start < n; start += shard_size, ++shards){
+        int num = n - start < shard_size ? n - start : shard_size;
+        char filename[4096];
+        snprintf(filename, sizeof(filename), "%s.%03d", outfile, shards);
+        write_image_pack_shard(paths, start, num, labels, classes, w, h, c, filename);
+        fprintf(index, "%s\n", filename);
+        fprintf(stderr, "%s: %d images\n", filename, num);
+    }
+    if(fclose(index) != 0) file_error(outfile);
+    fprintf(stderr, "%s: %d images %dx%dx%d in %d shards, %.1f s\n", outfile, n, w, h, c, shards,
+            what_time_is_it_now() - time);
+}
+
+image_pack *open_image_pack(char *index_file)
+{
+    struct list *plist = get_paths(index_file);
+    char **files = (char **)list_to_array(plist);
+    image_pack *p = calloc(1, sizeof(image_pack));
+    p->shards = plist->size;
+    p->maps = calloc(p->shards, sizeof(unsigned char *));
+    p->map_sizes = calloc(p->shards, sizeof(size_t));
+    p->shard_start = calloc(p->shards + 1, sizeof(int));
+    for(int i = 0; i < p->shards; ++i){
+        int fd = open(files[i], O_RDONLY);
+        if(fd < 0) file_error(files[i]);
+        struct stat st;
+        if(fstat(fd, &st) != 0) file_error(files[i]);
+        p->map_sizes[i] = st.st_size;
+        p->maps[i] = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p->maps[i] == MAP_FAILED) file_error(files[i]);
+        image_pack_header *header = (image_pack_header *)p->maps[i];
+        if((size_t)st.st_size < sizeof(image_pack_header) || memcmp(header->magic, IMAGE_PACK_MAGIC, 4) != 0 ||
+           header->version != IMAGE_PACK_VERSION ||
+           (size_t)st.st_size < header->data_offset + (size_t)header->count * header->record_size){
+            fprintf(stderr, "%s: not an image pack shard of version %d\n", files[i], IMAGE_PACK_VERSION);
+            exit(-1);
+        }
+        if(i == 0){
+            p->w = header->w;
+            p->h = header->h;
+            p->c = header->c;
+        } else if(header->w != p->w || header->h != p->h || header->c != p->c){
+            fprintf(stderr, "%s: images are %dx%dx%d, the first shard has %dx%dx%d\n", files[i],
+                    header->w, header->h, header->c, p->w, p->h, p->c);
+            exit(-1);
+        }
+        p->shard_start[i + 1] = p->shard_start[i] + header->count;
+    }
+    p->count = p->shard_start[p->shards];
+    pthread_mutex_init(&p->mutex, NULL);
+    fprintf(stderr, "%s: %d images %dx%dx%d in %d shards\n", index_file, p->count, p->w, p->h, p->c, p->shards);
+    free_ptr(files);
+    free_list_contents(plist);
+    free_list(plist);
+    return p;
+}
+
+void free_image_pack(image_pack *p)
+{
+    for(int i = 0; i < p->shards; ++i) munmap(p->maps[i], p->map_sizes[i]);
+    pthread_mutex_destroy(&p->mutex);
+    free_ptr(p->maps);
+    free_ptr(p->map_sizes);
+    free_ptr(p->shard_start);
+    free_ptr(p);
+}
+
+// the image of index i, its pixels and label
+static const unsigned char *image_pack_record(const image_pack *p, int i, int *label)
+{
+    int s = 0;
+    while(i >= p->shard_start[s + 1]) ++s;
+    const unsigned char *map = p->maps[s];
+    const image_pack_header *header = (const image_pack_header *)map;
+    int k = i - p->shard_start[s];
+    *label = ((const int *)(map + header->labels_offset))[k];
+    return map + header->data_offset + (size_t)k * header->record_size;
+}
+
+// batch_size images of the sampler from position on; in test mode the images are taken in the order of the pack
+void image_pack_batch(image_pack *p, batch *b, sampler *samples, uint64_t position, int batch_size, float hue,
+                      float saturation, float exposure, int flip, float mean_value, float scale, int test)
+{
+    int image_size = p->w * p->h * p->c;
+    reserve_batch(b, batch_size, p->w, p->h, p->c);
+    int *index = get_load_scratch(batch_size)->index;
+    uint64_t first = 0;     // the sample number of index[0], the stream of its augmentation
+    if(test){      // 0: train, 1: valid
+        pthread_mutex_lock(&p->mutex);
+        for(int i = 0; i < batch_size; ++i){
+            index[i] = p->next;
+            p->next = (p->next + 1) % p->count;
+        }
+        pthread_mutex_unlock(&p->mutex);
+    } else {
+        first = sampler_at(samples, position, index, batch_size);
+    }
+
+    #pragma omp parallel for
+    for(int i = 0; i < batch_size; ++i){
+        const unsigned char *pixels = image_pack_record(p, index[i], b->truth_label_index + i);
+        augment_args a = make_augment_args(p->w, p->h);
+        if(test == 0){      // 0: train, 1: valid
+            rand_stream(first + (uint64_t)i * samples->replicas);
+            if(flip) a.flip = rand_int(0, 1);
+            random_augment_color(&a, hue, saturation, exposure);
+        }
+        a.mean_value = mean_value;
+        a.scale = scale;
+        augment_image_into(pixels, p->w, p->h, p->c, 1, a, b->data + (size_t)i * image_size);
+    }
+}
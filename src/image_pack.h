@@ -0,0 +1,39 @@
+#ifndef IMAGE_PACK_H
+#define IMAGE_PACK_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "data.h"
+
+/* Decoded training images packed by `cnn pack`: resized uint8 CHW pixels and labels in large shard files plus a
+ * text index listing the shards. A shard is the header, the labels, then the images from a 4096 aligned offset,
+ * one record_size (a multiple of 64) record each. The loader maps the shards, so concurrent jobs share the page
+ * cache, and converts and augments the pixels into the batch on the fly */
+#define IMAGE_PACK_MAGIC "CNNP"
+#define IMAGE_PACK_VERSION 1
+
+typedef struct{
+    char magic[4];
+    int version, w, h, c, count;
+    int record_size, pad;
+    uint64_t labels_offset, data_offset;
+} image_pack_header;
+
+typedef struct{
+    int w, h, c, count, shards;
+    unsigned char **maps;   // [shards], mapped shard files
+    size_t *map_sizes;
+    int *shard_start;       // [shards + 1], index of the first image of each shard
+    int next;               // next image in test mode
+    pthread_mutex_t mutex;
+} image_pack;
+
+void write_image_pack(path_table *paths, int n, char **labels, int classes, int w, int h, int c, int shard_size,
+                      char *outfile);
+image_pack *open_image_pack(char *index_file);
+void free_image_pack(image_pack *p);
+void image_pack_batch(image_pack *p, batch *b, sampler *samples, uint64_t position, int batch_size, float hue,
+                      float saturation, float exposure, int flip, float mean_value, float scale, int test);
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "image_stream.h"
+#include "image_pack.h"
+#include "image_augment.h"
+#include "list.h"
+#include "utils.h"
+
+static void read_fully(int fd, void *buffer, size_t size, off_t offset, char *filename)
+{
+    size_t got = 0;
+    while(got < size){
+        ssize_t r = pread(fd, (char *)buffer + got, size - got, offset + got);
+        if(r <= 0) file_error(filename);
+        got += r;
+    }
+}
+
+static void read_stream_header(char *filename, image_pack_header *header)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    read_fully(fd, header, sizeof(image_pack_header), 0, filename);
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    if(memcmp(header->magic, IMAGE_PACK_MAGIC, 4) != 0 || header->version != IMAGE_PACK_VERSION ||
+       (size_t)size < header->data_offset + (size_t)header->count * header->record_size){
+        fprintf(stderr, "%s: not an image pack shard of version %d\n", filename, IMAGE_PACK_VERSION);
+        exit(-1);
+    }
+}
+
+// buffer_size: bytes of the shuffle buffer; read_size: bytes per sequential read of a shard
+image_stream *open_image_stream(char *index_file, size_t buffer_size, int readers, size_t read_size)
+{
+    struct list *plist = get_paths(index_file);
+    image_stream *s = calloc(1, sizeof(image_stream));
+    s->shards = plist->size;
+    s->files = (char **)list_to_array(plist);
+    free_list(plist);
+    if(s->shards == 0){
+        fprintf(stderr, "%s: no shards\n", index_file);
+        exit(-1);
+    }
+    for(int i = 0; i < s->shards; ++i){
+        image_pack_header header;
+        read_stream_header(s->files[i], &header);
+        if(i == 0){
+            s->w = header.w;
+            s->h = header.h;
+            s->c = header.c;
+            s->record_size = header.record_size;
+        } else if(header.w != s->w || header.h != s->h || header.c != s->c){
+            fprintf(stderr, "%s: images are %dx%dx%d, the first shard has %dx%dx%d\n", s->files[i],
+                    header.w, header.h, header.c, s->w, s->h, s->c);
+            exit(-1);
+        }
+        s->count += header.count;
+    }
+    s->capacity = buffer_size / s->record_size;
+    if(s->capacity > s->count) s->capacity = s->count;
+    if(s->capacity < 1) s->capacity = 1;
+    s->records = calloc(s->capacity, s->record_size);
+    s->labels = calloc(s->capacity, sizeof(int));
+    s->readers = readers < 1 ? 1 : readers;
+    s->read_size = read_size < s->record_size ? s->record_size : read_size;
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->not_full, NULL);
+    pthread_cond_init(&s->not_empty, NULL);
+    fprintf(stderr, "%s: %d images %dx%dx%d in %d shards, streamed into a shuffle buffer of %d images (%.0f MB)\n",
+            index_file, s->count, s->w, s->h, s->c, s->shards, s->capacity,
+            (double)s->capacity * s->record_size / 1024.0 / 1024.0);
+    return s;
+}
+
+// copy n records of a shard into the shuffle buffer, waiting while it is full; 0 once the stream is stopped
+static int push_records(image_stream *s, const unsigned char *records, const int *labels, int n)
+{
+    pthread_mutex_lock(&s->mutex);
+    for(int k = 0; k < n; ){
+        while(!s->stop && s->filled == s->capacity) pthread_cond_wait(&s->not_full, &s->mutex);
+        if(s->stop) break;
+        int num = s->capacity - s->filled < n - k ? s->capacity - s->filled : n - k;
+        memcpy(s->records + (size_t)s->filled * s->record_size, records + (size_t)k * s->record_size,
+               (size_t)num * s->record_size);
+        memcpy(s->labels + s->filled, labels + k, num * sizeof(int));
+        s->filled += num;
+        k += num;
+        pthread_cond_broadcast(&s->not_empty);
+    }
+    int running = !s->stop;
+    pthread_mutex_unlock(&s->mutex);
+    return running;
+}
+
+static void *image_stream_reader(void *args)
+{
+    image_stream *s = (image_stream *)args;
+    int chunk_records = s->read_size / s->record_size;
+    unsigned char *chunk = malloc((size_t)chunk_records * s->record_size);
+    int *labels = NULL;
+    int running = 1;
+    while(running){
+        int shard;
+        sampler_next(s->shard_order, &shard, 1);
+        char *filename = s->files[shard];
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0) file_error(filename);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        image_pack_header header;
+        read_fully(fd, &header, sizeof(header), 0, filename);
+        labels = realloc(labels, (header.count ? header.count : 1) * sizeof(int));
+        read_fully(fd, labels, header.count * sizeof(int), header.labels_offset, filename);
+        for(int first = 0; running && first < header.count; first += chunk_records){
+            int num = header.count - first < chunk_records ? header.count - first : chunk_records;
+            off_t offset = header.data_offset + (size_t)first * s->record_size;
+            size_t size = (size_t)num * s->record_size;
+            posix_fadvise(fd, offset + size, s->read_size, POSIX_FADV_WILLNEED);     // the next read ahead
+            read_fully(fd, chunk, size, offset, filename);
+            __sync_fetch_and_add(&s->bytes_read, size);
+            running = push_records(s, chunk, labels + first, num);
+        }
+        close(fd);
+    }
+    free_ptr(chunk);
+    free_ptr(labels);
+    return 0;
+}
+
+/* start the readers; the shards of an epoch are split between the replicas, and seen (net->seen) skips the shards
+ * a run that is resumed has already read, roughly, as the buffer order is not kept */
+void start_image_stream(image_stream *s, uint64_t seed, int replica, int replicas, uint64_t seen)
+{
+    s->shard_order = make_sampler(s->shards, seed, replica, replicas);
+    sampler_seek(s->shard_order, seen * s->shards / s->count);
+    s->pick = seed ^ ((uint64_t)replica << 32);
+    s->reader_ids = calloc(s->readers, sizeof(pthread_t));
+    for(int i = 0; i < s->readers; ++i){
+        if(pthread_create(s->reader_ids + i, NULL, image_stream_reader, s)) error("image stream: thread creation failed");
+    }
+}
+
+/* batch_size random records of the shuffle buffer, the first batch waits until the buffer is full; position numbers
+ * the samples for their augmentation streams as with a sampler, which records are in the buffer depends on the timing
+ * of the readers */
+void image_stream_batch(image_stream *s, batch *b, uint64_t position, int batch_size, float hue, float saturation,
+                        float exposure, int flip, float mean_value, float scale)
+{
+    int image_size = s->w * s->h * s->c;
+    reserve_batch(b, batch_size, s->w, s->h, s->c);
+    unsigned char *pixels = load_scratch_bytes(get_load_scratch(batch_size), (size_t)batch_size * s->record_size);
+    pthread_mutex_lock(&s->mutex);
+    while(!s->warm && s->filled < s->capacity) pthread_cond_wait(&s->not_empty, &s->mutex);
+    s->warm = 1;
+    for(int i = 0; i < batch_size; ++i){
+        while(s->filled == 0) pthread_cond_wait(&s->not_empty, &s->mutex);
+        int j = splitmix64(&s->pick) % s->filled;
+        memcpy(pixels + (size_t)i * s->record_size, s->records + (size_t)j * s->record_size, s->record_size);
+        b->truth_label_index[i] = s->labels[j];
+        s->filled -= 1;
+        if(j != s->filled){     // the last record takes the free slot
+            memcpy(s->records + (size_t)j * s->record_size, s->records + (size_t)s->filled * s->record_size,
+                   s->record_size);
+            s->labels[j] = s->labels[s->filled];
+        }
+        pthread_cond_broadcast(&s->not_full);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    #pragma omp parallel for
+    for(int i = 0; i < batch_size; ++i){
+        augment_args a = make_augment_args(s->w, s->h);
+        rand_stream((position + i) * s->shard_order->replicas + s->shard_order->replica);
+        if(flip) a.flip = rand_int(0, 1);
+        random_augment_color(&a, hue, saturation, exposure);
+        a.mean_value = mean_value;
+        a.scale = scale;
+        augment_image_into(pixels + (size_t)i * s->record_size, s->w, s->h, s->c, 1, a,
+                           b->data + (size_t)i * image_size);
+    }
+}
+
+void free_image_stream(image_stream *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->not_full);
+    pthread_mutex_unlock(&s->mutex);
+    if(s->reader_ids){
+        for(int i = 0; i < s->readers; ++i) pthread_join(s->reader_ids[i], NULL);
+    }
+    if(s->shard_order) free_sampler(s->shard_order);
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->not_full);
+    pthread_cond_destroy(&s->not_empty);
+    free_ptrs((void **)s->files, s->shards);
+    free_ptr(s->reader_ids);
+    free_ptr(s->records);
+    free_ptr(s->labels);
+    free_ptr(s);
+}
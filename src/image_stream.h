@@ -0,0 +1,39 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "data.h"
+#include "sampler.h"
+
+/* Training from image pack shards that do not fit in memory. Reader threads each stream a whole shard at a time
+ * with large sequential reads and read-ahead, several shards at once, into a bounded shuffle buffer of records; a
+ * batch takes random records out of the buffer and the readers refill it. The shard order is a new permutation
+ * every epoch (a sampler over the shards), so samples are shuffled across shards within the window of the buffer
+ * while the disks only see sequential reads */
+typedef struct{
+    int w, h, c, count, shards;
+    size_t record_size;
+    char **files;               // [shards]
+    size_t read_size;           // bytes per read
+    int capacity, filled;       // records the shuffle buffer holds at most, holds now
+    int warm;                   // 1 once the buffer was full, draws wait for that first
+    unsigned char *records;     // [capacity][record_size]
+    int *labels;                // [capacity]
+    sampler *shard_order;
+    uint64_t pick;              // splitmix64 state of the record picks
+    int readers, stop;
+    pthread_t *reader_ids;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_full, not_empty;
+    uint64_t bytes_read;
+} image_stream;
+
+image_stream *open_image_stream(char *index_file, size_t buffer_size, int readers, size_t read_size);
+void start_image_stream(image_stream *s, uint64_t seed, int replica, int replicas, uint64_t seen);
+void image_stream_batch(image_stream *s, batch *b, uint64_t position, int batch_size, float hue, float saturation,
+                        float exposure, int flip, float mean_value, float scale);
+void free_image_stream(image_stream *s);
+
+#endif
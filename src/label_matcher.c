@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "label_matcher.h"
+#include "utils.h"
+
+static size_t label_matcher_slot(const label_matcher *m, uint64_t key)
+{
+    uint64_t x = key * 0x9e3779b97f4a7c15ULL;
+    return (x ^ (x >> 29)) & (m->capacity - 1);
+}
+
+// the child of state on byte c, -1: none
+static int label_matcher_goto(const label_matcher *m, int state, unsigned char c)
+{
+    uint64_t key = ((uint64_t)state << 8) | c;
+    for(size_t i = label_matcher_slot(m, key); m->keys[i]; i = (i + 1) & (m->capacity - 1)){
+        if(m->keys[i] == key) return m->next[i];
+    }
+    return -1;
+}
+
+static void label_matcher_set(label_matcher *m, int state, unsigned char c, int child)
+{
+    uint64_t key = ((uint64_t)state << 8) | c;
+    size_t i = label_matcher_slot(m, key);
+    while(m->keys[i]) i = (i + 1) & (m->capacity - 1);
+    m->keys[i] = key;
+    m->next[i] = child;
+}
+
+label_matcher *make_label_matcher(char **labels, int classes)
+{
+    size_t chars = 0;
+    for(int i = 0; i < classes; ++i) chars += strlen(labels[i]);
+    label_matcher *m = calloc(1, sizeof(label_matcher));
+    m->capacity = 16;
+    while(m->capacity < 2 * (chars + 1)) m->capacity *= 2;
+    m->keys = calloc(m->capacity, sizeof(uint64_t));
+    m->next = calloc(m->capacity, sizeof(int));
+    m->fail = calloc(chars + 1, sizeof(int));
+    m->best = calloc(chars + 1, sizeof(int));
+    int *first_child = calloc(chars + 1, sizeof(int));     // child lists for the breadth first pass, 0: none
+    int *sibling = calloc(chars + 1, sizeof(int));
+    unsigned char *byte = calloc(chars + 1, 1);
+    m->states = 1;
+    m->best[0] = -1;
+    for(int i = 0; i < classes; ++i){
+        int s = 0;
+        for(const unsigned char *p = (const unsigned char *)labels[i]; *p; ++p){
+            int child = label_matcher_goto(m, s, *p);
+            if(child < 0){
+                child = m->states++;
+                m->best[child] = -1;
+                byte[child] = *p;
+                sibling[child] = first_child[s];
+                first_child[s] = child;
+                label_matcher_set(m, s, *p, child);
+            }
+            s = child;
+        }
+        if(m->best[s] < 0) m->best[s] = i;
+    }
+
+    int *queue = calloc(m->states, sizeof(int));
+    int head = 0, tail = 0;
+    for(int v = first_child[0]; v; v = sibling[v]) queue[tail++] = v;
+    while(head < tail){
+        int u = queue[head++];
+        int b = m->best[m->fail[u]];
+        if(b >= 0 && (m->best[u] < 0 || b < m->best[u])) m->best[u] = b;
+        for(int v = first_child[u]; v; v = sibling[v]){
+            int f = m->fail[u];
+            int g;
+            while((g = label_matcher_goto(m, f, byte[v])) < 0 && f) f = m->fail[f];
+            m->fail[v] = g < 0 ? 0 : g;
+            queue[tail++] = v;
+        }
+    }
+    free_ptr(queue);
+    free_ptr(first_child);
+    free_ptr(sibling);
+    free_ptr(byte);
+    return m;
+}
+
+// index of the first label that is a substring of s, -1: none
+int match_label(const label_matcher *m, const char *s)
+{
+    int best = m->best[0];
+    int state = 0;
+    for(const unsigned char *p = (const unsigned char *)s; *p && best != 0; ++p){
+        int g;
+        while((g = label_matcher_goto(m, state, *p)) < 0 && state) state = m->fail[state];
+        state = g < 0 ? 0 : g;
+        int b = m->best[state];
+        if(b >= 0 && (best < 0 || b < best)) best = b;
+    }
+    return best;
+}
+
+void free_label_matcher(label_matcher *m)
+{
+    free_ptr(m->fail);
+    free_ptr(m->best);
+    free_ptr(m->keys);
+    free_ptr(m->next);
+    free_ptr(m);
+}
@@ -0,0 +1,24 @@
+#ifndef LABEL_MATCHER_H
+#define LABEL_MATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Aho-Corasick automaton over the class labels: one pass over a path finds the first label, in label order, that
+ * occurs in it, the same answer as trying strstr with every label like fill_truth but in O(path length). The
+ * transitions of the trie are kept in one open addressing table keyed by state and byte, so tens of thousands of
+ * labels stay small */
+typedef struct{
+    int states;
+    int *fail;          // [states], longest proper suffix that is also a trie state
+    int *best;          // [states], smallest label index ending here or along the fail chain, -1: none
+    uint64_t *keys;     // [capacity], state << 8 | byte, 0: empty
+    int *next;          // [capacity]
+    size_t capacity;
+} label_matcher;
+
+label_matcher *make_label_matcher(char **labels, int classes);
+int match_label(const label_matcher *m, const char *s);
+void free_label_matcher(label_matcher *m);
+
+#endif
@@ -1,5 +1,9 @@
 #include "network.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_custom(char *filename, int batch, int time_steps);
 
 network *make_network(int n)
 {
@@ -26,7 +30,12 @@ network *make_network(int n)
 
 network *load_network(char *cfg, char *weights)
 {
-    network *net = parse_network_cfg(cfg);
+    return load_network_custom(cfg, weights, 0, 0);
+}
+
+network *load_network_custom(char *cfg, char *weights, int batch, int time_steps)
+{
+    network *net = parse_network_cfg_custom(cfg, batch, time_steps);
     if(weights && weights[0] != 0){
         load_weights(net, weights);
     }
@@ -40,6 +49,8 @@ void free_network(network *net)
             free_convolutional_layer(net->layers[i]);
         } else if(net->layers_type[i] == CONNECTED){
             free_connected_layer(net->layers[i]);
+        } else if(net->layers_type[i] == EMBEDDING){
+            free_embedding_layer(net->layers[i]);
         } else if(net->layers_type[i] == RNN){
             free_rnn_layer(net->layers[i]);
         } else if(net->layers_type[i] == LSTM){
@@ -118,6 +129,12 @@ void free_network(network *net)
             if(layer->loss_gpu) cuda_free(layer->loss_gpu);
 #endif
             free_ptr(layer);
+        } else if(net->layers_type[i] == HSOFTMAX){
+            free_hsoftmax_layer(net->layers[i]);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            free_sampled_softmax_layer(net->layers[i]);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            free_partial_fc_layer(net->layers[i]);
         } else if(net->layers_type[i] == COST){
             cost_layer *layer = (cost_layer *)net->layers[i];
             if(layer->output) free_ptr(layer->output);
@@ -178,9 +195,120 @@ float update_current_learning_rate(network *net)
     }
 }
 
+static int is_recurrent_layer(const network *net, int i)
+{
+    return net->layers_type[i] == RNN || net->layers_type[i] == LSTM || net->layers_type[i] == GRU;
+}
+
+// number of consecutive recurrent layers from layer first, up to last
+static int recurrent_layers(const network *net, int first, int last)
+{
+    int n = 0;
+    while(first + n <= last && is_recurrent_layer(net, first + n)) ++n;
+    return n;
+}
+
+/* the cores are split between the n layers of the wavefront, the loops of a layer run on its group through
+ * set_thread_group; returns the active levels to restore with end_wavefront */
+static int begin_wavefront(int n, int *group)
+{
+    int levels = 1;
+#ifdef _OPENMP
+    levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    *group = omp_get_num_procs() / n > 0 ? omp_get_num_procs() / n : 1;
+#else
+    *group = 1;
+#endif
+    return levels;
+}
+
+static void end_wavefront(int levels)
+{
+#ifdef _OPENMP
+    omp_set_max_active_levels(levels);
+#endif
+}
+
+static void forward_recurrent_step(network *net, int i, float *input, int step)
+{
+    if(net->layers_type[i] == RNN) forward_rnn_layer_step((rnn_layer *)net->layers[i], input, step, net->test);
+    else if(net->layers_type[i] == LSTM) forward_lstm_layer_step((lstm_layer *)net->layers[i], input, step, net->test);
+    else forward_gru_layer_step((gru_layer *)net->layers[i], input, step, net->test);
+}
+
+static void backward_recurrent_step(network *net, int i, float *input, float *delta, int step)
+{
+    if(net->layers_type[i] == RNN) backward_rnn_layer_step((rnn_layer *)net->layers[i], input, delta, step, net->test);
+    else if(net->layers_type[i] == LSTM) backward_lstm_layer_step((lstm_layer *)net->layers[i], input, delta, step, net->test);
+    else backward_gru_layer_step((gru_layer *)net->layers[i], input, delta, step, net->test);
+}
+
+/* n stacked recurrent layers from layer first as a wavefront: at diagonal d layer first+k runs step d-k, so step t
+ * of a layer runs at the same time as step t-1 of the layer above it, each layer on its own group of cores */
+static void forward_recurrent_wavefront(network *net, int first, int n, float *input)
+{
+    for(int k = 0; k < n; ++k){
+        int i = first + k;
+        float *delta = get_network_layer_data(net, i, 1, 0);
+        fill_cpu(get_network_output_size_layer(net, i) * net->batch * net->time_steps, 0, delta, 1);
+        if(net->layers_type[i] == RNN) forward_rnn_layer_begin((rnn_layer *)net->layers[i], net->test);
+        else if(net->layers_type[i] == LSTM) forward_lstm_layer_begin((lstm_layer *)net->layers[i], net->test);
+        else forward_gru_layer_begin((gru_layer *)net->layers[i], net->test);
+    }
+    int group;
+    int levels = begin_wavefront(n, &group);
+    for(int d = 0; d < net->time_steps + n - 1; ++d){
+        #pragma omp parallel for num_threads(n)
+        for(int k = 0; k < n; ++k){
+            int step = d - k;
+            if(step < 0 || step >= net->time_steps) continue;
+            set_thread_group(group);
+            float *x = (k == 0) ? input : get_network_layer_data(net, first + k - 1, 0, 0);
+            forward_recurrent_step(net, first + k, x, step);
+            set_thread_group(0);
+        }
+    }
+    end_wavefront(levels);
+}
+
+/* backward of the wavefront from the top layer down. A layer lags two steps behind the layer above: step t of a
+ * layer writes the delta of step t-1 of the layer below, which the layer above writes at step t-1 */
+static void backward_recurrent_wavefront(network *net, int first, int n, float *input, float *delta)
+{
+    for(int k = 0; k < n; ++k){
+        int i = first + k;
+        if(net->layers_type[i] == RNN) backward_rnn_layer_begin((rnn_layer *)net->layers[i]);
+        else if(net->layers_type[i] == LSTM) backward_lstm_layer_begin((lstm_layer *)net->layers[i]);
+    }
+    int group;
+    int levels = begin_wavefront(n, &group);
+    for(int d = 0; d < net->time_steps + 2*(n - 1); ++d){
+        #pragma omp parallel for num_threads(n)
+        for(int k = 0; k < n; ++k){
+            int i = first + n - 1 - k;
+            int step = net->time_steps - 1 - (d - 2*k);
+            if(step < 0 || step >= net->time_steps) continue;
+            set_thread_group(group);
+            float *x = (i == first) ? input : get_network_layer_data(net, i - 1, 0, 0);
+            float *dx = (i == first) ? delta : get_network_layer_data(net, i - 1, 1, 0);
+            backward_recurrent_step(net, i, x, dx, step);
+            set_thread_group(0);
+        }
+    }
+    end_wavefront(levels);
+}
+
 void forward_network(network *net, float *input)
 {
     for(int i = 0; i < net->n && i <= net->output_layer; ++i){
+        int n = net->wavefront ? recurrent_layers(net, i, net->output_layer) : 0;
+        if(n > 1){
+            forward_recurrent_wavefront(net, i, n, input);
+            i += n - 1;
+            input = get_network_layer_data(net, i, 0, 0);
+            continue;
+        }
         if(net->layers_type[i] == CONVOLUTIONAL){
             //memset(net->workspace, 0, net->workspace_size);
             convolutional_layer *layer = (convolutional_layer *)net->layers[i];
@@ -192,9 +320,14 @@ void forward_network(network *net, float *input)
             if(layer->delta) fill_cpu(layer->outputs * layer->batch, 0, layer->delta, 1);
             forward_connected_layer(layer, input, net->test);
             input = layer->output;
+        }else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            if(layer->delta) fill_cpu(layer->outputs * layer->batch * layer->steps, 0, layer->delta, 1);
+            forward_embedding_layer(layer, net->input_index);
+            input = layer->output;
         }else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
-            if(layer->delta) fill_cpu(layer->outputs * layer->batch, 0, layer->delta, 1);
+            if(layer->delta) fill_cpu(layer->outputs * layer->batch * layer->steps, 0, layer->delta, 1);
             forward_rnn_layer(layer, input, net->test);
             input = layer->output;
         }else if(net->layers_type[i] == LSTM){
@@ -247,13 +380,25 @@ void forward_network(network *net, float *input)
             dropout_layer *layer = (dropout_layer *)net->layers[i];
             // dropout_layer reuse previous layer's delta
             // if(layer->delta) fill_cpu(layer->outputs * layer->batch, 0, layer->delta, 1);
-            forward_dropout_layer(layer, input, net->test);
+            forward_dropout_layer(layer, input, net->seen, i, net->test);
             input = layer->output;
         } else if(net->layers_type[i] == SOFTMAX){
             softmax_layer *layer = (softmax_layer *)net->layers[i];
             if(layer->delta) fill_cpu(layer->outputs * layer->batch, 0, layer->delta, 1);
             forward_softmax_layer(layer, input, net);
             input = layer->output;
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            forward_hsoftmax_layer(layer, input, net);
+            input = layer->output;
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            forward_sampled_softmax_layer(layer, input, net);
+            input = layer->output;
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            forward_partial_fc_layer(layer, input, net);
+            input = layer->output;
         } else if(net->layers_type[i] == COST){
             cost_layer *layer = (cost_layer *)net->layers[i];
             forward_cost_layer(layer, input, net);
@@ -282,6 +427,9 @@ void update_network(network *net)
         } else if(net->layers_type[i] == CONNECTED){
             connected_layer *layer = (connected_layer *)net->layers[i];
             update_connected_layer(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            update_embedding_layer(layer, net->learning_rate, net->momentum, net->decay);
         } else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
             update_rnn_layer(layer, net->learning_rate, net->momentum, net->decay);
@@ -300,6 +448,15 @@ void update_network(network *net)
         } else if(net->layers_type[i] == AVGPOOL){
         } else if(net->layers_type[i] == NORMALIZE){
         } else if(net->layers_type[i] == SOFTMAX){
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            update_hsoftmax_layer(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            update_sampled_softmax_layer(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            update_partial_fc_layer(layer, net->learning_rate, net->momentum, net->decay);
         } else if(net->layers_type[i] == COST){
         } else {
             printf("update_network layers_type error, layer: %d\n", i);
@@ -323,6 +480,12 @@ float *get_network_layer_data(network *net, int i, int data_type, int is_gpu)
             return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
         else
             return data_type == 0 ? layer->output : layer->delta;
+    } else if(net->layers_type[i] == EMBEDDING){
+        embedding_layer *layer = (embedding_layer *)net->layers[i];
+        if(is_gpu)
+            return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
+        else
+            return data_type == 0 ? layer->output : layer->delta;
     } else if(net->layers_type[i] == RNN){
         rnn_layer *layer = (rnn_layer *)net->layers[i];
         if(is_gpu)
@@ -395,6 +558,24 @@ float *get_network_layer_data(network *net, int i, int data_type, int is_gpu)
             return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
         else
             return data_type == 0 ? layer->output : layer->delta;
+    } else if(net->layers_type[i] == HSOFTMAX){
+        hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+        if(is_gpu)
+            return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
+        else
+            return data_type == 0 ? layer->output : layer->delta;
+    } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+        sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+        if(is_gpu)
+            return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
+        else
+            return data_type == 0 ? layer->output : layer->delta;
+    } else if(net->layers_type[i] == PARTIAL_FC){
+        partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+        if(is_gpu)
+            return data_type == 0 ? layer->output_gpu : layer->delta_gpu;
+        else
+            return data_type == 0 ? layer->output : layer->delta;
     } else if(net->layers_type[i] == COST){
         cost_layer *layer = (cost_layer *)net->layers[i];
         if(is_gpu)
@@ -412,6 +593,15 @@ void backward_network(network *net, float *input)
     float *prev_input;
     float *prev_delta;
     for(int i = net->n-1; i >= 0; --i){
+        int first = i;
+        while(net->wavefront && first > 0 && is_recurrent_layer(net, first) && is_recurrent_layer(net, first - 1)) --first;
+        if(first < i){
+            prev_input = (first == 0) ? input : get_network_layer_data(net, first-1, 0, 0);
+            prev_delta = (first == 0) ? 0 : get_network_layer_data(net, first-1, 1, 0);
+            backward_recurrent_wavefront(net, first, i - first + 1, prev_input, prev_delta);
+            i = first;
+            continue;
+        }
         if(i == 0){
             prev_input = input;
             prev_delta = 0;
@@ -435,6 +625,9 @@ void backward_network(network *net, float *input)
         } else if(net->layers_type[i] == CONNECTED){
             connected_layer *layer = (connected_layer *)net->layers[i];
             backward_connected_layer(layer, prev_input, prev_delta, net->test);
+        } else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            backward_embedding_layer(layer, net->input_index);
         } else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
             backward_rnn_layer(layer, prev_input, prev_delta, net->test);
@@ -471,6 +664,15 @@ void backward_network(network *net, float *input)
         } else if(net->layers_type[i] == SOFTMAX){
             softmax_layer *layer = (softmax_layer *)net->layers[i];
             if(i != 0) backward_softmax_layer(layer, prev_delta);
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            backward_hsoftmax_layer(layer, prev_input, prev_delta, net);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            backward_sampled_softmax_layer(layer, prev_input, prev_delta, net);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            backward_partial_fc_layer(layer, prev_input, prev_delta, net);
         } else if(net->layers_type[i] == COST){
             cost_layer *layer = (cost_layer *)net->layers[i];
             backward_cost_layer(layer, prev_delta);
@@ -509,9 +711,14 @@ void forward_network_gpu(network *net, float *input)
             if(layer->delta_gpu) fill_gpu(layer->outputs * layer->batch, 0, layer->delta_gpu, 1);
             forward_connected_layer_gpu(layer, input, net->test);
             input = layer->output_gpu;
+        }else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            if(layer->delta_gpu) fill_gpu(layer->outputs * layer->batch * layer->steps, 0, layer->delta_gpu, 1);
+            forward_embedding_layer_gpu(layer, net->input_index);
+            input = layer->output_gpu;
         }else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
-            if(layer->delta_gpu) fill_gpu(layer->outputs * layer->batch, 0, layer->delta_gpu, 1);
+            if(layer->delta_gpu) fill_gpu(layer->outputs * layer->batch * layer->steps, 0, layer->delta_gpu, 1);
             forward_rnn_layer_gpu(layer, input, net->test);
             input = layer->output_gpu;
         }else if(net->layers_type[i] == LSTM){
@@ -568,6 +775,18 @@ void forward_network_gpu(network *net, float *input)
             if(layer->delta_gpu) fill_gpu(layer->outputs * layer->batch, 0, layer->delta_gpu, 1);
             forward_softmax_layer_gpu(layer, input, net);
             input = layer->output_gpu;
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            forward_hsoftmax_layer_gpu(layer, input, net);
+            input = layer->output_gpu;
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            forward_sampled_softmax_layer_gpu(layer, input, net);
+            input = layer->output_gpu;
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            forward_partial_fc_layer_gpu(layer, input, net);
+            input = layer->output_gpu;
         } else if(net->layers_type[i] == COST){
             cost_layer *layer = (cost_layer *)net->layers[i];
             forward_cost_layer_gpu(layer, input, net);
@@ -599,6 +818,9 @@ void backward_network_gpu(network *net, float *input)
         } else if(net->layers_type[i] == CONNECTED){
             connected_layer *layer = (connected_layer *)net->layers[i];
             backward_connected_layer_gpu(layer, prev_input, prev_delta, net->test);
+        } else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            backward_embedding_layer_gpu(layer, net->input_index);
         } else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
             backward_rnn_layer_gpu(layer, prev_input, prev_delta, net->test);
@@ -635,6 +857,15 @@ void backward_network_gpu(network *net, float *input)
         } else if(net->layers_type[i] == SOFTMAX){
             softmax_layer *layer = (softmax_layer *)net->layers[i];
             if(i != 0) backward_softmax_layer_gpu(layer, prev_delta);
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            backward_hsoftmax_layer_gpu(layer, prev_delta, net);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            backward_sampled_softmax_layer_gpu(layer, prev_delta, net);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            backward_partial_fc_layer_gpu(layer, prev_delta, net);
         } else if(net->layers_type[i] == COST){
             cost_layer *layer = (cost_layer *)net->layers[i];
             backward_cost_layer_gpu(layer, prev_delta);
@@ -654,6 +885,9 @@ void update_network_gpu(network *net)
         } else if(net->layers_type[i] == CONNECTED){
             connected_layer *layer = (connected_layer *)net->layers[i];
             update_connected_layer_gpu(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == EMBEDDING){
+            embedding_layer *layer = (embedding_layer *)net->layers[i];
+            update_embedding_layer_gpu(layer, net->learning_rate, net->momentum, net->decay);
         } else if(net->layers_type[i] == RNN){
             rnn_layer *layer = (rnn_layer *)net->layers[i];
             update_rnn_layer_gpu(layer, net->learning_rate, net->momentum, net->decay);
@@ -672,6 +906,15 @@ void update_network_gpu(network *net)
         } else if(net->layers_type[i] == AVGPOOL){
         } else if(net->layers_type[i] == NORMALIZE){
         } else if(net->layers_type[i] == SOFTMAX){
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+            update_hsoftmax_layer(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+            update_sampled_softmax_layer(layer, net->learning_rate, net->momentum, net->decay);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+            update_partial_fc_layer(layer, net->learning_rate, net->momentum, net->decay);
         } else if(net->layers_type[i] == COST){
         } else {
             printf("update_network layers_type error, layer: %d\n", i);
@@ -685,27 +928,33 @@ void update_network_gpu(network *net)
 void train_network_detect(network *net, batch_detect d)
 {
     for(int i = 0; i < net->subdivisions; ++i){
-        memset(net->truth, 0, net->max_boxes * 5 * net->batch);
-        for(int j = 0; j < net->batch; ++j){
-            memcpy(net->input + j * d.X.cols, d.X.vals[i * net->batch + j], d.X.cols * sizeof(float));
-            memcpy(net->truth + j * d.y.cols, d.y.vals[i * net->batch + j], d.y.cols * sizeof(float));
-        }
+        // the rows of a detection batch are contiguous, a subdivision is used in place
+        float *input = d.X.vals[i * net->batch];
+        memcpy(net->truth, d.y.vals[i * net->batch], (size_t)net->batch * d.y.cols * sizeof(float));
 #ifdef GPU
-        cuda_push_array(net->input_gpu, net->input, net->h * net->w * net->c * net->batch);
+        cuda_push_array(net->input_gpu, input, net->h * net->w * net->c * net->batch);
         cuda_push_array(net->truth_gpu, net->truth, net->max_boxes * 5 * net->batch);
         forward_network_gpu(net, net->input_gpu);
         backward_network_gpu(net, net->input_gpu);
         if(net->subdivisions - 1 == i) update_network_gpu(net);
 #else
-        forward_network(net, net->input);
-        backward_network(net, net->input);
+        forward_network(net, input);
+        backward_network(net, input);
         if(net->subdivisions - 1 == i) update_network(net);
 #endif
+        net->seen += net->batch * net->time_steps;     // per subdivision, the random streams of the layers use it
     }
-    net->seen += net->batch * net->time_steps * net->subdivisions;
     net->batch_train += 1;
 }
 
+// rows with a negative truth are masked out of the loss, e.g. the steps a truncated bptt window repeats
+static int labelled_rows(const int *truth_label_index, int n)
+{
+    int count = 0;
+    for(int i = 0; i < n; ++i) count += truth_label_index[i] >= 0;
+    return count;
+}
+
 void train_network(network *net, float *input, int *truth_label_index)
 {
     if(net->accuracy_count > net->accuracy_count_max){
@@ -714,14 +963,14 @@ void train_network(network *net, float *input, int *truth_label_index)
     }
 
     for(int i = 0; i < net->subdivisions; ++i){
-        net->truth_label_index = truth_label_index + i * net->batch;
+        net->truth_label_index = truth_label_index + i * net->batch * net->time_steps;
 #ifdef GPU
         if(net->w == 0 || net->h == 0 || net->c == 0) {
             cuda_push_array(net->input_gpu, input + i * net->time_steps * net->batch * net->inputs, net->time_steps * net->batch * net->inputs);
         } else {
             cuda_push_array(net->input_gpu, input + i * net->h * net->w * net->c * net->batch, net->h * net->w * net->c * net->batch);
         }
-        cuda_push_array_int(net->truth_label_index_gpu, net->truth_label_index, net->batch);
+        cuda_push_array_int(net->truth_label_index_gpu, net->truth_label_index, net->batch * net->time_steps);
         forward_network_gpu(net, net->input_gpu);
         backward_network_gpu(net, net->input_gpu);
 
@@ -739,9 +988,37 @@ void train_network(network *net, float *input, int *truth_label_index)
         backward_network(net, input_data);
         update_network(net);
 #endif
+        net->seen += net->batch * net->time_steps;
     }
-    net->seen += net->batch * net->subdivisions * net->time_steps;
-    net->accuracy_count += net->batch;
+    net->accuracy_count += labelled_rows(truth_label_index, net->batch * net->time_steps);
+    net->batch_train += 1;
+}
+
+/* same as train_network for networks whose first layer is [embedding]:
+ * input_index holds one token id per step and batch row instead of one-hot floats */
+void train_network_index(network *net, int *input_index, int *truth_label_index)
+{
+    if(net->accuracy_count > net->accuracy_count_max){
+        net->accuracy_count = 0;
+        net->correct_num = 0;
+    }
+
+    for(int i = 0; i < net->subdivisions; ++i){
+        net->truth_label_index = truth_label_index + i * net->batch * net->time_steps;
+        net->input_index = input_index + i * net->time_steps * net->batch;
+#ifdef GPU
+        cuda_push_array_int(net->truth_label_index_gpu, net->truth_label_index, net->batch * net->time_steps);
+        forward_network_gpu(net, 0);
+        backward_network_gpu(net, 0);
+        update_network_gpu(net);
+#else
+        forward_network(net, 0);
+        backward_network(net, 0);
+        update_network(net);
+#endif
+        net->seen += net->batch * net->time_steps;
+    }
+    net->accuracy_count += labelled_rows(truth_label_index, net->batch * net->time_steps);
     net->batch_train += 1;
 }
 
@@ -817,6 +1094,16 @@ void forward_network_test(network *net, float *input)
 #endif
 }
 
+void forward_network_test_index(network *net, int *input_index)
+{
+    net->input_index = input_index;
+#ifdef GPU
+    forward_network_gpu(net, 0);
+#else
+    forward_network(net, 0);
+#endif
+}
+
 int get_network_output_size_layer(network *net, int i)
 {
     if(net->layers_type[i] == CONVOLUTIONAL){
@@ -825,6 +1112,9 @@ int get_network_output_size_layer(network *net, int i)
     } else if(net->layers_type[i] == CONNECTED){
         connected_layer *layer = (connected_layer *)net->layers[i];
         return layer->outputs;
+    } else if(net->layers_type[i] == EMBEDDING){
+        embedding_layer *layer = (embedding_layer *)net->layers[i];
+        return layer->outputs;
     } else if(net->layers_type[i] == RNN){
         rnn_layer *layer = (rnn_layer *)net->layers[i];
         return layer->outputs;
@@ -864,6 +1154,15 @@ int get_network_output_size_layer(network *net, int i)
     }else if(net->layers_type[i] == SOFTMAX){
         softmax_layer *layer = (softmax_layer *)net->layers[i];
         return layer->inputs;
+    }else if(net->layers_type[i] == HSOFTMAX){
+        hsoftmax_layer *layer = (hsoftmax_layer *)net->layers[i];
+        return layer->outputs;
+    }else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+        sampled_softmax_layer *layer = (sampled_softmax_layer *)net->layers[i];
+        return layer->outputs;
+    }else if(net->layers_type[i] == PARTIAL_FC){
+        partial_fc_layer *layer = (partial_fc_layer *)net->layers[i];
+        return layer->outputs;
     }else if(net->layers_type[i] == COST){
         cost_layer *layer = (cost_layer *)net->layers[i];
         return layer->outputs;
@@ -902,6 +1201,9 @@ image get_network_image_layer(network *net, int i)
     } else if(net->layers_type[i] == CONNECTED){
         connected_layer *layer = (connected_layer *)net->layers[i];
         return get_connected_image(layer);
+    } else if(net->layers_type[i] == EMBEDDING){
+        embedding_layer *layer = (embedding_layer *)net->layers[i];
+        return get_embedding_image(layer);
     } else if(net->layers_type[i] == RNN){
         rnn_layer *layer = (rnn_layer *)net->layers[i];
         return get_rnn_image(layer);
@@ -981,6 +1283,46 @@ void load_connected_weights(const connected_layer *l, FILE *fp, int gpu_index)
 #endif
 }
 
+// the lazily updated rows are caught up first, so the saved weights match dense updates
+void save_embedding_weights(embedding_layer *l, FILE *fp, const network *net)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        pull_embedding_layer(l);
+    }
+#endif
+    flush_embedding_layer(l);
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        push_embedding_layer(l);
+    }
+#endif
+    fwrite(l->weights, sizeof(float), l->inputs*l->outputs, fp);
+}
+
+void load_embedding_weights(const embedding_layer *l, FILE *fp, int gpu_index)
+{
+    fread(l->weights, sizeof(float), l->inputs*l->outputs, fp);
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_embedding_layer(l);
+    }
+#endif
+}
+
+// the parameters live on the host for both layers, the skipped rows are caught up before saving
+void save_softmax_rows_weights(float *biases, float *weights, int rows, int inputs, FILE *fp)
+{
+    fwrite(biases, sizeof(float), rows, fp);
+    fwrite(weights, sizeof(float), rows*inputs, fp);
+}
+
+void load_softmax_rows_weights(float *biases, float *weights, int rows, int inputs, FILE *fp)
+{
+    fread(biases, sizeof(float), rows, fp);
+    fread(weights, sizeof(float), rows*inputs, fp);
+}
+
 void save_weights(network *net, char *filename)
 {
 #ifdef GPU
@@ -1007,6 +1349,20 @@ void save_weights(network *net, char *filename)
             save_convolutional_weights((convolutional_layer *)net->layers[i], fp, net->gpu_index);
         } else if(net->layers_type[i] == CONNECTED){
             save_connected_weights((connected_layer *)net->layers[i], fp, net->gpu_index);
+        } else if(net->layers_type[i] == EMBEDDING){
+            save_embedding_weights((embedding_layer *)net->layers[i], fp, net);
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *l = (hsoftmax_layer *)net->layers[i];
+            flush_hsoftmax_layer(l);
+            save_softmax_rows_weights(l->biases, l->weights, l->hier->n, l->inputs, fp);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *l = (sampled_softmax_layer *)net->layers[i];
+            flush_sampled_softmax_layer(l);
+            save_softmax_rows_weights(l->biases, l->weights, l->outputs, l->inputs, fp);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *l = (partial_fc_layer *)net->layers[i];
+            flush_partial_fc_layer(l);
+            fwrite(l->weights, sizeof(float), l->outputs*l->inputs, fp);
         } else if(net->layers_type[i] == RNN){
             save_connected_weights((connected_layer *)((rnn_layer *)net->layers[i])->input_layer, fp, net->gpu_index);
             save_connected_weights((connected_layer *)((rnn_layer *)net->layers[i])->self_layer, fp, net->gpu_index);
@@ -1059,6 +1415,18 @@ void load_weights(network *net, char *filename)
             load_convolutional_weights((convolutional_layer *)net->layers[i], fp, net->gpu_index);
         } else if(net->layers_type[i] == CONNECTED){
             load_connected_weights((connected_layer *)net->layers[i], fp, net->gpu_index);
+        } else if(net->layers_type[i] == EMBEDDING){
+            load_embedding_weights((embedding_layer *)net->layers[i], fp, net->gpu_index);
+        } else if(net->layers_type[i] == HSOFTMAX){
+            hsoftmax_layer *l = (hsoftmax_layer *)net->layers[i];
+            load_softmax_rows_weights(l->biases, l->weights, l->hier->n, l->inputs, fp);
+        } else if(net->layers_type[i] == SAMPLED_SOFTMAX){
+            sampled_softmax_layer *l = (sampled_softmax_layer *)net->layers[i];
+            load_softmax_rows_weights(l->biases, l->weights, l->outputs, l->inputs, fp);
+        } else if(net->layers_type[i] == PARTIAL_FC){
+            partial_fc_layer *l = (partial_fc_layer *)net->layers[i];
+            fread(l->weights, sizeof(float), l->outputs*l->inputs, fp);
+            for(int k = 0; k < l->outputs; ++k) l->normalized_count[k] = -1;
         } else if(net->layers_type[i] == RNN){
             load_connected_weights((connected_layer *)((rnn_layer *)net->layers[i])->input_layer, fp, net->gpu_index);
             load_connected_weights((connected_layer *)((rnn_layer *)net->layers[i])->self_layer, fp, net->gpu_index);
@@ -1125,3 +1493,35 @@ void reset_gru_state(network *net, int b)
         }
     }
 }
+
+/* the next forward starts from the state after the given step of the last one instead of after its last step,
+ * for truncated bptt windows that overlap */
+void set_recurrent_state_step(network *net, int step)
+{
+    for(int i = 0; i < net->n; ++i){
+        if(net->layers_type[i] == RNN){
+            rnn_layer *layer = (rnn_layer *)net->layers[i];
+            int size = layer->outputs*layer->batch;
+            copy_cpu(size, layer->states + step*size, 1, layer->state, 1);
+#ifdef GPU
+            copy_gpu(size, layer->states_gpu + step*size, 1, layer->state_gpu, 1);
+#endif
+        } else if(net->layers_type[i] == LSTM){
+            lstm_layer *layer = (lstm_layer *)net->layers[i];
+            int size = layer->outputs*layer->batch;
+            copy_cpu(size, layer->cell_cpu + step*size, 1, layer->c_cpu, 1);
+            copy_cpu(size, layer->output + step*size, 1, layer->h_cpu, 1);
+#ifdef GPU
+            copy_gpu(size, layer->cell_gpu + step*size, 1, layer->c_gpu, 1);
+            copy_gpu(size, layer->output_gpu + step*size, 1, layer->h_gpu, 1);
+#endif
+        } else if(net->layers_type[i] == GRU){
+            gru_layer *layer = (gru_layer *)net->layers[i];
+            int size = layer->outputs*layer->batch;
+            copy_cpu(size, layer->output + step*size, 1, layer->state, 1);
+#ifdef GPU
+            copy_gpu(size, layer->output_gpu + step*size, 1, layer->state_gpu, 1);
+#endif
+        }
+    }
+}
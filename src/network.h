@@ -4,9 +4,12 @@
 #include "image.h"
 #include "data.h"
 #include "utils.h"
+#include "tree.h"
+#include "sparse_update.h"
 
 #include "convolutional_layer.h"
 #include "connected_layer.h"
+#include "embedding_layer.h"
 #include "rnn_layer.h"
 #include "lstm_layer.h"
 #include "gru_layer.h"
@@ -37,6 +40,7 @@ enum learning_rate_policy{
 enum LAYER_TYPE{
     CONVOLUTIONAL,
     CONNECTED,
+    EMBEDDING,
     RNN,
     LSTM,
     GRU,
@@ -47,6 +51,9 @@ enum LAYER_TYPE{
     NORMALIZE,
     DROPOUT,
     SOFTMAX,
+    HSOFTMAX,
+    SAMPLED_SOFTMAX,
+    PARTIAL_FC,
     COST,
     UPSAMPLE,
     YOLO,
@@ -78,6 +85,51 @@ typedef struct {
     float *loss, *loss_gpu, *cost;
 } softmax_layer;
 
+/* [connected] + [softmax] over a large number of classes, with lazily updated rows (sparse_update.h).
+ * Training only touches the classes on the path of the truth in the tree (hsoftmax) or the truth and the
+ * shared negative samples (sampled_softmax), without truth the output is the full class probability. */
+typedef struct {
+    int inputs, outputs, batch;   // outputs: classes
+    tree *hier;
+    int *class_node;   // class id -> tree leaf whose name is the class id
+    int path_size;     // the largest sum of group sizes on a leaf to root path
+    float lr_mult, lr_decay_mult, bias_mult, bias_decay_mult;
+    float *weights, *weight_updates, *biases, *bias_updates;   // one row per tree node
+    sparse_update *weight_update, *bias_update;
+    float *output, *delta, *prob, *node_prob, *input_cpu;   // delta: [batch][inputs], for the previous layer
+    float *cost;
+    float *output_gpu, *delta_gpu;
+} hsoftmax_layer;
+
+typedef struct {
+    int inputs, outputs, batch, samples;   // outputs: classes, ordered by decreasing frequency
+    int *sample_index;   // the negative samples of the batch, log-uniform over the classes
+    float lr_mult, lr_decay_mult, bias_mult, bias_decay_mult;
+    float *weights, *weight_updates, *biases, *bias_updates;   // one row per class
+    sparse_update *weight_update, *bias_update;
+    float *output, *delta, *prob, *input_cpu;   // delta: [batch][inputs], for the previous layer
+    float *cost;
+    float *output_gpu, *delta_gpu;
+} sampled_softmax_layer;
+
+/* weight normalized [connected] + AM-softmax [softmax] for a large number of identities (partial FC):
+ * each training step only uses the classes of the batch plus random negatives up to samples classes,
+ * the rows are normalized when read after they changed, and updated lazily (sparse_update.h) */
+typedef struct {
+    int inputs, outputs, batch, samples;   // outputs: classes
+    float label_specific_margin_bias;
+    int margin_scale;
+    float lr_mult, lr_decay_mult;
+    float *weights, *weight_updates;   // one row per class, kept normalized
+    int *normalized_count;   // per row: sparse_update count when the row was last normalized
+    sparse_update *weight_update;
+    int *class_slot, *sample_index, sample_num;   // the classes of this step, class_slot: class -> sample or -1
+    float *logits;   // [batch][samples], AM-softmax probability after forward
+    float *output, *delta, *input_cpu;   // delta: [batch][inputs], for the previous layer
+    float *cost;
+    float *output_gpu, *delta_gpu;
+} partial_fc_layer;
+
 typedef struct {
     int batch,inputs, outputs;
     float scale;
@@ -94,6 +146,8 @@ typedef struct {
     int max_batches, max_epoch; // max iteration times of batch
     size_t seen;    // the number of image processed
     int time_steps, inputs;  // for rnn layer, the inputs num of network
+    int wavefront;  // run stacked recurrent layers as a wavefront over the steps, cpu only
+    int bptt_k1;    // truncated bptt: steps a training window advances, time_steps is the window length
     int epoch;
     int batch_train;   // the number of batch trained
     int w, h, c, batch, subdivisions;  // net input data dimension
@@ -101,6 +155,7 @@ typedef struct {
     int classes;    // train data classes
     int *truth_label_index, *truth_label_index_gpu;
     float *input, *truth, *input_gpu, *truth_gpu;
+    int *input_index;  // token ids read by the [embedding] first layer, time_steps * batch
     int *is_not_max_gpu; // for counting correct rate in forward_softmax_layer_gpu
     float *workspace, *workspace_gpu;  // for convolutional_layer image reorder
     size_t workspace_size;
@@ -160,6 +215,43 @@ void forward_softmax_layer_gpu(softmax_layer *layer, float *input_gpu, network *
 void backward_softmax_layer_gpu(const softmax_layer *layer, float *delta_gpu);
 #endif
 
+hsoftmax_layer *make_hsoftmax_layer(int batch, int inputs, int outputs, char *tree_file, float lr_mult,
+                                    float lr_decay_mult, float bias_mult, float bias_decay_mult);
+void free_hsoftmax_layer(void *input);
+void forward_hsoftmax_layer(hsoftmax_layer *l, float *input, network *net);
+void backward_hsoftmax_layer(hsoftmax_layer *l, float *input, float *delta, network *net);
+void update_hsoftmax_layer(hsoftmax_layer *l, float learning_rate, float momentum, float decay);
+void flush_hsoftmax_layer(hsoftmax_layer *l);
+#ifdef GPU
+void forward_hsoftmax_layer_gpu(hsoftmax_layer *l, float *input_gpu, network *net);
+void backward_hsoftmax_layer_gpu(hsoftmax_layer *l, float *delta_gpu, network *net);
+#endif
+
+sampled_softmax_layer *make_sampled_softmax_layer(int batch, int inputs, int outputs, int samples, float lr_mult,
+                                                  float lr_decay_mult, float bias_mult, float bias_decay_mult);
+void free_sampled_softmax_layer(void *input);
+void forward_sampled_softmax_layer(sampled_softmax_layer *l, float *input, network *net);
+void backward_sampled_softmax_layer(sampled_softmax_layer *l, float *input, float *delta, network *net);
+void update_sampled_softmax_layer(sampled_softmax_layer *l, float learning_rate, float momentum, float decay);
+void flush_sampled_softmax_layer(sampled_softmax_layer *l);
+#ifdef GPU
+void forward_sampled_softmax_layer_gpu(sampled_softmax_layer *l, float *input_gpu, network *net);
+void backward_sampled_softmax_layer_gpu(sampled_softmax_layer *l, float *delta_gpu, network *net);
+#endif
+
+partial_fc_layer *make_partial_fc_layer(int batch, int inputs, int outputs, int samples,
+                                        float label_specific_margin_bias, int margin_scale, float lr_mult,
+                                        float lr_decay_mult);
+void free_partial_fc_layer(void *input);
+void forward_partial_fc_layer(partial_fc_layer *l, float *input, network *net);
+void backward_partial_fc_layer(partial_fc_layer *l, float *input, float *delta, network *net);
+void update_partial_fc_layer(partial_fc_layer *l, float learning_rate, float momentum, float decay);
+void flush_partial_fc_layer(partial_fc_layer *l);
+#ifdef GPU
+void forward_partial_fc_layer_gpu(partial_fc_layer *l, float *input_gpu, network *net);
+void backward_partial_fc_layer_gpu(partial_fc_layer *l, float *delta_gpu, network *net);
+#endif
+
 image get_route_image(const route_layer *layer);
 route_layer *make_route_layer(int batch, int n, int *input_layers, int *input_size, network *net);
 void forward_route_layer(const route_layer *l, network *net);
@@ -183,13 +275,17 @@ float *get_network_layer_data(network *net, int i, int data_type, int is_gpu);
 void reset_rnn_state(network *net, int b);
 void reset_lstm_state(network *net, int b);
 void reset_gru_state(network *net, int b);
+void set_recurrent_state_step(network *net, int step);
 network *make_network(int n);
 network *load_network(char *cfg, char *weights);
+network *load_network_custom(char *cfg, char *weights, int batch, int time_steps);
 void free_network(network *net);
 void train_network(network *net, float *input, int *truth_label_index);
+void train_network_index(network *net, int *input_index, int *truth_label_index);
 void train_network_detect(network *net, batch_detect d);
 void valid_network(network *net, float *input, int *truth_label_index);
 void forward_network_test(network *net, float *input);
+void forward_network_test_index(network *net, int *input_index);
 int get_network_output_size_layer(network *net, int i);
 image get_network_image_layer(network *net, int i);
 float update_current_learning_rate(network * net);
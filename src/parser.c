@@ -80,6 +80,23 @@ rnn_layer *parse_rnn(struct list *options, network *net, int count)
     return l;
 }
 
+embedding_layer *parse_embedding(struct list *options, network *net, int count)
+{
+    if(count != 0) error("[embedding] must be the first layer, it reads token ids instead of the previous layer");
+    int outputs = option_find_int(options, "output",1);
+    float lr_mult = option_find_float(options, "lr_mult", 1);
+    float lr_decay_mult = option_find_float(options, "lr_decay_mult", 1);
+    char *weight_filler_str = option_find_str(options, "weight_filler", "xavier");
+    int weight_filler = 1;
+    if(strcmp(weight_filler_str, "gaussian") == 0){
+        weight_filler = 2;
+    }
+    float sigma = option_find_float(options, "weight_filler_std", 1);
+    embedding_layer *l = make_embedding_layer(net->batch, net->inputs, outputs, net->time_steps, lr_mult, lr_decay_mult,
+                                              weight_filler, sigma);
+    return l;
+}
+
 lstm_layer *parse_lstm(struct list *options, network *net, int count)
 {
     int outputs = option_find_int(options, "output",1);
@@ -348,6 +365,46 @@ softmax_layer *parse_softmax(struct list *options, network *net, int count, int
     return layer;
 }
 
+hsoftmax_layer *parse_hsoftmax(struct list *options, network *net, int count)
+{
+    int input = get_network_output_size_layer(net, count-1);
+    char *tree_file = option_find_str(options, "tree", 0);
+    if(!tree_file) error("[hsoftmax] must have a tree file");
+    float lr_mult = option_find_float(options, "lr_mult", 1);
+    float lr_decay_mult = option_find_float(options, "lr_decay_mult", 0);
+    float bias_mult = option_find_float(options, "bias_mult", 2);
+    float bias_decay_mult = option_find_float(options, "bias_decay_mult", 0);
+    hsoftmax_layer *layer = make_hsoftmax_layer(net->batch, input, net->classes, tree_file, lr_mult, lr_decay_mult,
+                                                bias_mult, bias_decay_mult);
+    return layer;
+}
+
+sampled_softmax_layer *parse_sampled_softmax(struct list *options, network *net, int count)
+{
+    int input = get_network_output_size_layer(net, count-1);
+    int samples = option_find_int(options, "samples", 64);
+    float lr_mult = option_find_float(options, "lr_mult", 1);
+    float lr_decay_mult = option_find_float(options, "lr_decay_mult", 0);
+    float bias_mult = option_find_float(options, "bias_mult", 2);
+    float bias_decay_mult = option_find_float(options, "bias_decay_mult", 0);
+    sampled_softmax_layer *layer = make_sampled_softmax_layer(net->batch, input, net->classes, samples, lr_mult,
+                                                              lr_decay_mult, bias_mult, bias_decay_mult);
+    return layer;
+}
+
+partial_fc_layer *parse_partial_fc(struct list *options, network *net, int count)
+{
+    int input = get_network_output_size_layer(net, count-1);
+    int samples = option_find_int(options, "samples", 8192);
+    float label_specific_margin_bias = option_find_float(options, "label_specific_margin_bias", 0);
+    int margin_scale = option_find_int(options, "margin_scale", 0);
+    float lr_mult = option_find_float(options, "lr_mult", 1);
+    float lr_decay_mult = option_find_float(options, "lr_decay_mult", 0);
+    partial_fc_layer *layer = make_partial_fc_layer(net->batch, input, net->classes, samples,
+                                                    label_specific_margin_bias, margin_scale, lr_mult, lr_decay_mult);
+    return layer;
+}
+
 enum COST_TYPE get_cost_type(char *s)
 {
     if (strcmp(s, "sse")==0) return SSE;
@@ -487,6 +544,8 @@ void parse_net_options(struct list *options, network *net)
     //net->mean_value /= 255.0F;  // scale image to [0, 1] when load image
     net->scale = option_find_float(options, "scale", 0);
 
+    int seed = option_find_int(options, "seed", 0);    // 0: the seed of the program
+    if(seed) rand_seed(seed);
     net->max_batches = option_find_int(options, "max_batches", 0);
     net->max_epoch = option_find_int(options, "max_epoch", 0);
     net->batch = option_find_int(options, "batch", 0);
@@ -494,6 +553,14 @@ void parse_net_options(struct list *options, network *net)
     net->batch /= net->subdivisions;
     net->accuracy_count_max = option_find_int(options, "accuracy_count_max", 2000);
     net->time_steps = option_find_int(options, "time_steps", 1);
+    net->wavefront = option_find_int(options, "wavefront", 0);
+#ifdef GPU
+    if(net->wavefront) fprintf(stderr, "wavefront=1 runs on the cpu only, the gpu build ignores it\n");
+#endif
+    // truncated bptt: windows of bptt_k2 steps that advance by bptt_k1 steps, the loss is on the last bptt_k1 steps
+    int bptt_k2 = option_find_int(options, "bptt_k2", 0);
+    if(bptt_k2 > 0) net->time_steps = bptt_k2;
+    net->bptt_k1 = option_find_int(options, "bptt_k1", net->time_steps);
     char *policy_s = option_find_str(options, "policy", "constant");
     net->policy = get_policy(policy_s);
     if (net->policy == STEPS){
@@ -535,6 +602,13 @@ void parse_net_options(struct list *options, network *net)
 }
 
 network *parse_network_cfg(char *filename)
+{
+    return parse_network_cfg_custom(filename, 0, 0);
+}
+
+/* batch and time_steps > 0 override the values of the cfg file, e.g. to run a trained recurrent network one step at
+ * a time over a few streams */
+network *parse_network_cfg_custom(char *filename, int batch, int time_steps)
 {
     struct list *sections = read_cfg(filename);
     network *net = make_network(sections->size - 1);
@@ -543,15 +617,29 @@ network *parse_network_cfg(char *filename)
     if(!(strcmp(s->type, "[network]")==0)) error("First section must be [network]");
     struct list *options = s->options;
     parse_net_options(options, net);
+    if(batch > 0){
+        net->batch = batch;
+        net->subdivisions = 1;
+    }
+    if(time_steps > 0) net->time_steps = time_steps;
+    if(net->bptt_k1 <= 0 || net->bptt_k1 > net->time_steps) net->bptt_k1 = net->time_steps;
 
     float total_bflop = 0;
     n = n->next;
     int count = 0;
+    int step_batch = net->batch;
     fprintf(stderr, "layer                    input                 filters                          output\n");
     while(n){
         struct section *s = (struct section *)n->val;
         struct list *options = s->options;
         fprintf(stderr, "%3d: ", count);
+        // the layers around the recurrent ones see the rows of all the steps at once
+        if(strcmp(s->type, "[rnn]")==0 || strcmp(s->type, "[lstm]")==0 || strcmp(s->type, "[gru]")==0 ||
+           strcmp(s->type, "[embedding]")==0){
+            net->batch = step_batch;
+        } else {
+            net->batch = step_batch * net->time_steps;
+        }
         if(strcmp(s->type, "[convolutional]")==0){
             convolutional_layer *layer = parse_convolutional(options, net, count);
             total_bflop += layer->bflop;
@@ -561,6 +649,10 @@ network *parse_network_cfg(char *filename)
             connected_layer *layer = parse_connected(options, net, count);
             net->layers_type[count] = CONNECTED;
             net->layers[count] = layer;
+        } else if(strcmp(s->type, "[embedding]")==0){
+            embedding_layer *layer = parse_embedding(options, net, count);
+            net->layers_type[count] = EMBEDDING;
+            net->layers[count] = layer;
         } else if(strcmp(s->type, "[rnn]")==0){
             rnn_layer *layer = parse_rnn(options, net, count);
             net->layers_type[count] = RNN;
@@ -585,6 +677,19 @@ network *parse_network_cfg(char *filename)
             softmax_layer *layer = parse_softmax(options, net, count, sections->size - 1 - 1 == count);
             net->layers_type[count] = SOFTMAX;
             net->layers[count] = layer;
+        }else if(strcmp(s->type, "[hsoftmax]")==0 || strcmp(s->type, "[sampled_softmax]")==0 ||
+                 strcmp(s->type, "[partial_fc]")==0){
+            if(count == 0 || sections->size - 1 - 1 != count) error("softmax output layer must be the last layer");
+            if(strcmp(s->type, "[hsoftmax]")==0){
+                net->layers[count] = parse_hsoftmax(options, net, count);
+                net->layers_type[count] = HSOFTMAX;
+            } else if(strcmp(s->type, "[partial_fc]")==0){
+                net->layers[count] = parse_partial_fc(options, net, count);
+                net->layers_type[count] = PARTIAL_FC;
+            } else {
+                net->layers[count] = parse_sampled_softmax(options, net, count);
+                net->layers_type[count] = SAMPLED_SOFTMAX;
+            }
         }else if(strcmp(s->type, "[maxpool]")==0){
             maxpool_layer *layer = parse_maxpool(options, net, count);
             net->layers_type[count] = MAXPOOL;
@@ -628,19 +733,22 @@ network *parse_network_cfg(char *filename)
         ++count;
         n = n->next;
     }
+    net->batch = step_batch;
 
     net->input = (float *)malloc(net->h * net->w * net->c * net->batch * sizeof(float));
     net->max_boxes = 30;
     net->truth = calloc(1, net->max_boxes * 5 * net->batch * sizeof(float));
 #ifdef GPU
-    if(net->w == 0 || net->h == 0 || net->c == 0) {
+    if(net->layers_type[0] == EMBEDDING) {
+        net->input_gpu = 0;  // token ids are pushed by the embedding layer itself
+    } else if(net->w == 0 || net->h == 0 || net->c == 0) {
         net->input_gpu = cuda_make_array(0, net->time_steps * net->batch * net->inputs);
     } else {
         net->input_gpu = cuda_make_array(0, net->h * net->w * net->c * net->batch);
     }
     net->truth_gpu = cuda_make_array(0, net->max_boxes * 5 * net->batch);
-    net->truth_label_index_gpu = cuda_make_int_array(0, net->batch);
-    net->is_not_max_gpu = cuda_make_int_array(0, net->batch);
+    net->truth_label_index_gpu = cuda_make_int_array(0, net->batch * net->time_steps);
+    net->is_not_max_gpu = cuda_make_int_array(0, net->batch * net->time_steps);
     net->gpu_index = cuda_get_device();
 #endif
     if(net->workspace_size){
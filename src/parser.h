@@ -22,4 +22,5 @@
 
 struct list *read_data_cfg(char *filename);
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_custom(char *filename, int batch, int time_steps);
 #endif
@@ -0,0 +1,210 @@
+#include "network.h"
+
+partial_fc_layer *make_partial_fc_layer(int batch, int inputs, int outputs, int samples,
+                                        float label_specific_margin_bias, int margin_scale, float lr_mult,
+                                        float lr_decay_mult)
+{
+    if(samples > outputs) samples = outputs;
+    if(samples < batch) samples = batch < outputs ? batch : outputs;  // room for all the positive classes
+    fprintf(stderr, "Partial FC:         %d inputs, %d outputs, %d samples, label_specific_margin_bias: %f, "
+            "margin_scale: %d\n", inputs, outputs, samples, label_specific_margin_bias, margin_scale);
+    partial_fc_layer *l = calloc(1, sizeof(partial_fc_layer));
+    l->batch = batch;
+    l->inputs = inputs;
+    l->outputs = outputs;
+    l->samples = samples;
+    l->label_specific_margin_bias = label_specific_margin_bias;
+    l->margin_scale = margin_scale;
+    l->lr_mult = lr_mult;
+    l->lr_decay_mult = lr_decay_mult;
+
+    l->weights = calloc(outputs*inputs, sizeof(float));
+    l->weight_updates = calloc(outputs*inputs, sizeof(float));
+    float scale = sqrtf(2.0F / inputs);
+    for(int i = 0; i < outputs*inputs; ++i) l->weights[i] = scale*rand_uniform(-1, 1);
+    l->normalized_count = calloc(outputs, sizeof(int));
+    for(int i = 0; i < outputs; ++i) l->normalized_count[i] = -1;
+    l->weight_update = make_sparse_update(outputs, inputs, samples);
+
+    l->class_slot = calloc(outputs, sizeof(int));
+    for(int i = 0; i < outputs; ++i) l->class_slot[i] = -1;
+    l->sample_index = calloc(samples, sizeof(int));
+    l->logits = calloc(batch*samples, sizeof(float));
+    l->output = calloc(batch*outputs, sizeof(float));
+    l->delta = calloc(batch*inputs, sizeof(float));
+    l->cost = calloc(1, sizeof(float));
+#ifdef GPU
+    l->input_cpu = calloc(batch*inputs, sizeof(float));
+    l->output_gpu = cuda_make_array(l->output, batch*outputs);
+    l->delta_gpu = cuda_make_array(l->delta, batch*inputs);
+#endif
+    return l;
+}
+
+void free_partial_fc_layer(void *input)
+{
+    partial_fc_layer *l = (partial_fc_layer *)input;
+    free_ptr(l->weights);
+    free_ptr(l->weight_updates);
+    free_ptr(l->normalized_count);
+    free_sparse_update(l->weight_update);
+    free_ptr(l->class_slot);
+    free_ptr(l->sample_index);
+    free_ptr(l->logits);
+    free_ptr(l->output);
+    free_ptr(l->delta);
+    free_ptr(l->cost);
+#ifdef GPU
+    free_ptr(l->input_cpu);
+    if(l->output_gpu) cuda_free(l->output_gpu);
+    if(l->delta_gpu) cuda_free(l->delta_gpu);
+#endif
+    free_ptr(l);
+}
+
+// bring row k up to date and normalize it if it changed since it was last normalized
+static float *partial_fc_row(partial_fc_layer *l, int k)
+{
+    float *w = l->weights + k*l->inputs;
+    sparse_update_catch_up(l->weight_update, l->weights, l->weight_updates, k);
+    if(l->normalized_count[k] != l->weight_update->count){
+        float sum = 1e-6;
+        for(int j = 0; j < l->inputs; ++j) sum += w[j]*w[j];
+        scal_cpu(l->inputs, 1.0F / sqrtf(sum), w, 1);
+        l->normalized_count[k] = l->weight_update->count;
+    }
+    return w;
+}
+
+// the same margin and scale as forward_softmax_layer in training, on a row of cosines
+static void partial_fc_margin(const partial_fc_layer *l, float *logits, int n, int truth)
+{
+    if(l->label_specific_margin_bias < -0.01 && logits[truth] > -l->label_specific_margin_bias){
+        logits[truth] += l->label_specific_margin_bias;
+    }
+    if(l->margin_scale > 0) scal_cpu(n, l->margin_scale, logits, 1);
+}
+
+static void sample_partial_fc_classes(partial_fc_layer *l, const int *truth)
+{
+    for(int i = 0; i < l->sample_num; ++i) l->class_slot[l->sample_index[i]] = -1;
+    l->sample_num = 0;
+    for(int b = 0; b < l->batch; ++b){
+        if(truth[b] < 0 || truth[b] >= l->outputs){
+            fprintf(stderr, "partial_fc layer: class %d out of range [0, %d)\n", truth[b], l->outputs);
+            exit(-1);
+        }
+        if(l->class_slot[truth[b]] < 0){
+            l->class_slot[truth[b]] = l->sample_num;
+            l->sample_index[l->sample_num++] = truth[b];
+        }
+    }
+    while(l->sample_num < l->samples){
+        int k = rand_size_t() % l->outputs;
+        if(l->class_slot[k] < 0){
+            l->class_slot[k] = l->sample_num;
+            l->sample_index[l->sample_num++] = k;
+        }
+    }
+}
+
+void forward_partial_fc_layer(partial_fc_layer *l, float *input, network *net)
+{
+    float loss = 0;
+    if(net->test == 0 && net->truth_label_index){    // 0: train, 1: valid
+        sample_partial_fc_classes(l, net->truth_label_index);
+        int n = l->sample_num;
+        // the class rows are split between the threads, each thread computes the cosines of its rows
+        #pragma omp parallel for
+        for(int i = 0; i < n; ++i){
+            float *w = partial_fc_row(l, l->sample_index[i]);
+            for(int b = 0; b < l->batch; ++b){
+                l->logits[b*n + i] = dot_cpu(l->inputs, w, 1, input + b*l->inputs, 1);
+            }
+        }
+        for(int b = 0; b < l->batch; ++b){
+            float *logits = l->logits + b*n;
+            int truth = l->class_slot[net->truth_label_index[b]];
+            partial_fc_margin(l, logits, n, truth);
+            if(max_index(logits, n) == truth) net->correct_num += 1;
+            softmax_cpu(logits, n, logits);
+            loss -= logf(fmaxf(logits[truth], FLT_MIN));
+        }
+    } else {
+        flush_partial_fc_layer(l);
+        gemm(0, 1, l->batch, l->outputs, l->inputs, 1, input, l->inputs, l->weights, l->inputs, 0, l->output, l->outputs);
+        for(int b = 0; b < l->batch; ++b){
+            float *output = l->output + b*l->outputs;
+            softmax_cpu(output, l->outputs, output);
+            if(net->truth_label_index){
+                int truth = net->truth_label_index[b];
+                if(max_index(output, l->outputs) == truth) net->correct_num += 1;
+                loss -= logf(fmaxf(output[truth], FLT_MIN));
+            }
+        }
+    }
+    l->cost[0] = loss;
+    net->loss = loss;
+}
+
+void backward_partial_fc_layer(partial_fc_layer *l, float *input, float *delta, network *net)
+{
+    int n = l->sample_num;
+    float scale = (l->margin_scale > 0) ? l->margin_scale : 1;
+    for(int b = 0; b < l->batch; ++b){
+        float *logits = l->logits + b*n;
+        int truth = l->class_slot[net->truth_label_index[b]];
+        for(int i = 0; i < n; ++i) logits[i] = scale * ((i == truth) - logits[i]);
+    }
+    #pragma omp parallel for
+    for(int i = 0; i < n; ++i){
+        float *weight_updates = l->weight_updates + l->sample_index[i]*l->inputs;
+        for(int b = 0; b < l->batch; ++b){
+            axpy_cpu(l->inputs, l->logits[b*n + i], input + b*l->inputs, 1, weight_updates, 1);
+        }
+    }
+    if(delta){
+        #pragma omp parallel for
+        for(int b = 0; b < l->batch; ++b){
+            for(int i = 0; i < n; ++i){
+                axpy_cpu(l->inputs, l->logits[b*n + i], l->weights + l->sample_index[i]*l->inputs, 1,
+                         delta + b*l->inputs, 1);
+            }
+        }
+    }
+    for(int i = 0; i < n; ++i) sparse_update_touch(l->weight_update, l->sample_index[i]);
+}
+
+void update_partial_fc_layer(partial_fc_layer *l, float learning_rate, float momentum, float decay)
+{
+    sparse_update_apply(l->weight_update, l->weights, l->weight_updates, -decay * l->lr_decay_mult * l->batch,
+                        learning_rate * l->lr_mult / l->batch, momentum);
+}
+
+void flush_partial_fc_layer(partial_fc_layer *l)
+{
+    for(int k = 0; k < l->outputs; ++k) partial_fc_row(l, k);
+}
+
+#ifdef GPU
+// the class rows live in host memory and are split between the host threads, like the yolo layer the input
+// is pulled to the host
+void forward_partial_fc_layer_gpu(partial_fc_layer *l, float *input_gpu, network *net)
+{
+    cuda_pull_array(input_gpu, l->input_cpu, l->batch*l->inputs);
+    forward_partial_fc_layer(l, l->input_cpu, net);
+    if(net->test != 0 || !net->truth_label_index){
+        cuda_push_array(l->output_gpu, l->output, l->batch*l->outputs);
+    }
+}
+
+void backward_partial_fc_layer_gpu(partial_fc_layer *l, float *delta_gpu, network *net)
+{
+    fill_cpu(l->batch*l->inputs, 0, l->delta, 1);
+    backward_partial_fc_layer(l, l->input_cpu, delta_gpu ? l->delta : 0, net);
+    if(delta_gpu){
+        cuda_push_array(l->delta_gpu, l->delta, l->batch*l->inputs);
+        axpy_gpu(l->batch*l->inputs, 1, l->delta_gpu, 1, delta_gpu, 1);
+    }
+}
+#endif
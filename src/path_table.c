@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "path_table.h"
+#include "label_matcher.h"
+#include "utils.h"
+
+static size_t path_table_align(size_t n)
+{
+    return (n + 7) / 8 * 8;
+}
+
+// one path per line, '\r' and blank lines dropped
+static path_table *scan_path_list(const char *text, size_t size)
+{
+    const char *end = text + size;
+    int count = 0;
+    for(const char *p = text; p < end; ){
+        const char *nl = memchr(p, '\n', end - p);
+        const char *e = nl ? nl : end;
+        if(e > p && e[-1] == '\r') --e;
+        if(e > p) ++count;
+        p = nl ? nl + 1 : end;
+    }
+    path_table *t = calloc(1, sizeof(path_table));
+    t->count = count;
+    char *arena = malloc(size + 1);
+    uint64_t *offset = calloc(count, sizeof(uint64_t));
+    int *length = calloc(count, sizeof(int));
+    size_t used = 0;
+    int i = 0;
+    for(const char *p = text; p < end; ){
+        const char *nl = memchr(p, '\n', end - p);
+        const char *e = nl ? nl : end;
+        if(e > p && e[-1] == '\r') --e;
+        if(e > p){
+            offset[i] = used;
+            length[i] = e - p;
+            memcpy(arena + used, p, e - p);
+            used += e - p;
+            arena[used++] = '\0';
+            ++i;
+        }
+        p = nl ? nl + 1 : end;
+    }
+    t->arena = arena;
+    t->arena_size = used;
+    t->offset = offset;
+    t->length = length;
+    return t;
+}
+
+path_table *load_path_table(char *filename)
+{
+    double time = what_time_is_it_now();
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(filename);
+    size_t size = st.st_size;
+    char *map = size ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+    path_table *t = NULL;
+    const path_table_header *header = (const path_table_header *)map;
+    if(size >= sizeof(path_table_header) && memcmp(header->magic, PATH_TABLE_MAGIC, 4) == 0){
+        size_t offsets = sizeof(path_table_header);
+        size_t lengths = offsets + (size_t)header->count * sizeof(uint64_t);
+        size_t arena = path_table_align(lengths + (size_t)header->count * sizeof(int));
+        if(header->version != PATH_TABLE_VERSION || size < arena + header->arena_size){
+            fprintf(stderr, "%s: not a path table of version %d\n", filename, PATH_TABLE_VERSION);
+            exit(-1);
+        }
+        t = calloc(1, sizeof(path_table));
+        t->count = header->count;
+        t->offset = (const uint64_t *)(map + offsets);
+        t->length = (const int *)(map + lengths);
+        t->arena = map + arena;
+        t->arena_size = header->arena_size;
+        t->map = map;
+        t->map_size = size;
+    } else {
+        madvise(map, size, MADV_SEQUENTIAL);
+        t = scan_path_list(map, size);
+        if(map) munmap(map, size);
+    }
+    fprintf(stderr, "%s: %d paths, %.2f s\n", filename, t->count, what_time_is_it_now() - time);
+    return t;
+}
+
+void save_path_table(const path_table *t, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    path_table_header header = {PATH_TABLE_MAGIC, PATH_TABLE_VERSION, t->count, 0, t->arena_size};
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(t->offset, sizeof(uint64_t), t->count, fp);
+    fwrite(t->length, sizeof(int), t->count, fp);
+    size_t written = sizeof(header) + (size_t)t->count * (sizeof(uint64_t) + sizeof(int));
+    uint64_t pad = 0;
+    fwrite(&pad, 1, path_table_align(written) - written, fp);
+    fwrite(t->arena, 1, t->arena_size, fp);
+    if(fclose(fp) != 0) file_error(filename);
+}
+
+// the class of every path, the first label that is a substring of it as in fill_truth, found once per dataset
+void resolve_path_labels(path_table *t, char **labels, int classes)
+{
+    double time = what_time_is_it_now();
+    label_matcher *m = make_label_matcher(labels, classes);
+    if(!t->label) t->label = calloc(t->count, sizeof(int));
+    int unmatched = 0;
+    #pragma omp parallel for reduction(+:unmatched)
+    for(int i = 0; i < t->count; ++i){
+        t->label[i] = match_label(m, table_path(t, i));
+        unmatched += t->label[i] < 0;
+    }
+    free_label_matcher(m);
+    fprintf(stderr, "%d labels resolved for %d paths, %d without a label, %.2f s\n", classes, t->count, unmatched,
+            what_time_is_it_now() - time);
+}
+
+void free_path_table(path_table *t)
+{
+    if(t->map){
+        munmap(t->map, t->map_size);
+    } else {
+        free_ptr((void *)t->arena);
+        free_ptr((void *)t->offset);
+        free_ptr((void *)t->length);
+    }
+    free_ptr(t->label);
+    free_ptr(t);
+}
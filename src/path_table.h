@@ -0,0 +1,41 @@
+#ifndef PATH_TABLE_H
+#define PATH_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The image paths of a list file in one arena of NUL terminated strings with an offset and a length per path, in
+ * place of a list of malloc'd lines. A text list is mapped and scanned once; `cnn paths` saves the table in a
+ * binary form that load_path_table maps as is, so a list of millions of images loads without parsing */
+#define PATH_TABLE_MAGIC "CNNL"
+#define PATH_TABLE_VERSION 1
+
+typedef struct{
+    char magic[4];
+    int version, count, pad;
+    uint64_t arena_size;
+} path_table_header;     // followed by offsets [count], lengths [count] padded to 8 bytes, the arena
+
+typedef struct{
+    int count;
+    const char *arena;
+    size_t arena_size;
+    const uint64_t *offset;     // [count]
+    const int *length;          // [count], without the NUL
+    void *map;                  // the mapped binary table, or NULL when the arrays are allocated
+    size_t map_size;
+    int *label;                 // [count], class of each path from resolve_path_labels, -1: no label matches; NULL
+                                // until resolved
+} path_table;
+
+static inline char *table_path(const path_table *t, int i)
+{
+    return (char *)t->arena + t->offset[i];
+}
+
+path_table *load_path_table(char *filename);
+void save_path_table(const path_table *t, char *filename);
+void resolve_path_labels(path_table *t, char **labels, int classes);
+void free_path_table(path_table *t);
+
+#endif
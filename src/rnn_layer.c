@@ -49,9 +49,11 @@ rnn_layer *make_rnn_layer(int batch, int inputs, int outputs, int steps, ACTIVAT
 
     l->state = calloc(batch*outputs, sizeof(float));
     l->prev_state = calloc(batch*outputs, sizeof(float));
+    l->states = calloc(batch*outputs*steps, sizeof(float));
 #ifdef GPU
     l->state_gpu = cuda_make_array(0, batch*outputs);
     l->prev_state_gpu = cuda_make_array(0, batch*outputs);
+    l->states_gpu = cuda_make_array(0, batch*outputs*steps);
     l->output_gpu = l->output_layer->output_gpu;
     l->delta_gpu = l->output_layer->delta_gpu;
 #endif
@@ -64,10 +66,12 @@ void free_rnn_layer(void *input)
     rnn_layer *layer = (rnn_layer *)input;
     if(layer->state) free_ptr(layer->state);
     if(layer->prev_state) free_ptr(layer->prev_state);
+    if(layer->states) free_ptr(layer->states);
     free_connected_layer(layer->input_layer);
     free_connected_layer(layer->self_layer);
     free_connected_layer(layer->output_layer);
 #ifdef GPU
+    if(layer->states_gpu) cuda_free(layer->states_gpu);
     if(layer->output_gpu) cuda_free(layer->output_gpu);
     if(layer->delta_gpu) cuda_free(layer->delta_gpu);
 #endif
@@ -81,84 +85,90 @@ void update_rnn_layer(const rnn_layer *l, float learning_rate, float momentum, f
     update_connected_layer(l->output_layer, learning_rate, momentum, decay);
 }
 
-void increment_layer(connected_layer *l, int steps)
-{
-    int num = l->outputs*l->batch*steps;
-    l->output += num;
-    l->delta += num;
-    if(l->x) l->x += num;
-    if(l->x_norm) l->x_norm += num;
-
-#ifdef GPU
-    l->output_gpu += num;
-    l->delta_gpu += num;
-    if(l->x_gpu) l->x_gpu += num;
-    if(l->x_norm_gpu) l->x_norm_gpu += num;
-#endif
-}
-
+/* only self_layer depends on the previous step, input_layer and output_layer run once over all steps */
 void forward_rnn_layer(const rnn_layer *l, float *input, int test)
 {
+    int size = l->outputs*l->batch;
     if(0 == test){    // 0: train, 1: valid
-        copy_cpu(l->outputs*l->batch, l->state, 1, l->prev_state, 1);
+        copy_cpu(size, l->state, 1, l->prev_state, 1);
     }
+    forward_connected_layer_steps(l->input_layer, input, l->steps, test);
     for (int i = 0; i < l->steps; ++i) {
-        forward_connected_layer(l->input_layer, input, test);
         forward_connected_layer(l->self_layer, l->state, test);
-        copy_cpu(l->outputs * l->batch, l->input_layer->output, 1, l->state, 1);
-        axpy_cpu(l->outputs * l->batch, 1, l->self_layer->output, 1, l->state, 1);
-
-        forward_connected_layer(l->output_layer, l->state, test);
-        input += l->inputs*l->batch;
-        increment_layer(l->input_layer, 1);
+        copy_cpu(size, l->input_layer->output + i*size, 1, l->state, 1);
+        axpy_cpu(size, 1, l->self_layer->output, 1, l->state, 1);
+        copy_cpu(size, l->state, 1, l->states + i*size, 1);
         increment_layer(l->self_layer, 1);
-        increment_layer(l->output_layer, 1);
     }
-    increment_layer(l->input_layer, -l->steps);  // restore the l->input_layer->output modify
     increment_layer(l->self_layer,  -l->steps);
-    increment_layer(l->output_layer,  -l->steps);
+    forward_connected_layer_steps(l->output_layer, l->states, l->steps, test);
 }
 
 void backward_rnn_layer(const rnn_layer *l, float *input, float *delta, int test)
 {
-    input = input + l->inputs*l->batch*l->steps;
-    if(delta){
-        delta = delta + l->inputs*l->batch*l->steps;
-    }
-    increment_layer(l->input_layer, l->steps);
+    int size = l->outputs*l->batch;
+    fill_cpu(size*l->steps, 0, l->self_layer->delta, 1);
+    backward_connected_layer_steps(l->output_layer, l->states, l->self_layer->delta, l->steps, test);
+
     increment_layer(l->self_layer, l->steps);
-    increment_layer(l->output_layer, l->steps);
-    float *last_input = l->input_layer->output - l->outputs*l->batch;
-    float *last_self = l->self_layer->output - l->outputs*l->batch;
     for(int i = l->steps-1; i >= 0; --i) {
-        increment_layer(l->input_layer, -1);
         increment_layer(l->self_layer, -1);
-        increment_layer(l->output_layer, -1);
-        input -= l->inputs*l->batch;
-        if(delta){
-            delta -= l->inputs*l->batch;
-        }
-        copy_cpu(l->outputs * l->batch, l->input_layer->output, 1, l->state, 1);
-        axpy_cpu(l->outputs * l->batch, 1, l->self_layer->output, 1, l->state, 1);
-        backward_connected_layer(l->output_layer, l->state, l->self_layer->delta, test);
-
-        if(i != 0) {
-            copy_cpu(l->outputs * l->batch, l->input_layer->output - l->outputs*l->batch, 1, l->state, 1);
-            axpy_cpu(l->outputs * l->batch, 1, l->self_layer->output - l->outputs*l->batch, 1, l->state, 1);
-        }else {
-            copy_cpu(l->outputs*l->batch, l->prev_state, 1, l->state, 1);
-        }
-        float *delta_self_layer = NULL;
-        if(i == 0) delta_self_layer = 0;
-        else delta_self_layer = l->self_layer->delta - l->outputs*l->batch;
-        backward_connected_layer(l->self_layer, l->state, delta_self_layer, test);
-
-        copy_cpu(l->outputs*l->batch, l->self_layer->delta, 1, l->input_layer->delta, 1);
-        backward_connected_layer(l->input_layer, input, delta, test);
+        float *prev_state = (i == 0) ? l->prev_state : l->states + (i-1)*size;
+        float *delta_self_layer = (i == 0) ? 0 : l->self_layer->delta - size;
+        backward_connected_layer(l->self_layer, prev_state, delta_self_layer, test);
+    }
+    copy_cpu(size*l->steps, l->self_layer->delta, 1, l->input_layer->delta, 1);
+    backward_connected_layer_steps(l->input_layer, input, delta, l->steps, test);
+}
+
+/* one step at a time, for the wavefront over stacked recurrent layers: the same as forward_rnn_layer and
+ * backward_rnn_layer, with input and delta of all the steps, but the steps of other layers can run in between */
+void forward_rnn_layer_begin(const rnn_layer *l, int test)
+{
+    if(0 == test){    // 0: train, 1: valid
+        copy_cpu(l->outputs*l->batch, l->state, 1, l->prev_state, 1);
     }
-    copy_cpu(l->outputs * l->batch, last_input, 1, l->state, 1);
-    axpy_cpu(l->outputs * l->batch, 1, last_self, 1, l->state, 1);
-    //printf("backward_rnn_layer %p\n", l->input_layer->output);
+}
+
+void forward_rnn_layer_step(const rnn_layer *l, float *input, int i, int test)
+{
+    int size = l->outputs*l->batch;
+    increment_layer(l->input_layer, i);
+    increment_layer(l->self_layer, i);
+    increment_layer(l->output_layer, i);
+    forward_connected_layer_steps(l->input_layer, input + i*l->inputs*l->batch, 1, test);
+    forward_connected_layer(l->self_layer, l->state, test);
+    copy_cpu(size, l->input_layer->output, 1, l->state, 1);
+    axpy_cpu(size, 1, l->self_layer->output, 1, l->state, 1);
+    copy_cpu(size, l->state, 1, l->states + i*size, 1);
+    forward_connected_layer_steps(l->output_layer, l->states + i*size, 1, test);
+    increment_layer(l->input_layer, -i);
+    increment_layer(l->self_layer, -i);
+    increment_layer(l->output_layer, -i);
+}
+
+void backward_rnn_layer_begin(const rnn_layer *l)
+{
+    fill_cpu(l->outputs*l->batch*l->steps, 0, l->self_layer->delta, 1);
+}
+
+// steps in reverse order
+void backward_rnn_layer_step(const rnn_layer *l, float *input, float *delta, int i, int test)
+{
+    int size = l->outputs*l->batch;
+    increment_layer(l->input_layer, i);
+    increment_layer(l->self_layer, i);
+    increment_layer(l->output_layer, i);
+    backward_connected_layer_steps(l->output_layer, l->states + i*size, l->self_layer->delta, 1, test);
+    float *prev_state = (i == 0) ? l->prev_state : l->states + (i-1)*size;
+    float *delta_self_layer = (i == 0) ? 0 : l->self_layer->delta - size;
+    backward_connected_layer(l->self_layer, prev_state, delta_self_layer, test);
+    copy_cpu(size, l->self_layer->delta, 1, l->input_layer->delta, 1);
+    backward_connected_layer_steps(l->input_layer, input + i*l->inputs*l->batch,
+                                   delta ? delta + i*l->inputs*l->batch : 0, 1, test);
+    increment_layer(l->input_layer, -i);
+    increment_layer(l->self_layer, -i);
+    increment_layer(l->output_layer, -i);
 }
 
 #ifdef GPU
@@ -186,68 +196,36 @@ void update_rnn_layer_gpu(const rnn_layer *l, float learning_rate, float momentu
 
 void forward_rnn_layer_gpu(const rnn_layer *l, float *input, int test)
 {
+    int size = l->outputs*l->batch;
     if(0 == test){    // 0: train, 1: valid
-        copy_gpu(l->outputs*l->batch, l->state_gpu, 1, l->prev_state_gpu, 1);
+        copy_gpu(size, l->state_gpu, 1, l->prev_state_gpu, 1);
     }
-
+    forward_connected_layer_steps_gpu(l->input_layer, input, l->steps, test);
     for(int i = 0; i < l->steps; ++i) {
-        forward_connected_layer_gpu(l->input_layer, input, test);
         forward_connected_layer_gpu(l->self_layer, l->state_gpu, test);
-
-        copy_gpu(l->outputs * l->batch, l->input_layer->output_gpu, 1, l->state_gpu, 1);
-        axpy_gpu(l->outputs * l->batch, 1, l->self_layer->output_gpu, 1, l->state_gpu, 1);
-
-        forward_connected_layer_gpu(l->output_layer, l->state_gpu, test);
-        input += l->inputs*l->batch;
-        increment_layer(l->input_layer, 1);
+        copy_gpu(size, l->input_layer->output_gpu + i*size, 1, l->state_gpu, 1);
+        axpy_gpu(size, 1, l->self_layer->output_gpu, 1, l->state_gpu, 1);
+        copy_gpu(size, l->state_gpu, 1, l->states_gpu + i*size, 1);
         increment_layer(l->self_layer, 1);
-        increment_layer(l->output_layer, 1);
     }
-    increment_layer(l->input_layer, -l->steps);  // restore the l->input_layer->output modify
     increment_layer(l->self_layer,  -l->steps);
-    increment_layer(l->output_layer,  -l->steps);
+    forward_connected_layer_steps_gpu(l->output_layer, l->states_gpu, l->steps, test);
 }
 
 void backward_rnn_layer_gpu(const rnn_layer *l, float *input, float *delta, int test)
 {
-    input = input + l->inputs*l->batch*l->steps;
-    if(delta){
-        delta = delta + l->inputs*l->batch*l->steps;
-    }
-    increment_layer(l->input_layer, l->steps);
-    increment_layer(l->self_layer, l->steps);
-    increment_layer(l->output_layer, l->steps);
+    int size = l->outputs*l->batch;
+    fill_gpu(size*l->steps, 0, l->self_layer->delta_gpu, 1);
+    backward_connected_layer_steps_gpu(l->output_layer, l->states_gpu, l->self_layer->delta_gpu, l->steps, test);
 
-    float *last_input = l->input_layer->output_gpu - l->outputs*l->batch;
-    float *last_self = l->self_layer->output_gpu - l->outputs*l->batch;
+    increment_layer(l->self_layer, l->steps);
     for(int i = l->steps-1; i >= 0; --i) {
-        increment_layer(l->input_layer, -1);
         increment_layer(l->self_layer, -1);
-        increment_layer(l->output_layer, -1);
-        input -= l->inputs*l->batch;
-        if(delta){
-            delta -= l->inputs*l->batch;
-        }   
-        copy_gpu(l->outputs * l->batch, l->input_layer->output_gpu, 1, l->state_gpu, 1);
-        axpy_gpu(l->outputs * l->batch, 1, l->self_layer->output_gpu, 1, l->state_gpu, 1);
-        backward_connected_layer_gpu(l->output_layer, l->state_gpu, l->self_layer->delta_gpu, test);
-
-        if(i != 0) {
-            copy_gpu(l->outputs * l->batch, l->input_layer->output_gpu - l->outputs*l->batch, 1, l->state_gpu, 1);
-            axpy_gpu(l->outputs * l->batch, 1, l->self_layer->output_gpu - l->outputs*l->batch, 1, l->state_gpu, 1);
-        }else {
-            copy_gpu(l->outputs*l->batch, l->prev_state_gpu, 1, l->state_gpu, 1);
-        }
-
-        float *delta_self_layer = NULL;
-        if(i == 0) delta_self_layer = 0;
-        else delta_self_layer = l->self_layer->delta_gpu - l->outputs*l->batch;
-        backward_connected_layer_gpu(l->self_layer, l->state_gpu, delta_self_layer, test);
-        
-        copy_gpu(l->outputs*l->batch, l->self_layer->delta_gpu, 1, l->input_layer->delta_gpu, 1);
-        backward_connected_layer_gpu(l->input_layer, input, delta, test);
+        float *prev_state = (i == 0) ? l->prev_state_gpu : l->states_gpu + (i-1)*size;
+        float *delta_self_layer = (i == 0) ? 0 : l->self_layer->delta_gpu - size;
+        backward_connected_layer_gpu(l->self_layer, prev_state, delta_self_layer, test);
     }
-    copy_gpu(l->outputs * l->batch, last_input, 1, l->state_gpu, 1);
-    axpy_gpu(l->outputs * l->batch, 1, last_self, 1, l->state_gpu, 1);
+    copy_gpu(size*l->steps, l->self_layer->delta_gpu, 1, l->input_layer->delta_gpu, 1);
+    backward_connected_layer_steps_gpu(l->input_layer, input, delta, l->steps, test);
 }
 #endif
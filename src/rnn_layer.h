@@ -15,8 +15,8 @@
 
 typedef struct{
     int inputs, outputs, batch, steps;
-    float *output, *delta, *state, *prev_state;
-    float *output_gpu, *delta_gpu, *state_gpu, *prev_state_gpu;
+    float *output, *delta, *state, *prev_state, *states;  // states: the state of every step, input of output_layer
+    float *output_gpu, *delta_gpu, *state_gpu, *prev_state_gpu, *states_gpu;
     connected_layer *input_layer, *self_layer, *output_layer;
 } rnn_layer;
 
@@ -26,6 +26,10 @@ void free_rnn_layer(void *input);
 void forward_rnn_layer(const rnn_layer *l, float *input, int test);
 void backward_rnn_layer(const rnn_layer *l, float *input, float *delta, int test);
 void update_rnn_layer(const rnn_layer *l, float learning_rate, float momentum, float decay);
+void forward_rnn_layer_begin(const rnn_layer *l, int test);
+void forward_rnn_layer_step(const rnn_layer *l, float *input, int i, int test);
+void backward_rnn_layer_begin(const rnn_layer *l);
+void backward_rnn_layer_step(const rnn_layer *l, float *input, float *delta, int i, int test);
 
 #ifdef GPU
 void forward_rnn_layer_gpu(const rnn_layer *l, float *input, int test);
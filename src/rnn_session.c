@@ -0,0 +1,181 @@
+#include "rnn_session.h"
+
+static void add_state_array(rnn_state_arrays *a, float *cpu, float *gpu, int size)
+{
+    a->cpu = realloc(a->cpu, (a->n + 1) * sizeof(float *));
+    a->gpu = realloc(a->gpu, (a->n + 1) * sizeof(float *));
+    a->size = realloc(a->size, (a->n + 1) * sizeof(int));
+    a->cpu[a->n] = cpu;
+    a->gpu[a->n] = gpu;
+    a->size[a->n] = size;
+    a->n += 1;
+}
+
+rnn_scheduler *make_rnn_scheduler(network *net)
+{
+    if(net->time_steps != 1){
+        fprintf(stderr, "make_rnn_scheduler: time_steps must be 1, got %d\n", net->time_steps);
+        exit(-1);
+    }
+    rnn_scheduler *s = calloc(1, sizeof(rnn_scheduler));
+    s->net = net;
+    s->slots = net->batch;
+    net->test = 1;      // 0: train, 1: valid
+    net->output_layer = net->n - 1;
+    net->truth_label_index = 0;
+    s->outputs = get_network_output_size_layer(net, net->output_layer);
+
+    int max_size = 0;
+    for(int i = 0; i < net->n; ++i){
+        float *gpu[2] = {0, 0};
+        if(net->layers_type[i] == RNN){
+            rnn_layer *l = (rnn_layer *)net->layers[i];
+#ifdef GPU
+            gpu[0] = l->state_gpu;
+#endif
+            add_state_array(&s->arrays, l->state, gpu[0], l->outputs);
+        } else if(net->layers_type[i] == LSTM){
+            lstm_layer *l = (lstm_layer *)net->layers[i];
+#ifdef GPU
+            gpu[0] = l->c_gpu;
+            gpu[1] = l->h_gpu;
+#endif
+            add_state_array(&s->arrays, l->c_cpu, gpu[0], l->outputs);
+            add_state_array(&s->arrays, l->h_cpu, gpu[1], l->outputs);
+        } else if(net->layers_type[i] == GRU){
+            gru_layer *l = (gru_layer *)net->layers[i];
+#ifdef GPU
+            gpu[0] = l->state_gpu;
+#endif
+            add_state_array(&s->arrays, l->state, gpu[0], l->outputs);
+        }
+    }
+    for(int i = 0; i < s->arrays.n; ++i){
+        s->state_size += s->arrays.size[i];
+        if(s->arrays.size[i] > max_size) max_size = s->arrays.size[i];
+    }
+    if(net->layers_type[0] == EMBEDDING){
+        s->index = calloc(s->slots, sizeof(int));
+    } else {
+        s->input = calloc(s->slots * net->inputs, sizeof(float));
+    }
+    s->state = calloc(s->slots * max_size, sizeof(float));
+    s->output = calloc(s->slots * s->outputs, sizeof(float));
+    fprintf(stderr, "rnn scheduler: %d slots, %d state floats per session, %d outputs\n",
+            s->slots, s->state_size, s->outputs);
+    return s;
+}
+
+void free_rnn_scheduler(rnn_scheduler *s)
+{
+    free_ptr(s->arrays.cpu);
+    free_ptr(s->arrays.gpu);
+    free_ptr(s->arrays.size);
+    free_ptr(s->pending);
+    free_ptr(s->input);
+    free_ptr(s->index);
+    free_ptr(s->state);
+    free_ptr(s->output);
+    free_ptr(s);
+}
+
+rnn_session *make_rnn_session(const rnn_scheduler *s)
+{
+    rnn_session *session = calloc(1, sizeof(rnn_session));
+    session->state_size = s->state_size;
+    session->state = calloc(s->state_size, sizeof(float));
+    session->output = calloc(s->outputs, sizeof(float));
+    session->token = -1;
+    return session;
+}
+
+void free_rnn_session(rnn_session *session)
+{
+    free_ptr(session->state);
+    free_ptr(session->output);
+    free_ptr(session);
+}
+
+void reset_rnn_session(rnn_session *session)
+{
+    memset(session->state, 0, session->state_size * sizeof(float));
+}
+
+void rnn_session_snapshot(const rnn_session *session, float *state)
+{
+    memcpy(state, session->state, session->state_size * sizeof(float));
+}
+
+void rnn_session_restore(rnn_session *session, const float *state)
+{
+    memcpy(session->state, state, session->state_size * sizeof(float));
+}
+
+// queue one step of the session, a session that is already pending is run first
+void rnn_session_step(rnn_scheduler *s, rnn_session *session, int token)
+{
+    if(token < 0 || token >= s->net->inputs){
+        fprintf(stderr, "rnn_session_step: token %d out of range [0, %d)\n", token, s->net->inputs);
+        exit(-1);
+    }
+    if(session->token >= 0) rnn_scheduler_run(s);
+    if(s->pending_num % 64 == 0){
+        s->pending = realloc(s->pending, (s->pending_num + 64) * sizeof(rnn_session *));
+    }
+    session->token = token;
+    s->pending[s->pending_num++] = session;
+}
+
+// copy the states of the sessions into (scatter == 0) or out of (scatter == 1) the first num slots of the network
+static void rnn_scheduler_states(rnn_scheduler *s, rnn_session **sessions, int num, int scatter)
+{
+    int offset = 0;
+    for(int i = 0; i < s->arrays.n; ++i){
+        int size = s->arrays.size[i];
+#ifdef GPU
+        float *rows = s->state;
+        if(scatter) cuda_pull_array(s->arrays.gpu[i], rows, num * size);
+#else
+        float *rows = s->arrays.cpu[i];
+#endif
+        for(int b = 0; b < num; ++b){
+            if(scatter) memcpy(sessions[b]->state + offset, rows + b*size, size * sizeof(float));
+            else memcpy(rows + b*size, sessions[b]->state + offset, size * sizeof(float));
+        }
+#ifdef GPU
+        if(!scatter) cuda_push_array(s->arrays.gpu[i], rows, num * size);
+#endif
+        offset += size;
+    }
+}
+
+// run the pending steps, slots sessions per forward
+void rnn_scheduler_run(rnn_scheduler *s)
+{
+    network *net = s->net;
+    for(int start = 0; start < s->pending_num; start += s->slots){
+        int num = s->pending_num - start < s->slots ? s->pending_num - start : s->slots;
+        rnn_session **sessions = s->pending + start;
+        rnn_scheduler_states(s, sessions, num, 0);
+        if(s->index){
+            for(int b = 0; b < num; ++b) s->index[b] = sessions[b]->token;
+            forward_network_test_index(net, s->index);
+        } else {
+            for(int b = 0; b < num; ++b) s->input[b*net->inputs + sessions[b]->token] = 1;
+            forward_network_test(net, s->input);
+            for(int b = 0; b < num; ++b) s->input[b*net->inputs + sessions[b]->token] = 0;
+        }
+#ifdef GPU
+        cuda_pull_array(get_network_layer_data(net, net->output_layer, 0, 1), s->output, num * s->outputs);
+        float *output = s->output;
+#else
+        float *output = get_network_layer_data(net, net->output_layer, 0, 0);
+#endif
+        rnn_scheduler_states(s, sessions, num, 1);
+        for(int b = 0; b < num; ++b){
+            memcpy(sessions[b]->output, output + b*s->outputs, s->outputs * sizeof(float));
+            sessions[b]->token = -1;
+        }
+    }
+    s->pending_num = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef RNN_SESSION_H
+#define RNN_SESSION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "network.h"
+
+/* Independent generation streams over one recurrent network. The hidden state of a stream ([rnn] state, [lstm] c and
+ * h, [gru] state) lives in its session, not in the network. The network runs one step per forward with batch rows as
+ * slots: rnn_scheduler_run gathers the states of the pending sessions into the slots, runs one batched forward and
+ * scatters the new states and the output distributions back to the sessions */
+typedef struct{
+    int state_size;
+    float *state;       // [state_size], the recurrent state of every layer of the stream
+    float *output;      // [outputs], the output of the last step
+    int token;          // input of the pending step, -1: none
+} rnn_session;
+
+typedef struct{
+    int n;
+    float **cpu, **gpu;  // state arrays of the network, [slots][size[i]] each
+    int *size;
+} rnn_state_arrays;
+
+typedef struct{
+    network *net;
+    int slots, outputs, state_size;
+    rnn_state_arrays arrays;
+    rnn_session **pending;
+    int pending_num;
+    float *input, *state, *output;  // one-hot input, staging buffer of one state array, output of the network
+    int *index;
+} rnn_scheduler;
+
+rnn_scheduler *make_rnn_scheduler(network *net);
+void free_rnn_scheduler(rnn_scheduler *s);
+rnn_session *make_rnn_session(const rnn_scheduler *s);
+void free_rnn_session(rnn_session *session);
+void reset_rnn_session(rnn_session *session);
+void rnn_session_snapshot(const rnn_session *session, float *state);
+void rnn_session_restore(rnn_session *session, const float *state);
+void rnn_session_step(rnn_scheduler *s, rnn_session *session, int token);
+void rnn_scheduler_run(rnn_scheduler *s);
+
+#endif
@@ -0,0 +1,181 @@
+#include "network.h"
+
+sampled_softmax_layer *make_sampled_softmax_layer(int batch, int inputs, int outputs, int samples, float lr_mult,
+                                                  float lr_decay_mult, float bias_mult, float bias_decay_mult)
+{
+    fprintf(stderr, "Sampled Softmax:    %d inputs, %d outputs, %d samples\n", inputs, outputs, samples);
+    sampled_softmax_layer *l = calloc(1, sizeof(sampled_softmax_layer));
+    l->batch = batch;
+    l->inputs = inputs;
+    l->outputs = outputs;
+    l->samples = samples;
+    l->lr_mult = lr_mult;
+    l->lr_decay_mult = lr_decay_mult;
+    l->bias_mult = bias_mult;
+    l->bias_decay_mult = bias_decay_mult;
+
+    l->weights = calloc(outputs*inputs, sizeof(float));
+    l->weight_updates = calloc(outputs*inputs, sizeof(float));
+    l->biases = calloc(outputs, sizeof(float));
+    l->bias_updates = calloc(outputs, sizeof(float));
+    float scale = sqrtf(2.0F / inputs);
+    for(int i = 0; i < outputs*inputs; ++i) l->weights[i] = scale*rand_uniform(-1, 1);
+    int max_rows = batch + samples < outputs ? batch + samples : outputs;
+    l->weight_update = make_sparse_update(outputs, inputs, max_rows);
+    l->bias_update = make_sparse_update(outputs, 1, max_rows);
+
+    l->sample_index = calloc(samples, sizeof(int));
+    l->output = calloc(batch*outputs, sizeof(float));
+    l->delta = calloc(batch*inputs, sizeof(float));
+    l->prob = calloc(batch*(samples + 1), sizeof(float));
+    l->cost = calloc(1, sizeof(float));
+#ifdef GPU
+    l->input_cpu = calloc(batch*inputs, sizeof(float));
+    l->output_gpu = cuda_make_array(l->output, batch*outputs);
+    l->delta_gpu = cuda_make_array(l->delta, batch*inputs);
+#endif
+    return l;
+}
+
+void free_sampled_softmax_layer(void *input)
+{
+    sampled_softmax_layer *l = (sampled_softmax_layer *)input;
+    free_ptr(l->weights);
+    free_ptr(l->weight_updates);
+    free_ptr(l->biases);
+    free_ptr(l->bias_updates);
+    free_sparse_update(l->weight_update);
+    free_sparse_update(l->bias_update);
+    free_ptr(l->sample_index);
+    free_ptr(l->output);
+    free_ptr(l->delta);
+    free_ptr(l->prob);
+    free_ptr(l->cost);
+#ifdef GPU
+    free_ptr(l->input_cpu);
+    if(l->output_gpu) cuda_free(l->output_gpu);
+    if(l->delta_gpu) cuda_free(l->delta_gpu);
+#endif
+    free_ptr(l);
+}
+
+// log-uniform (Zipfian) proposal, P(k) = log((k+2)/(k+1)) / log(n+1) for the class ids sorted by frequency
+static float log_uniform_probability(int k, int n)
+{
+    return log((k + 2.0) / (k + 1.0)) / log(n + 1.0);
+}
+
+static int log_uniform_sample(int n)
+{
+    int k = (int)exp(rand_uniform(0, 1) * log(n + 1.0)) - 1;
+    return k < 0 ? 0 : (k >= n ? n - 1 : k);
+}
+
+static float sampled_softmax_logit(sampled_softmax_layer *l, int k, float *x)
+{
+    sparse_update_catch_up(l->weight_update, l->weights, l->weight_updates, k);
+    sparse_update_catch_up(l->bias_update, l->biases, l->bias_updates, k);
+    return dot_cpu(l->inputs, l->weights + k*l->inputs, 1, x, 1) + l->biases[k];
+}
+
+void forward_sampled_softmax_layer(sampled_softmax_layer *l, float *input, network *net)
+{
+    float loss = 0;
+    if(net->test == 0 && net->truth_label_index){    // 0: train, 1: valid
+        /* softmax over the truth and the negative samples shared by the batch, the logits are corrected by
+         * -log(samples * P(k)) so the sampled loss is an estimate of the full one; a sample equal to the truth
+         * (accidental hit) is dropped, the accuracy is over the sampled classes only */
+        for(int s = 0; s < l->samples; ++s) l->sample_index[s] = log_uniform_sample(l->outputs);
+        for(int b = 0; b < l->batch; ++b){
+            float *x = input + b*l->inputs;
+            float *prob = l->prob + b*(l->samples + 1);
+            int truth = net->truth_label_index[b];
+            if(truth < 0) continue;  // masked row
+            if(truth >= l->outputs){
+                fprintf(stderr, "sampled_softmax layer: class %d out of range [0, %d)\n", truth, l->outputs);
+                exit(-1);
+            }
+            prob[0] = sampled_softmax_logit(l, truth, x) -
+                logf(l->samples * log_uniform_probability(truth, l->outputs));
+            for(int s = 0; s < l->samples; ++s){
+                int k = l->sample_index[s];
+                prob[s + 1] = (k == truth) ? -FLT_MAX : sampled_softmax_logit(l, k, x) -
+                    logf(l->samples * log_uniform_probability(k, l->outputs));
+            }
+            if(max_index(prob, l->samples + 1) == 0) net->correct_num += 1;
+            softmax_cpu(prob, l->samples + 1, prob);
+            loss -= logf(fmaxf(prob[0], FLT_MIN));
+        }
+    } else {
+        sparse_update_flush(l->weight_update, l->weights, l->weight_updates);
+        sparse_update_flush(l->bias_update, l->biases, l->bias_updates);
+        for(int b = 0; b < l->batch; ++b) copy_cpu(l->outputs, l->biases, 1, l->output + b*l->outputs, 1);
+        gemm(0, 1, l->batch, l->outputs, l->inputs, 1, input, l->inputs, l->weights, l->inputs, 1, l->output, l->outputs);
+        for(int b = 0; b < l->batch; ++b){
+            float *output = l->output + b*l->outputs;
+            softmax_cpu(output, l->outputs, output);
+            if(net->truth_label_index && net->truth_label_index[b] >= 0){
+                int truth = net->truth_label_index[b];
+                if(max_index(output, l->outputs) == truth) net->correct_num += 1;
+                loss -= logf(fmaxf(output[truth], FLT_MIN));
+            }
+        }
+    }
+    l->cost[0] = loss;
+    net->loss = loss;
+}
+
+void backward_sampled_softmax_layer(sampled_softmax_layer *l, float *input, float *delta, network *net)
+{
+    for(int b = 0; b < l->batch; ++b){
+        if(net->truth_label_index[b] < 0) continue;
+        float *x = input + b*l->inputs;
+        float *prob = l->prob + b*(l->samples + 1);
+        for(int s = 0; s <= l->samples; ++s){
+            int k = (s == 0) ? net->truth_label_index[b] : l->sample_index[s - 1];
+            float d = (s == 0) - prob[s];
+            if(d == 0) continue;
+            if(delta) axpy_cpu(l->inputs, d, l->weights + k*l->inputs, 1, delta + b*l->inputs, 1);
+            axpy_cpu(l->inputs, d, x, 1, l->weight_updates + k*l->inputs, 1);
+            l->bias_updates[k] += d;
+            sparse_update_touch(l->weight_update, k);
+            sparse_update_touch(l->bias_update, k);
+        }
+    }
+}
+
+void update_sampled_softmax_layer(sampled_softmax_layer *l, float learning_rate, float momentum, float decay)
+{
+    sparse_update_apply(l->bias_update, l->biases, l->bias_updates, -decay * l->bias_decay_mult * l->batch,
+                        learning_rate * l->bias_mult / l->batch, momentum);
+    sparse_update_apply(l->weight_update, l->weights, l->weight_updates, -decay * l->lr_decay_mult * l->batch,
+                        learning_rate * l->lr_mult / l->batch, momentum);
+}
+
+void flush_sampled_softmax_layer(sampled_softmax_layer *l)
+{
+    sparse_update_flush(l->weight_update, l->weights, l->weight_updates);
+    sparse_update_flush(l->bias_update, l->biases, l->bias_updates);
+}
+
+#ifdef GPU
+// the sampling runs on the host, like the yolo layer; the parameters only live in host memory
+void forward_sampled_softmax_layer_gpu(sampled_softmax_layer *l, float *input_gpu, network *net)
+{
+    cuda_pull_array(input_gpu, l->input_cpu, l->batch*l->inputs);
+    forward_sampled_softmax_layer(l, l->input_cpu, net);
+    if(net->test != 0 || !net->truth_label_index){
+        cuda_push_array(l->output_gpu, l->output, l->batch*l->outputs);
+    }
+}
+
+void backward_sampled_softmax_layer_gpu(sampled_softmax_layer *l, float *delta_gpu, network *net)
+{
+    fill_cpu(l->batch*l->inputs, 0, l->delta, 1);
+    backward_sampled_softmax_layer(l, l->input_cpu, delta_gpu ? l->delta : 0, net);
+    if(delta_gpu){
+        cuda_push_array(l->delta_gpu, l->delta, l->batch*l->inputs);
+        axpy_gpu(l->batch*l->inputs, 1, l->delta_gpu, 1, delta_gpu, 1);
+    }
+}
+#endif
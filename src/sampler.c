@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sampler.h"
+#include "utils.h"
+
+// Fisher-Yates from a generator of its own, the rand streams of the loader threads are not touched
+static void sampler_shuffle(sampler *s, int64_t epoch)
+{
+    uint64_t e = epoch;
+    uint64_t state = s->seed ^ splitmix64(&e);
+    for(int i = 0; i < s->n; ++i) s->order[i] = i;
+    for(int i = s->n - 1; i > 0; --i){
+        int j = (int)(((unsigned __int128)splitmix64(&state) * (uint64_t)(i + 1)) >> 64);
+        int t = s->order[i];
+        s->order[i] = s->order[j];
+        s->order[j] = t;
+    }
+    s->epoch = epoch;
+}
+
+sampler *make_sampler(int n, uint64_t seed, int replica, int replicas)
+{
+    if(n <= 0){
+        fprintf(stderr, "sampler: no images to sample\n");
+        exit(-1);
+    }
+    if(replicas < 1 || replica < 0 || replica >= replicas){
+        fprintf(stderr, "sampler: replica %d of %d\n", replica, replicas);
+        exit(-1);
+    }
+    sampler *s = calloc(1, sizeof(sampler));
+    s->n = n;
+    s->seed = seed;
+    s->replica = replica;
+    s->replicas = replicas;
+    s->epoch = -1;
+    s->order = calloc(n, sizeof(int));
+    pthread_mutex_init(&s->mutex, NULL);
+    return s;
+}
+
+// position: the samples this replica has already taken, e.g. net->seen of the weights the run resumes from
+void sampler_seek(sampler *s, uint64_t position)
+{
+    pthread_mutex_lock(&s->mutex);
+    s->position = position;
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static uint64_t sampler_draw(sampler *s, uint64_t position, int *index, int count)
+{
+    for(int i = 0; i < count; ++i){
+        uint64_t k = (position + i) * s->replicas + s->replica;
+        int64_t epoch = k / s->n;
+        if(epoch != s->epoch) sampler_shuffle(s, epoch);
+        index[i] = s->order[k % s->n];
+    }
+    return position * s->replicas + s->replica;
+}
+
+/* the images at positions [position, position + count) of this replica, whatever was taken before; returns the
+ * global sample number k of the first one, the others are k + replicas, k + 2 * replicas, ... as the rand_stream ids
+ * of their augmentation. The loader threads draw batch t at position start + t * batch, in any order */
+uint64_t sampler_at(sampler *s, uint64_t position, int *index, int count)
+{
+    pthread_mutex_lock(&s->mutex);
+    uint64_t first = sampler_draw(s, position, index, count);
+    pthread_mutex_unlock(&s->mutex);
+    return first;
+}
+
+// the next count images of this replica, no image repeats within an epoch; returns as sampler_at
+uint64_t sampler_next(sampler *s, int *index, int count)
+{
+    pthread_mutex_lock(&s->mutex);
+    uint64_t first = sampler_draw(s, s->position, index, count);
+    s->position += count;
+    pthread_mutex_unlock(&s->mutex);
+    return first;
+}
+
+// the epoch that position of replica falls in, counted over the samples of all the replicas as sampler_at does
+int sampler_epoch(uint64_t position, int n, int replica, int replicas)
+{
+    return (position * replicas + replica) / n;
+}
+
+void free_sampler(sampler *s)
+{
+    pthread_mutex_destroy(&s->mutex);
+    free_ptr(s->order);
+    free_ptr(s);
+}
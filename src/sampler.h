@@ -0,0 +1,29 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Epoch-exact sampling without replacement: epoch e is a permutation of the n images drawn from (seed, e) alone,
+ * so sample k of a run is always image order(k / n)[k % n]. The loader threads draw their batches at explicit
+ * positions with sampler_at, and replica r of replicas takes the positions k = j * replicas + r, so data-parallel
+ * processes with the same seed see disjoint images. Starting from net->seen resumes a run on the same samples it
+ * would have drawn had it not stopped */
+typedef struct{
+    int n;
+    uint64_t seed;
+    int replica, replicas;
+    uint64_t position;      // samples this replica has taken
+    int64_t epoch;          // of order, -1: none yet
+    int *order;             // [n]
+    pthread_mutex_t mutex;
+} sampler;
+
+sampler *make_sampler(int n, uint64_t seed, int replica, int replicas);
+void sampler_seek(sampler *s, uint64_t position);
+uint64_t sampler_at(sampler *s, uint64_t position, int *index, int count);
+uint64_t sampler_next(sampler *s, int *index, int count);
+int sampler_epoch(uint64_t position, int n, int replica, int replicas);
+void free_sampler(sampler *s);
+
+#endif
@@ -39,7 +39,7 @@ void forward_softmax_layer(softmax_layer *layer, float *input, network *net)
     }
     for(int b = 0; b < layer->batch; b++){
         int index = b * layer->inputs;
-        if(layer->label_specific_margin_bias < -0.01 && net->test == 0){    // 0: train, 1: valid
+        if(layer->label_specific_margin_bias < -0.01 && net->test == 0 && net->truth_label_index[b] >= 0){
             if(layer->input_backup[index + net->truth_label_index[b]] > -layer->label_specific_margin_bias){
                 layer->input_backup[index + net->truth_label_index[b]] += layer->label_specific_margin_bias;
             }
@@ -68,6 +68,7 @@ void forward_softmax_layer(softmax_layer *layer, float *input, network *net)
 
     if(layer->is_last_layer && net->truth_label_index){
         for(int b = 0; b < layer->batch; ++b){
+            if(net->truth_label_index[b] < 0) continue;  // masked row
             int index = b * layer->inputs;
             int max_i = net->truth_label_index[b];
             double max = layer->input_backup[index + net->truth_label_index[b]];
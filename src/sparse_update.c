@@ -0,0 +1,91 @@
+#include "sparse_update.h"
+#include "utils.h"
+
+sparse_update *make_sparse_update(int n, int size, int max_rows)
+{
+    sparse_update *s = calloc(1, sizeof(sparse_update));
+    s->n = n;
+    s->size = size;
+    s->row_count = calloc(n, sizeof(int));
+    s->rows = calloc(max_rows, sizeof(int));
+    s->touched = calloc(n, sizeof(char));
+    return s;
+}
+
+void free_sparse_update(sparse_update *s)
+{
+    free_ptr(s->row_count);
+    free_ptr(s->rows);
+    free_ptr(s->touched);
+    free_ptr(s);
+}
+
+void sparse_update_touch(sparse_update *s, int row)
+{
+    if(!s->touched[row]){
+        s->touched[row] = 1;
+        s->rows[s->rows_num++] = row;
+    }
+}
+
+// p = [[1+a*b, b], [momentum*a, momentum]] ^ skip, the skipped steps acting on (weights, weight_updates)
+void sparse_update_power(int skip, float a, float b, float momentum, double *p)
+{
+    double m[4] = {1 + (double)a*b, b, (double)momentum*a, momentum};
+    p[0] = 1; p[1] = 0; p[2] = 0; p[3] = 1;
+    while(skip > 0){
+        if(skip & 1){
+            double t[4] = {p[0]*m[0] + p[1]*m[2], p[0]*m[1] + p[1]*m[3], p[2]*m[0] + p[3]*m[2], p[2]*m[1] + p[3]*m[3]};
+            memcpy(p, t, sizeof(t));
+        }
+        double t[4] = {m[0]*m[0] + m[1]*m[2], m[0]*m[1] + m[1]*m[3], m[2]*m[0] + m[3]*m[2], m[2]*m[1] + m[3]*m[3]};
+        memcpy(m, t, sizeof(t));
+        skip >>= 1;
+    }
+}
+
+void sparse_update_catch_up(sparse_update *s, float *weights, float *weight_updates, int row)
+{
+    int skip = s->count - s->row_count[row];
+    s->row_count[row] = s->count;
+    if(skip <= 0) return;
+    double p[4];
+    sparse_update_power(skip, s->a, s->b, s->momentum, p);
+    weights += row*s->size;
+    weight_updates += row*s->size;
+    for(int j = 0; j < s->size; ++j){
+        double w = weights[j];
+        double u = weight_updates[j];
+        weights[j] = p[0]*w + p[1]*u;
+        weight_updates[j] = p[2]*w + p[3]*u;
+    }
+}
+
+void sparse_update_apply(sparse_update *s, float *weights, float *weight_updates, float a, float b, float momentum)
+{
+    for(int i = 0; i < s->rows_num; ++i){
+        int r = s->rows[i];
+        sparse_update_catch_up(s, weights, weight_updates, r);
+        float *w = weights + r*s->size;
+        float *u = weight_updates + r*s->size;
+        for(int j = 0; j < s->size; ++j){
+            u[j] += a * w[j];
+            w[j] += b * u[j];
+            u[j] *= momentum;
+        }
+        s->row_count[r] = s->count + 1;
+        s->touched[r] = 0;
+    }
+    s->rows_num = 0;
+    s->count += 1;
+    s->a = a;
+    s->b = b;
+    s->momentum = momentum;
+}
+
+void sparse_update_flush(sparse_update *s, float *weights, float *weight_updates)
+{
+    for(int r = 0; r < s->n; ++r){
+        sparse_update_catch_up(s, weights, weight_updates, r);
+    }
+}
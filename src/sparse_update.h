@@ -0,0 +1,30 @@
+#ifndef SPARSE_UPDATE_H
+#define SPARSE_UPDATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lazy momentum / decay update of a [n][size] parameter matrix of which each iteration only a few rows get
+ * gradient (embedding rows, output classes). Only the touched rows are updated, the iterations a row skipped
+ * (momentum and decay only, no gradient) are caught up in closed form before the row is read again, with the
+ * coefficients of the last update. The rows are then the same as with dense updates at a constant learning rate.
+ * One step is: weight_updates += a*weights; weights += b*weight_updates; weight_updates *= momentum */
+typedef struct{
+    int n, size;
+    int count;  // number of updates applied to the matrix
+    int *row_count;  // per row: number of updates already applied to the row
+    int *rows, rows_num;  // rows with gradient since the last update
+    char *touched;
+    float a, b, momentum;  // of the last update
+} sparse_update;
+
+sparse_update *make_sparse_update(int n, int size, int max_rows);
+void free_sparse_update(sparse_update *s);
+void sparse_update_touch(sparse_update *s, int row);
+void sparse_update_catch_up(sparse_update *s, float *weights, float *weight_updates, int row);
+void sparse_update_apply(sparse_update *s, float *weights, float *weight_updates, float a, float b, float momentum);
+void sparse_update_flush(sparse_update *s, float *weights, float *weight_updates);
+void sparse_update_power(int skip, float a, float b, float momentum, double *p);
+
+#endif
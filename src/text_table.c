@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "text_table.h"
+#include "utils.h"
+
+#define TEXT_TABLE_CHUNK (1 << 20)      // bytes per parallel chunk
+
+static int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// end of the line starting at p
+static const char *line_end(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static int blank_line(const char *p, const char *end)
+{
+    while(p < end && is_blank(*p)) ++p;
+    return p == end;
+}
+
+static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                       1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static double power_of_ten(int e)
+{
+    return e <= 22 ? powers_of_ten[e] : pow(10, e);
+}
+
+/* a decimal number with optional sign, fraction and exponent, the digits are gathered in an integer and scaled
+ * once; nan when there are no digits or the field has other characters */
+static float parse_number(const char **s, const char *end)
+{
+    const char *p = *s;
+    int negative = 0;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for(; p < end && (unsigned)(*p - '0') < 10; ++p, ++digits){
+        if(mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (*p - '0');
+        else exponent += 1;
+    }
+    if(p < end && *p == '.'){
+        for(++p; p < end && (unsigned)(*p - '0') < 10; ++p, ++digits){
+            if(mantissa < 100000000000000000ULL){
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent -= 1;
+            }
+        }
+    }
+    if(digits && p < end && (*p == 'e' || *p == 'E')){
+        const char *e = p + 1;
+        int e_negative = 0, e_value = 0, e_digits = 0;
+        if(e < end && (*e == '-' || *e == '+')) e_negative = *e++ == '-';
+        for(; e < end && (unsigned)(*e - '0') < 10; ++e, ++e_digits){
+            if(e_value < 10000) e_value = e_value * 10 + (*e - '0');
+        }
+        if(e_digits){
+            exponent += e_negative ? -e_value : e_value;
+            p = e;
+        }
+    }
+    int valid = digits && (p == end || *p == ',' || *p == '\n' || is_blank(*p));
+    while(p < end && *p != ',' && *p != '\n' && !is_blank(*p)) ++p;
+    *s = p;
+    if(!valid) return nan("");
+    double v = mantissa;
+    if(exponent > 0) v *= power_of_ten(exponent);
+    else if(exponent < 0) v /= power_of_ten(-exponent);
+    return negative ? -v : v;
+}
+
+// the next field of the line, or nan past its last one
+static float next_field(const char **s, const char *end)
+{
+    const char *p = *s;
+    while(p < end && is_blank(*p)) ++p;
+    if(p == end) return nan("");
+    float v = parse_number(&p, end);
+    while(p < end && is_blank(*p)) ++p;
+    if(p < end && *p == ',') ++p;
+    *s = p;
+    return v;
+}
+
+static int count_line_fields(const char *p, const char *end)
+{
+    int n = 0;
+    while(1){
+        while(p < end && is_blank(*p)) ++p;
+        if(p == end) return n;
+        next_field(&p, end);
+        n += 1;
+    }
+}
+
+text_table *open_text_table(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(filename);
+    text_table *t = calloc(1, sizeof(text_table));
+    t->size = st.st_size;
+    if(t->size){
+        t->map = mmap(0, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(t->map == MAP_FAILED) file_error(filename);
+        madvise(t->map, t->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    const char *end = t->map + t->size;
+    t->chunks = 1 + t->size / TEXT_TABLE_CHUNK;
+    t->chunk_start = calloc(t->chunks + 1, sizeof(size_t));
+    t->chunk_row = calloc(t->chunks + 1, sizeof(int));
+    for(int k = 1; k < t->chunks; ++k){
+        const char *p = t->map + (size_t)k * t->size / t->chunks;
+        if(p < t->map + t->chunk_start[k - 1]) p = t->map + t->chunk_start[k - 1];
+        p = line_end(p, end);
+        t->chunk_start[k] = (p < end ? p + 1 : end) - t->map;
+    }
+    t->chunk_start[t->chunks] = t->size;
+    #pragma omp parallel for schedule(dynamic)
+    for(int k = 0; k < t->chunks; ++k){
+        const char *p = t->map + t->chunk_start[k];
+        const char *chunk_end = t->map + t->chunk_start[k + 1];
+        int rows = 0;
+        while(p < chunk_end){
+            const char *e = line_end(p, chunk_end);
+            if(!blank_line(p, e)) ++rows;
+            p = e + 1;
+        }
+        t->chunk_row[k + 1] = rows;
+    }
+    for(int k = 0; k < t->chunks; ++k) t->chunk_row[k + 1] += t->chunk_row[k];
+    t->rows = t->chunk_row[t->chunks];
+
+    const char *p = t->map;
+    while(p < end){
+        const char *e = line_end(p, end);
+        if(!blank_line(p, e)){
+            t->cols = count_line_fields(p, e);
+            break;
+        }
+        p = e + 1;
+    }
+    return t;
+}
+
+/* parse the first rows rows: their first label_cols fields to labels ([rows][label_cols]), the others to values
+ * ([rows][cols - label_cols]) */
+void read_text_table(text_table *t, int rows, int label_cols, float *labels, float *values)
+{
+    int value_cols = t->cols - label_cols;
+    #pragma omp parallel for schedule(dynamic)
+    for(int k = 0; k < t->chunks; ++k){
+        const char *p = t->map + t->chunk_start[k];
+        const char *chunk_end = t->map + t->chunk_start[k + 1];
+        int r = t->chunk_row[k];
+        while(p < chunk_end && r < rows){
+            const char *e = line_end(p, chunk_end);
+            if(!blank_line(p, e)){
+                const char *f = p;
+                for(int j = 0; j < label_cols; ++j) labels[(size_t)r * label_cols + j] = next_field(&f, e);
+                float *row = values + (size_t)r * value_cols;
+                for(int j = 0; j < value_cols; ++j) row[j] = next_field(&f, e);
+                ++r;
+            }
+            p = e + 1;
+        }
+    }
+}
+
+void free_text_table(text_table *t)
+{
+    if(t->map) munmap(t->map, t->size);
+    free_ptr(t->chunk_start);
+    free_ptr(t->chunk_row);
+    free_ptr(t);
+}
@@ -0,0 +1,23 @@
+#ifndef TEXT_TABLE_H
+#define TEXT_TABLE_H
+
+#include <stddef.h>
+
+/* A text file of numbers, one row per line, separated by commas and/or blanks: MNIST style csv images (label,
+ * pixels...) or the features.txt written by `classifier valid`. The file is mapped and split into line aligned
+ * chunks that are counted and parsed in parallel, straight into the buffers of the caller. Empty or malformed
+ * fields read as nan like parse_fields, empty lines are skipped */
+typedef struct{
+    char *map;
+    size_t size;
+    int rows, cols;         // cols: fields of the first row
+    int chunks;
+    size_t *chunk_start;    // [chunks + 1], line aligned byte offsets
+    int *chunk_row;         // [chunks + 1], index of the first row of each chunk
+} text_table;
+
+text_table *open_text_table(char *filename);
+void read_text_table(text_table *t, int rows, int label_cols, float *labels, float *values);
+void free_text_table(text_table *t);
+
+#endif
@@ -16,6 +16,8 @@ typedef struct{
     int *group_offset;
 } tree;
 
+tree *read_tree(char *filename);
+void hierarchy_predictions(float *predictions, int n, tree *hier, int only_leaves, int stride);
 int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride);
 float get_hierarchy_probability(float *x, tree *hier, int c, int stride);
 
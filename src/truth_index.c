@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "truth_index.h"
+#include "data.h"
+#include "utils.h"
+
+// what a cached index has to match to be used for the list list_file loaded into paths
+truth_source get_truth_source(const path_table *paths, char *list_file)
+{
+    truth_source s = {14695981039346656037ULL, 0, 0};
+    const unsigned char *p = (const unsigned char *)paths->arena;
+    for(size_t i = 0; i < paths->arena_size; ++i){
+        s.paths_hash ^= p[i];
+        s.paths_hash *= 1099511628211ULL;
+    }
+    struct stat st;
+    if(stat(list_file, &st) != 0) file_error(list_file);
+    s.list_size = st.st_size;
+    s.list_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return s;
+}
+
+// read the label file of every path in parallel and concatenate the boxes
+truth_index *build_truth_index(path_table *paths, char *list_file)
+{
+    double time = what_time_is_it_now();
+    int n = paths->count;
+    box_label **image_boxes = calloc(n, sizeof(box_label *));
+    int *counts = calloc(n, sizeof(int));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i = 0; i < n; ++i){
+        char labelpath[4096];
+        detection_label_path(table_path(paths, i), labelpath);
+        image_boxes[i] = read_boxes(labelpath, counts + i);
+    }
+    truth_index *t = calloc(1, sizeof(truth_index));
+    t->count = n;
+    t->source = get_truth_source(paths, list_file);
+    uint64_t *first = calloc(n + 1, sizeof(uint64_t));
+    for(int i = 0; i < n; ++i) first[i + 1] = first[i] + counts[i];
+    truth_box *boxes = calloc(first[n] ? first[n] : 1, sizeof(truth_box));
+    for(int i = 0; i < n; ++i){
+        for(int j = 0; j < counts[i]; ++j){
+            box_label b = image_boxes[i][j];
+            boxes[first[i] + j] = (truth_box){b.x, b.y, b.w, b.h, b.id};
+        }
+        free_ptr(image_boxes[i]);
+    }
+    free_ptr(image_boxes);
+    free_ptr(counts);
+    t->first = first;
+    t->boxes = boxes;
+    fprintf(stderr, "truth index: %lu boxes of %d images, %.2f s\n", (unsigned long)first[n], n,
+            what_time_is_it_now() - time);
+    return t;
+}
+
+truth_index *load_truth_index(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    if(fstat(fd, &st) != 0) file_error(filename);
+    size_t size = st.st_size;
+    unsigned char *map = size ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+    const truth_index_header *header = (const truth_index_header *)map;
+    size_t first = sizeof(truth_index_header);
+    size_t boxes = first + (size >= first ? ((size_t)header->count + 1) * sizeof(uint64_t) : 0);
+    if(size < first || memcmp(header->magic, TRUTH_INDEX_MAGIC, 4) != 0 || header->version != TRUTH_INDEX_VERSION ||
+       size < boxes + header->boxes * sizeof(truth_box)){
+        fprintf(stderr, "%s: not a truth index of version %d\n", filename, TRUTH_INDEX_VERSION);
+        exit(-1);
+    }
+    truth_index *t = calloc(1, sizeof(truth_index));
+    t->count = header->count;
+    t->source = header->source;
+    t->first = (const uint64_t *)(map + first);
+    t->boxes = (const truth_box *)(map + boxes);
+    t->map = map;
+    t->map_size = size;
+    return t;
+}
+
+/* the index saved at filename, built from the label files and saved there first when it is missing, of an older
+ * version or of another list than list_file */
+truth_index *open_truth_index(path_table *paths, char *list_file, char *filename)
+{
+    if(access(filename, R_OK) == 0){
+        truth_index_header header = {{0}};
+        FILE *fp = fopen(filename, "rb");
+        if(!fp) file_error(filename);
+        size_t got = fread(&header, sizeof(header), 1, fp);
+        fclose(fp);
+        truth_source source = get_truth_source(paths, list_file);
+        if(got == 1 && memcmp(header.magic, TRUTH_INDEX_MAGIC, 4) == 0 && header.version == TRUTH_INDEX_VERSION &&
+           header.count == paths->count && header.source.paths_hash == source.paths_hash &&
+           header.source.list_size == source.list_size && header.source.list_mtime == source.list_mtime){
+            truth_index *t = load_truth_index(filename);
+            fprintf(stderr, "%s: boxes of %d images\n", filename, t->count);
+            return t;
+        }
+        fprintf(stderr, "%s: not built from %s as it is now, rebuilding\n", filename, list_file);
+    }
+    truth_index *t = build_truth_index(paths, list_file);
+    save_truth_index(t, filename);
+    return t;
+}
+
+void save_truth_index(const truth_index *t, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if(!fp){
+        fprintf(stderr, "%s: can not be written, the truth index is kept in memory only\n", filename);
+        return;
+    }
+    truth_index_header header = {TRUTH_INDEX_MAGIC, TRUTH_INDEX_VERSION, t->count, 0, t->first[t->count], t->source};
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(t->first, sizeof(uint64_t), t->count + 1, fp);
+    fwrite(t->boxes, sizeof(truth_box), t->first[t->count], fp);
+    if(fclose(fp) != 0) file_error(filename);
+}
+
+void free_truth_index(truth_index *t)
+{
+    if(t->map){
+        munmap(t->map, t->map_size);
+    } else {
+        free_ptr((void *)t->first);
+        free_ptr((void *)t->boxes);
+    }
+    free_ptr(t);
+}
@@ -0,0 +1,51 @@
+#ifndef TRUTH_INDEX_H
+#define TRUTH_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "path_table.h"
+
+/* The ground truth boxes of a detection list compiled into one file: the boxes of every image back to back with
+ * the index of the first box per image. It is built from the label .txt files on first use or by `cnn truth`, and
+ * mapped by the loader, so a sample costs no path rewriting, open or fscanf, only the geometric transform. The
+ * header records the list it was built from (a hash of the paths, the size and mtime of the list file) and a cached
+ * index of another list is rebuilt; edits of the label files alone are not seen, run `cnn truth` after them */
+#define TRUTH_INDEX_MAGIC "CNNB"
+#define TRUTH_INDEX_VERSION 2
+
+typedef struct{
+    uint64_t paths_hash;    // fnv-1a of the path arena
+    uint64_t list_size;
+    int64_t list_mtime;
+} truth_source;
+
+typedef struct{
+    char magic[4];
+    int version, count, pad;
+    uint64_t boxes;
+    truth_source source;
+} truth_index_header;     // followed by first [count + 1], the boxes [boxes]
+
+typedef struct{
+    float x, y, w, h;
+    int id;
+} truth_box;
+
+typedef struct{
+    int count;
+    truth_source source;
+    const uint64_t *first;      // [count + 1], the boxes of image i are first[i] .. first[i + 1] - 1
+    const truth_box *boxes;
+    void *map;                  // the mapped index, or NULL when the arrays are allocated
+    size_t map_size;
+} truth_index;
+
+truth_source get_truth_source(const path_table *paths, char *list_file);
+truth_index *build_truth_index(path_table *paths, char *list_file);
+truth_index *load_truth_index(char *filename);
+truth_index *open_truth_index(path_table *paths, char *list_file, char *filename);
+void save_truth_index(const truth_index *t, char *filename);
+void free_truth_index(truth_index *t);
+
+#endif
@@ -6,8 +6,12 @@
 #include <unistd.h>
 #include <float.h>
 #include <limits.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "utils.h"
 
@@ -80,7 +84,7 @@ void shuffle(void *arr, size_t n, size_t size)
     size_t i;
     void *swp = calloc(1, size);
     for(i = 0; i < n-1; ++i){
-        size_t j = i + rand()/(RAND_MAX / (n-i)+1);
+        size_t j = i + rand_size_t() % (n-i);
         memcpy(swp,          arr+(j*size), size);
         memcpy(arr+(j*size), arr+(i*size), size);
         memcpy(arr+(i*size), swp,          size);
@@ -96,7 +100,7 @@ int *random_index_order(int min, int max)
     }
     for(i = min; i < max-1; ++i){
         int swap = inds[i];
-        int index = i + rand()%(max-i);
+        int index = i + rand_size_t()%(max-i);
         inds[i] = inds[index];
         inds[index] = swap;
     }
@@ -227,20 +231,45 @@ float sec(clock_t clocks)
     return (float)clocks/CLOCKS_PER_SEC;
 }
 
+static void top_k_sift_down(const float *a, int *heap, int m, int j)
+{
+    while(2*j + 1 < m){
+        int c = 2*j + 1;
+        if(c + 1 < m && a[heap[c + 1]] < a[heap[c]]) ++c;
+        if(a[heap[c]] >= a[heap[j]]) break;
+        int swap = heap[c];
+        heap[c] = heap[j];
+        heap[j] = swap;
+        j = c;
+    }
+}
+
+// indexes of the k largest values of a, largest first, -1 after n; partial sort with a min-heap of the k best, O(n log k)
 void top_k(float *a, int n, int k, int *index)
 {
-    int i,j;
-    for(j = 0; j < k; ++j) index[j] = -1;
-    for(i = 0; i < n; ++i){
-        int curr = i;
-        for(j = 0; j < k; ++j){
-            if((index[j] < 0) || a[curr] > a[index[j]]){
-                int swap = curr;
-                curr = index[j];
+    int m = 0;
+    for(int i = 0; i < n; ++i){
+        if(m < k){
+            int j = m++;
+            index[j] = i;
+            while(j > 0 && a[index[(j - 1)/2]] > a[index[j]]){
+                int swap = index[(j - 1)/2];
+                index[(j - 1)/2] = index[j];
                 index[j] = swap;
+                j = (j - 1)/2;
             }
+        } else if(k > 0 && a[i] > a[index[0]]){
+            index[0] = i;
+            top_k_sift_down(a, index, m, 0);
         }
     }
+    for(int j = m - 1; j > 0; --j){
+        int swap = index[0];
+        index[0] = index[j];
+        index[j] = swap;
+        top_k_sift_down(a, index, j, 0);
+    }
+    for(int j = m; j < k; ++j) index[j] = -1;
 }
 
 void error(const char *s)
@@ -584,6 +613,72 @@ void scale_array(float *a, int n, float s)
     }
 }
 
+/* xoshiro256** generators, one per thread, instead of the locked global state of rand(). A generator is seeded from
+ * the run seed and a stream id: a thread takes a fresh id on its first use, rand_stream sets an explicit one so
+ * e.g. an augmented sample gets the same numbers whichever thread loads it */
+static uint64_t rand_run_seed = 0x853c49e6748fea9bULL;
+static int rand_generation = 1;             // bumped by rand_seed, the threads reseed lazily
+static uint64_t rand_thread_streams;        // ids of the threads, from 1 << 63 on
+static __thread uint64_t rand_state[4];
+static __thread int rand_state_generation;
+static __thread int rand_have_spare;
+static __thread double rand_spare1, rand_spare2;
+
+uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void rand_stream(uint64_t stream)
+{
+    uint64_t x = rand_run_seed ^ (stream * 0xd1342543de82ef95ULL);
+    for(int i = 0; i < 4; ++i) rand_state[i] = splitmix64(&x);
+    rand_state_generation = __atomic_load_n(&rand_generation, __ATOMIC_ACQUIRE);
+    rand_have_spare = 0;
+}
+
+// seed all the generators of the run, the threads that already drew numbers reseed on their next draw
+void rand_seed(uint64_t seed)
+{
+    srand(seed);
+    rand_run_seed = seed;
+    __atomic_store_n(&rand_thread_streams, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rand_generation, 1, __ATOMIC_RELEASE);
+}
+
+/* the stream of row `row` of layer `layer` in the forward after seen samples, e.g. a dropout mask; from 1 << 62 on,
+ * apart from the streams of the samples (their sampler position, from 0 on) and of the threads */
+uint64_t rand_layer_stream(uint64_t seen, int layer, int row)
+{
+    uint64_t x = seen * 65536 + layer;
+    return (1ULL << 62) | ((splitmix64(&x) ^ (uint64_t)row) & ((1ULL << 62) - 1));
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t rand_u64()
+{
+    if(rand_state_generation != __atomic_load_n(&rand_generation, __ATOMIC_ACQUIRE)){
+        rand_stream((1ULL << 63) | __atomic_fetch_add(&rand_thread_streams, 1, __ATOMIC_RELAXED));
+    }
+    uint64_t *s = rand_state;
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
 float rand_uniform(float min, float max)
 {
     if(max < min){
@@ -591,7 +686,7 @@ float rand_uniform(float min, float max)
         min = max;
         max = swap;
     }
-    return ((float)rand()/RAND_MAX * (max - min)) + min;
+    return (rand_u64() >> 40) * (1.0F / 16777216.0F) * (max - min) + min;
 }
 
 int sample_array(float *a, int n)
@@ -651,72 +746,62 @@ int rand_int(int min, int max)
         min = max;
         max = s;
     }
-    int r = (rand()%(max - min + 1)) + min;
+    int r = (int)(rand_u64() % ((uint64_t)max - min + 1)) + min;
     return r;
 }
 
 // From http://en.wikipedia.org/wiki/Box%E2%80%93Muller_transform
 float rand_normal()
 {
-    static int haveSpare = 0;
-    static double rand1, rand2;
-
-    if(haveSpare)
+    if(rand_have_spare)
     {
-        haveSpare = 0;
-        return sqrtf(rand1) * sin(rand2);
+        rand_have_spare = 0;
+        return sqrtf(rand_spare1) * sin(rand_spare2);
     }
 
-    haveSpare = 1;
-
-    rand1 = rand() / ((double) RAND_MAX);
-    if(rand1 < 1e-100) rand1 = 1e-100;
-    rand1 = -2 * log(rand1);
-    rand2 = (rand() / ((double) RAND_MAX)) * TWO_PI;
+    rand_spare1 = (rand_u64() >> 11) * (1.0 / 9007199254740992.0);
+    if(rand_spare1 < 1e-100) rand_spare1 = 1e-100;
+    rand_spare1 = -2 * log(rand_spare1);
+    rand_spare2 = (rand_u64() >> 11) * (1.0 / 9007199254740992.0) * TWO_PI;
+    rand_have_spare = 1;
 
-    return sqrtf(rand1) * cos(rand2);
+    return sqrtf(rand_spare1) * cos(rand_spare2);
 }
 
 float rand_normal_me(float mean, float sigma)
 {
-    static int haveSpare = 0;
-    static double rand1, rand2;
-
-    if(haveSpare)
-    {
-        haveSpare = 0;
-        return sqrtf(rand1) * sin(rand2) * sigma + mean;
-    }
-
-    haveSpare = 1;
-
-    rand1 = rand() / ((double) RAND_MAX);
-    if(rand1 < 1e-100) rand1 = 1e-100;
-    rand1 = -2 * log(rand1);
-    rand2 = (rand() / ((double) RAND_MAX)) * TWO_PI;
-
-    return sqrtf(rand1) * cos(rand2) * sigma + mean;
+    return rand_normal() * sigma + mean;
 }
 
 size_t rand_size_t()
 {
-    return  ((size_t)(rand()&0xff) << 56) | 
-        ((size_t)(rand()&0xff) << 48) |
-        ((size_t)(rand()&0xff) << 40) |
-        ((size_t)(rand()&0xff) << 32) |
-        ((size_t)(rand()&0xff) << 24) |
-        ((size_t)(rand()&0xff) << 16) |
-        ((size_t)(rand()&0xff) << 8) |
-        ((size_t)(rand()&0xff) << 0);
+    return (size_t)rand_u64();
 }
 
 float rand_scale(float s)
 {
     float scale = rand_uniform(1, s);
-    if(rand()%2) return scale;
+    if(rand_u64() & 1) return scale;
     return 1./scale;
 }
 
+static __thread int thread_group_size;
+
+// threads of the parallel loops run by the calling thread, as a num_threads clause; 0: the OpenMP default
+void set_thread_group(int n)
+{
+    thread_group_size = n;
+}
+
+int thread_group()
+{
+#ifdef _OPENMP
+    return thread_group_size > 0 ? thread_group_size : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
 float **one_hot_encode(float *a, int n, int k)
 {
     int i;
@@ -2,6 +2,7 @@
 #define UTILS_H
 #include <stdio.h>
 #include <time.h>
+#include <stdint.h>
 #include "list.h"
 
 #define TIME(a) \
@@ -50,6 +51,11 @@ float sec(clock_t clocks);
 void print_statistics(float *a, int n);
 int int_index(int *a, int val, int n);
 
+void rand_seed(uint64_t seed);
+void rand_stream(uint64_t stream);
+uint64_t rand_layer_stream(uint64_t seen, int layer, int row);
+uint64_t splitmix64(uint64_t *x);
+uint64_t rand_u64();
 float rand_normal();
 float rand_normal_me(float mean, float sigma);
 float rand_uniform(float min, float max);
@@ -74,5 +80,7 @@ void normalize_array(float *a, int n);
 int *read_intlist(char *s, int *n, int d);
 unsigned char *read_file(char *filename);
 size_t rand_size_t();
+void set_thread_group(int n);
+int thread_group();
 #endif
 
@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "utils.h"
 #include "image.h"
 #include "gemm.h"
+#include "blas.h"
+#include "sparse_update.h"
 
 #ifdef GPU
 #include "cuda.h"
@@ -75,6 +78,59 @@ int test_gemm_gpu(int w, int h)
 
 #endif
 
+/* the lazy updates of sparse_update against dense momentum / decay over every row, with random rows getting
+ * gradient each step and random rows read (caught up) in between; returns 0 when they agree */
+int test_sparse_update()
+{
+    int n = 64, size = 16, steps = 500;
+    float lr = 0.01, momentum = 0.9, decay = 0.0005;
+    int batch = 8;
+    float a = -decay * batch, b = lr / batch;
+    float *dense = make_matrix(n, size);
+    float *dense_updates = calloc(n*size, sizeof(float));
+    float *weights = calloc(n*size, sizeof(float));
+    float *weight_updates = calloc(n*size, sizeof(float));
+    memcpy(weights, dense, n*size*sizeof(float));
+    sparse_update *s = make_sparse_update(n, size, n);
+    float max_error = 0;
+    for(int t = 0; t < steps; ++t){
+        int touched = rand_int(0, 8);
+        for(int i = 0; i < touched; ++i){
+            int r = rand_int(0, n - 1);
+            sparse_update_catch_up(s, weights, weight_updates, r);
+            for(int j = 0; j < size; ++j){
+                float g = rand_uniform(-1, 1);
+                dense_updates[r*size + j] += g;
+                weight_updates[r*size + j] += g;
+            }
+            sparse_update_touch(s, r);
+        }
+        axpy_cpu(n*size, a, dense, 1, dense_updates, 1);
+        axpy_cpu(n*size, b, dense_updates, 1, dense, 1);
+        scal_cpu(n*size, momentum, dense_updates, 1);
+        sparse_update_apply(s, weights, weight_updates, a, b, momentum);
+        int r = rand_int(0, n - 1);
+        sparse_update_catch_up(s, weights, weight_updates, r);
+        for(int j = 0; j < size; ++j){
+            max_error = fmaxf(max_error, fabsf(weights[r*size + j] - dense[r*size + j]));
+        }
+    }
+    sparse_update_flush(s, weights, weight_updates);
+    for(int i = 0; i < n*size; ++i){
+        max_error = fmaxf(max_error, fabsf(weights[i] - dense[i]));
+        max_error = fmaxf(max_error, fabsf(weight_updates[i] - dense_updates[i]));
+    }
+    int failed = max_error > 1e-4;
+    printf("sparse update: %d rows, %d steps, max difference to dense %g, %s\n", n, steps, max_error,
+           failed ? "FAILED" : "ok");
+    free_sparse_update(s);
+    free(dense);
+    free(dense_updates);
+    free(weights);
+    free(weight_updates);
+    return failed;
+}
+
 void load_csv_image(char *filename, char *save_dir)
 {
     FILE *fp = fopen(filename, "r");
@@ -156,6 +212,7 @@ int main(int argc, char **argv)
     //test_gemm_gpu(1000, 1000);
     #endif
     //test_image();
+    if(test_sparse_update()) return -1;
     test_load_csv_image();
     return 0;
 }